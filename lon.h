@@ -32,11 +32,31 @@
 
 #define LON_BUFFERSIZE 1024
 #define LON_MAX_LEVEL  256
+#define LON_TAPESIZE   256
+#define LON_MAXNUMERAL 200
+#define LON_KEYARENA   4096
+
+#define LON_FEAT_COMMENT   0x01  /* '--' and '--[[ ]]' comments */
+#define LON_FEAT_LONGSTR   0x02  /* '[[ ]]' long strings */
+#define LON_FEAT_ZAPESC    0x04  /* '\z' escape */
+#define LON_FEAT_UTF8ESC   0x08  /* '\u{XXX}' escape */
+#define LON_FEAT_NONASCII  0x10  /* bytes >= 0x80 in strings */
+#define LON_FEAT_HEXNUM    0x20  /* hexadecimal numerals */
+#define LON_FEAT_ALL       0x3F
+#define LON_FEAT_STRICT    0x00  /* machine generated subset */
+
+#ifndef LON_FEATURES /* features compiled into the lexer */
+# define LON_FEATURES LON_FEAT_ALL
+#endif
+
+#define LON_BINARY_MAGIC   "\x1bLON"  /* binary data starts with it */
+#define LON_BINARY_VERSION 1
 
 #define LON_OK        (0)
 #define LON_ERR      (-1)
 #define LON_ERRMEM   (-2)
 #define LON_ERRFILE  (-3)
+#define LON_DONE      (1)  /* lon_load_next(): no value left */
 
 #if !defined(lon_getlocaledecpoint)
 # ifdef __ANDROID__
@@ -61,6 +81,12 @@ typedef struct lon_Buffer lon_Buffer;
 typedef struct lon_Loader lon_Loader;
 typedef struct lon_Dumper lon_Dumper;
 typedef struct lon_Callbacks lon_Callbacks;
+typedef struct lon_Event lon_Event;
+typedef struct lon_Tape lon_Tape;
+typedef struct lon_Key lon_Key;
+typedef struct lon_Intern lon_Intern;
+typedef struct lon_Index lon_Index;
+typedef struct lon_IndexEntry lon_IndexEntry;
 typedef struct lon_LoaderDumper lon_LoaderDumper;
 
 #if LON_USE_LONGLONG
@@ -78,6 +104,7 @@ typedef float lon_Number;
 typedef const char *lon_Reader (void *ud, size_t *plen);
 typedef size_t      lon_Writer (void *ud, const char *buff, size_t len);
 typedef void        lon_Panic  (void *ud, const char *errmsg);
+typedef void        lon_Flush  (void *ud, const lon_Event *evs, size_t n);
 
 
 /* lon buffer */
@@ -103,20 +130,104 @@ LON_API int lon_addfstring  (lon_Buffer *B, const char *fmt, ...);
 /* lon parser */
 
 LON_API void lon_initloader (lon_Loader *L);
+LON_API void lon_freeloader (lon_Loader *L);
 
 LON_API void lon_setcallbacks (lon_Loader *L, lon_Callbacks *cb);
 LON_API void lon_setpanicf    (lon_Loader *L, lon_Panic *p, void *ud);
 LON_API void lon_setdumper    (lon_Loader *L, lon_Dumper *ld);
 
+#define LON_LOPT_FEATURES  1  /* default: LON_FEAT_ALL */
+#define LON_LOPT_JSON      2  /* default: 0(LON text or binary) */
+#define LON_LOPT_MAXLEVEL  3  /* default: 0(no limit of table levels) */
+#define LON_LOPT_LUAFLOAT  4  /* default: 0(integers to Lua as integers) */
+#define LON_LOPT_KEEPBUFFER 5 /* default: 0(free load buffers after loads) */
+
+LON_API int lon_setloadopt (lon_Loader *L, int opt, int value);
+
 LON_API int  lon_load   (lon_Loader *L, lon_Reader *reader, void *ud);
 LON_API void lon_break  (lon_Loader *L, int res);
 LON_API int  lon_status (lon_Loader *L);
 LON_API int  lon_levels (lon_Loader *L);
+LON_API size_t lon_offset (lon_Loader *L);
+
+LON_API int lon_tointeger (const char *s, size_t len, lon_Integer *v);
+LON_API int lon_tonumber  (const char *s, size_t len, lon_Number *v);
+
+LON_API unsigned lon_hash (const char *s, size_t len);
 
 LON_API int lon_load_buffer (lon_Loader *L, const char *s, size_t len);
 LON_API int lon_load_string (lon_Loader *L, const char *s);
 LON_API int lon_load_file   (lon_Loader *L, const char *filename);
 
+LON_API int lon_validate        (lon_Loader *L, lon_Reader *reader, void *ud);
+LON_API int lon_validate_buffer (lon_Loader *L, const char *s, size_t len);
+
+/* load the next top-level value of a list, one per call; 'reader' starts
+ * at *poffset, which is then moved just past the value (to where the
+ * next call starts); returns LON_DONE when no value is left */
+LON_API int lon_load_next        (lon_Loader *L, lon_Reader *reader,
+                                  void *ud, size_t *poffset);
+LON_API int lon_load_next_buffer (lon_Loader *L, const char *s, size_t len,
+                                  size_t *poffset);
+
+/* load one indexed field, as a table of just that field; 'reader'
+ * starts at e->offset, and 's' is the whole indexed document */
+LON_API int lon_load_field        (lon_Loader *L, lon_Reader *reader,
+                                   void *ud, const lon_IndexEntry *e);
+LON_API int lon_load_field_buffer (lon_Loader *L, const char *s, size_t len,
+                                   const lon_IndexEntry *e);
+LON_API int lon_load_field_file   (lon_Loader *L, const char *filename,
+                                   const lon_IndexEntry *e);
+
+/* files written aside and then moved over the original: lon_tmpfile()
+ * creates a new empty file named after 'filename' and puts its name in
+ * 'name'; lon_replacefile() keeps 'to' untouched if it fails */
+LON_API int lon_tmpfile     (lon_Buffer *name, const char *filename);
+LON_API int lon_replacefile (const char *from, const char *to);
+
+
+/* lon event tape */
+
+#define LON_EV_BEGIN        0
+#define LON_EV_END          1
+#define LON_EV_NIL          2
+#define LON_EV_BOOLEAN      3
+#define LON_EV_INTEGER      4
+#define LON_EV_NUMBER       5
+#define LON_EV_STRING       6
+#define LON_EV_TABLE_BEGIN  7
+#define LON_EV_TABLE_END    8
+
+LON_API void lon_inittape (lon_Tape *T, lon_Flush *flush, void *ud);
+LON_API void lon_settape  (lon_Loader *L, lon_Tape *T);
+
+
+/* lon key intern table */
+
+LON_API void lon_initintern (lon_Intern *I);
+LON_API void lon_freeintern (lon_Intern *I);
+LON_API void lon_setintern  (lon_Loader *L, lon_Intern *I);
+
+LON_API const lon_Key *lon_intern (lon_Intern *I, const char *s, size_t len,
+                                   unsigned hash);
+LON_API const lon_Key *lon_getkey (lon_Intern *I, unsigned id);
+
+
+/* lon offset index */
+
+LON_API void lon_initindex (lon_Index *I, int depth);
+LON_API void lon_freeindex (lon_Index *I);
+LON_API void lon_setindex  (lon_Loader *L, lon_Index *I);
+
+LON_API int lon_index_write (lon_Index *I, const char *filename);
+LON_API int lon_index_read  (lon_Index *I, const char *filename);
+
+LON_API const lon_IndexEntry *lon_index_entries (lon_Index *I, size_t *pn);
+LON_API const lon_IndexEntry *lon_index_find (lon_Index *I, const char *s,
+                                              size_t len);
+LON_API const char *lon_index_key (lon_Index *I, const lon_IndexEntry *e,
+                                   size_t *plen);
+
 
 /* lon dumper */
 
@@ -128,6 +239,9 @@ LON_API int lon_load_file   (lon_Loader *L, const char *filename);
 #define LON_OPT_FLTHEXA    6  /* default: 0(false) */
 #define LON_OPT_FLTPREC    7  /* default: 0(default precision) */
 #define LON_OPT_QUOTE     8  /* default: 0("", 0="", 1='', 2=[[]]) */
+#define LON_OPT_BINARY    9  /* default: 0(text, 1=binary, 2=with key dict) */
+#define LON_OPT_VERBATIM 10  /* default: 0(false) */
+#define LON_OPT_JSON     11  /* default: 0(false) */
 
 LON_API void lon_initdumper (lon_Dumper *D);
 LON_API void lon_setwriter  (lon_Dumper *D, lon_Writer *writer, void *ud);
@@ -145,10 +259,14 @@ LON_API int lon_dump_integer (lon_Dumper *D, lon_Integer v);
 LON_API int lon_dump_number  (lon_Dumper *D, lon_Number v);
 LON_API int lon_dump_string  (lon_Dumper *D, const char *s);
 LON_API int lon_dump_buffer  (lon_Dumper *D, const char *s, size_t len);
+LON_API int lon_dump_raw     (lon_Dumper *D, const char *s, size_t len);
 
 LON_API int lon_dump_table_begin (lon_Dumper *D);
 LON_API int lon_dump_table_end   (lon_Dumper *D);
 
+LON_API int lon_dump_integer_array (lon_Dumper *D, const lon_Integer *v, size_t n);
+LON_API int lon_dump_number_array  (lon_Dumper *D, const lon_Number *v, size_t n);
+
 #ifdef LON_LUA_API
 
 typedef struct lua_State lua_State;
@@ -184,11 +302,98 @@ struct lon_Callbacks {
 
     void (*on_table_begin) (lon_Callbacks *cb);
     void (*on_table_end)   (lon_Callbacks *cb);
+
+    /* optional: runs of positional numerals, 'index' is the position
+     * of v[0] in the current table */
+    void (*on_integer_array) (lon_Callbacks *cb, lon_Integer index,
+                              const lon_Integer *v, size_t n);
+    void (*on_number_array)  (lon_Callbacks *cb, lon_Integer index,
+                              const lon_Number *v, size_t n);
+
+    /* optional: numerals as source text, replaces on_integer/on_number
+     * (and numeral runs) for values; convert with lon_tointeger() or
+     * lon_tonumber() when needed */
+    void (*on_raw_number) (lon_Callbacks *cb, const char *s, size_t len,
+                           int is_int);
+
+    /* optional: string literals as source text, with delimiters and
+     * escapes undecoded, replaces on_string (and on_key) for literals */
+    void (*on_raw_string) (lon_Callbacks *cb, const char *s, size_t len);
+
+    /* optional: string keys, replaces on_string for keys; 'hash' is
+     * lon_hash(s, len), computed by the lexer */
+    void (*on_key) (lon_Callbacks *cb, const char *s, size_t len,
+                    unsigned hash);
+
+    /* optional: string keys interned by lon_setintern() table,
+     * replaces on_key and on_string for keys */
+    void (*on_interned_key) (lon_Callbacks *cb, const lon_Key *key);
+
+    /* optional: key of positional field, replaces on_integer for it */
+    void (*on_index) (lon_Callbacks *cb, lon_Integer index);
+};
+
+struct lon_Event {
+    unsigned char  type;   /* LON_EV_* */
+    unsigned char  status; /* LON_STATUS_* */
+    unsigned short depth;  /* table levels */
+    size_t len;            /* length of string */
+    union {
+        int b;
+        lon_Integer i;
+        lon_Number n;
+        const char *s;     /* valid until flush returns */
+        size_t offset;     /* internal: string offset before flush */
+    } u;
+};
+
+struct lon_Tape {
+    lon_Flush *flush;
+    void *ud;
+    size_t count;
+    lon_Buffer strings;
+    lon_Event events[LON_TAPESIZE];
+};
+
+struct lon_Key {
+    unsigned hash;    /* lon_hash() of key */
+    unsigned id;      /* 0, 1, 2... in intern order */
+    size_t len;
+    char s[1];        /* NUL terminated, stable until lon_freeintern() */
+};
+
+struct lon_Intern {
+    size_t count;     /* keys interned */
+    size_t size;      /* slots, power of 2 */
+    lon_Key **slots;  /* open addressing, followed by keys in id order */
+    char *arena;      /* current chunk, chunks are linked by first pointer */
+    size_t used;      /* bytes used in current chunk */
+};
+
+struct lon_IndexEntry {
+    size_t offset;     /* after the separator before the field */
+    size_t size;       /* up to the separator after it */
+    int line;          /* line at offset */
+    lon_Integer index; /* positional index or integer key, else 0 */
+    size_t key;        /* string key in lon_Index.keys, or (size_t)-1 */
+    size_t keylen;
+};
+
+struct lon_Index {
+    int depth;         /* table level of indexed fields, 1 for top-level */
+    lon_Buffer entries;/* lon_IndexEntry */
+    lon_Buffer keys;   /* NUL terminated string keys */
+    size_t *slots;     /* entry + 1 by key hash, built on first lookup */
+    size_t mask;
 };
 
 struct lon_Loader {
     jmp_buf jbuf;
     lon_Callbacks *cb;
+    lon_Tape *tape;
+    lon_Intern *intern;
+    lon_Index *index;
+    const lon_IndexEntry *field; /* only load this field */
     lon_Panic *panicf;
     lon_Reader *reader;
     void *ud, *panic_ud;
@@ -196,8 +401,12 @@ struct lon_Loader {
     /* special load callbacks */
     lon_Dumper *dumper;
     void *lua_state;
+    int luafloat;     /* push all numerals to Lua as floats */
 
+    unsigned strict;  /* rejected LON_FEAT_* features */
     int levels;       /* table levels */
+    int maxlevels;    /* error beyond this many levels, 0 for no limit */
+    int keepbuffer;   /* buffer bytes kept between loads */
     int status;       /* callback status */
 #define LON_STATUS_TOP    0
 #define LON_STATUS_KEY    1
@@ -205,6 +414,15 @@ struct lon_Loader {
 
     size_t n;         /* bytes still unread */
     const char *p;    /* bytes still unread */
+    const char *chunk;/* current chunk from reader */
+    size_t offset;    /* bytes before current chunk */
+    int validate;     /* only check syntax */
+    int json;         /* read JSON texts */
+    int once;         /* stop after one top-level value */
+    int rawnumber;    /* numerals go to on_raw_number() as written */
+    int rawstring;    /* strings go to on_raw_string() as written */
+    size_t next;      /* where lon_load_next() left off */
+    int nextline;     /* line number at 'next' */
 
     const char *name; /* name of readed chunk */
     int line;         /* current line number */
@@ -212,11 +430,14 @@ struct lon_Loader {
     int seplen;       /* length of string's delimiter */
     int token;        /* current token */
     int decpoint;     /* decimal point */
+    unsigned hash;    /* lon_hash() of current name */
 
     lon_Integer iv;
     lon_Number nv;
     lon_Buffer buffer; /* token data */
     lon_Buffer errmsg; /* error message */
+    lon_Buffer array;  /* pending numeral run */
+    lon_Intern bkeys;  /* key dictionary of binary data */
 };
 
 struct lon_Dumper {
@@ -232,12 +453,19 @@ struct lon_Dumper {
     unsigned opt_flt_hexa   : 1;
     unsigned opt_flt_prec   : 4;
     unsigned opt_str_quote    : 4;
+    unsigned opt_binary     : 2;
+    unsigned opt_verbatim   : 1;
+    unsigned opt_json       : 1;
 
+    lon_Intern keydict; /* keys written in binary */
     size_t levels;
+    size_t jskip;       /* skipped tables opened in JSON */
+    unsigned jdrop;     /* keys and values left to skip in JSON */
     struct {
-        unsigned iskey : 1;
-        unsigned subsq : 1;
-        unsigned index : 30;
+        unsigned iskey  : 1;
+        unsigned subsq  : 1;
+        unsigned object : 1; /* JSON object, or array */
+        unsigned index  : 29;
     } stack[LON_MAX_LEVEL];
     size_t buff_size;
     char buffer[LON_BUFFERSIZE];
@@ -260,6 +488,14 @@ LON_NS_END
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+# ifndef WIN32_LEAN_AND_MEAN
+#   define WIN32_LEAN_AND_MEAN
+# endif
+# include <windows.h> /* MoveFileExA */
+#endif
 
 
 LON_NS_BEGIN
@@ -272,10 +508,33 @@ LON_NS_BEGIN
 #include <lua.h>
 #include <lauxlib.h>
 
+#ifndef LON_LUA_PENDING
+# define LON_LUA_PENDING 32 /* fields kept on stack to size a table */
+#endif
+
+/* fields of a table are left on the stack until it ends, or until
+ * LON_LUA_PENDING of them are seen; the table is then created with its
+ * size known and later fields are set into it directly */
+typedef struct lonL_LuaTable {
+    int base;            /* stack top before the fields */
+    int n, npos;         /* pending fields, positional ones */
+    unsigned char keyed[(LON_LUA_PENDING + CHAR_BIT-1) / CHAR_BIT];
+                         /* bit i set if pending field i has a key */
+    int direct;          /* table is created */
+    int positional;      /* value of a positional field is expected */
+    lon_Integer index;   /* and its index */
+} lonL_LuaTable;
+
+#define lonL_iskeyed(t,i)  ((t)->keyed[(i)/CHAR_BIT] & (1u << (i)%CHAR_BIT))
+#define lonL_setkeyed(t,i) \
+    ((t)->keyed[(i)/CHAR_BIT] |= (unsigned char)(1u << (i)%CHAR_BIT))
+
 typedef struct lonL_LuaState {
     lua_State *L;
     size_t size;
     size_t capacity;
+    int keys;  /* stack index of interned key strings, or 0 */
+    lonL_LuaTable tables[LON_MAX_LEVEL];
 } lonL_LuaState;
 
 LON_API void lon_setluastate(lon_Loader *L, lua_State *LS)
@@ -289,15 +548,47 @@ static void lonL_growstack(lonL_LuaState *ls, size_t n) {
     }
 }
 
-static void lonL_updatelua(lon_Callbacks *cb) {
+static void lonL_maketable(lonL_LuaState *ls, lonL_LuaTable *t, int narr) {
+    /* create table of pending fields, with room for 'narr' more items */
+    int i, slot = t->base + 2;
+    lua_Integer index = 0;
+    lua_createtable(ls->L, t->npos + narr, t->n - t->npos);
+    lua_insert(ls->L, t->base + 1);
+    for (i = 0; i < t->n; ++i) {
+        lua_pushvalue(ls->L, slot++);
+        if (!lonL_iskeyed(t, i))
+            lua_rawseti(ls->L, t->base + 1, ++index);
+        else {
+            lua_pushvalue(ls->L, slot++);
+            lua_rawset(ls->L, t->base + 1);
+        }
+    }
+    lua_settop(ls->L, t->base + 1);
+    t->n = t->npos = 0, t->direct = 1;
+    memset(t->keyed, 0, sizeof(t->keyed));
+}
+
+static void lonL_updatelua(lon_Callbacks *cb, int level) {
     lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
+    lonL_LuaTable *t;
     switch (lon_status(cb->loader)) {
     case LON_STATUS_TOP:
         lonL_growstack(ls, 1);
         ++ls->size;
         break;
     case LON_STATUS_VALUE:
-        lua_rawset(ls->L, -3);
+        t = &ls->tables[level-1];
+        if (t->direct && t->positional)
+            lua_rawseti(ls->L, -2, (lua_Integer)t->index);
+        else if (t->direct)
+            lua_rawset(ls->L, -3);
+        else {
+            if (t->positional) ++t->npos;
+            else lonL_setkeyed(t, t->n);
+            if (++t->n >= LON_LUA_PENDING)
+                lonL_maketable(ls, t, 0);
+        }
+        t->positional = 0;
         break;
     }
 }
@@ -310,41 +601,102 @@ static void lonL_lua_onerror(lon_Callbacks *cb, const char *errmsg) {
 static void lonL_lua_onnil(lon_Callbacks *cb) {
     lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
     lua_pushnil(ls->L);
-    lonL_updatelua(cb);
+    lonL_updatelua(cb, cb->loader->levels);
 }
 
 static void lonL_lua_onboolean(lon_Callbacks *cb, int value) {
     lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
     lua_pushboolean(ls->L, value);
-    lonL_updatelua(cb);
+    lonL_updatelua(cb, cb->loader->levels);
 }
 
 static void lonL_lua_oninteger(lon_Callbacks *cb, lon_Integer value) {
     lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
-    lua_pushinteger(ls->L, value);
-    lonL_updatelua(cb);
+    if (cb->loader->luafloat)
+        lua_pushnumber(ls->L, (lua_Number)value);
+    else
+        lua_pushinteger(ls->L, value);
+    lonL_updatelua(cb, cb->loader->levels);
 }
 
 static void lonL_lua_onnumber(lon_Callbacks *cb, lon_Number value) {
     lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
     lua_pushnumber(ls->L, value);
-    lonL_updatelua(cb);
+    lonL_updatelua(cb, cb->loader->levels);
 }
 
 static void lonL_lua_onstring(lon_Callbacks *cb, const char *s, size_t len) {
     lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
     lua_pushlstring(ls->L, s, len);
-    lonL_updatelua(cb);
+    lonL_updatelua(cb, cb->loader->levels);
+}
+
+static void lonL_lua_oninternedkey(lon_Callbacks *cb, const lon_Key *k) {
+    lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
+    if (lua_rawgeti(ls->L, ls->keys, (lua_Integer)k->id + 1) == LUA_TNIL) {
+        lua_pop(ls->L, 1);
+        lua_pushlstring(ls->L, k->s, k->len);
+        lua_pushvalue(ls->L, -1);
+        lua_rawseti(ls->L, ls->keys, (lua_Integer)k->id + 1);
+    }
+    lonL_updatelua(cb, cb->loader->levels);
+}
+
+static void lonL_lua_onindex(lon_Callbacks *cb, lon_Integer index) {
+    lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
+    lonL_LuaTable *t = &ls->tables[cb->loader->levels-1];
+    t->positional = 1, t->index = index;
+}
+
+static void lonL_lua_onintegerarray(lon_Callbacks *cb, lon_Integer index,
+                                    const lon_Integer *v, size_t n) {
+    lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
+    lonL_LuaTable *t = &ls->tables[cb->loader->levels-1];
+    size_t i;
+    if (!t->direct && t->n + n >= LON_LUA_PENDING)
+        lonL_maketable(ls, t, (int)n);
+    for (i = 0; i < n; ++i) {
+        if (cb->loader->luafloat)
+            lua_pushnumber(ls->L, (lua_Number)v[i]);
+        else
+            lua_pushinteger(ls->L, (lua_Integer)v[i]);
+        if (t->direct) lua_rawseti(ls->L, -2, (lua_Integer)(index + i));
+    }
+    if (!t->direct) t->n += (int)n, t->npos += (int)n;
+}
+
+static void lonL_lua_onnumberarray(lon_Callbacks *cb, lon_Integer index,
+                                   const lon_Number *v, size_t n) {
+    lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
+    lonL_LuaTable *t = &ls->tables[cb->loader->levels-1];
+    size_t i;
+    if (!t->direct && t->n + n >= LON_LUA_PENDING)
+        lonL_maketable(ls, t, (int)n);
+    for (i = 0; i < n; ++i) {
+        lua_pushnumber(ls->L, (lua_Number)v[i]);
+        if (t->direct) lua_rawseti(ls->L, -2, (lua_Integer)(index + i));
+    }
+    if (!t->direct) t->n += (int)n, t->npos += (int)n;
 }
 
 static void lonL_lua_ontablebegin(lon_Callbacks *cb) {
     lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
-    lonL_growstack(ls, 3);
-    lua_newtable(ls->L);
+    lonL_LuaTable *t;
+    if (cb->loader->levels > LON_MAX_LEVEL)
+        luaL_error(ls->L, "too many nested tables");
+    luaL_checkstack(ls->L, LON_LUA_PENDING*2 + 3, "too many tables");
+    t = &ls->tables[cb->loader->levels-1];
+    t->base = lua_gettop(ls->L);
+    t->n = t->npos = 0;
+    t->direct = t->positional = 0;
+    memset(t->keyed, 0, sizeof(t->keyed));
 }
 
 static void lonL_lua_ontableend(lon_Callbacks *cb) {
-    lonL_updatelua(cb);
+    lonL_LuaState *ls = (lonL_LuaState*)cb->loader->lua_state;
+    lonL_LuaTable *t = &ls->tables[cb->loader->levels-1];
+    if (!t->direct) lonL_maketable(ls, t, 0);
+    lonL_updatelua(cb, cb->loader->levels-1);
 }
 
 static void lonL_initluacb(lon_Loader *L, lon_Callbacks *cb) {
@@ -356,37 +708,59 @@ static void lonL_initluacb(lon_Loader *L, lon_Callbacks *cb) {
     cb->on_string      = lonL_lua_onstring;
     cb->on_table_begin = lonL_lua_ontablebegin;
     cb->on_table_end   = lonL_lua_ontableend;
+    cb->on_index       = lonL_lua_onindex;
+    cb->on_integer_array = lonL_lua_onintegerarray;
+    cb->on_number_array  = lonL_lua_onnumberarray;
+    if (L->intern) cb->on_interned_key = lonL_lua_oninternedkey;
     L->cb = cb;
 }
 
-static void lonD_pushvalue(lon_Dumper *D, lua_State *L, int idx, int t);
-
-static int lonD_relindex(int idx, int onstack) {
-    return idx >= 0 || idx <= LUA_REGISTRYINDEX ?
-        idx : idx - onstack;
-}
-
-static void lonD_pushtable(lon_Dumper *D, lua_State *L, int idx, int t) {
-    luaL_checkstack(L, 6, "too many tables");
-    lua_pushnil(L);
-    idx = lonD_relindex(idx, 1);
+typedef struct lonD_LuaPath {
+    const void *tables[LON_MAX_LEVEL]; /* tables being dumped */
+    int n;
+    int arg;   /* index of value passed to lon_dump_value() */
+} lonD_LuaPath;
+
+static void lonD_pushvalue(lon_Dumper *D, lua_State *L, int idx,
+                           lonD_LuaPath *p);
+
+static void lonD_pushtable(lon_Dumper *D, lua_State *L, int idx,
+                           lonD_LuaPath *p) {
+    /* array part first, so its keys are written as positional fields */
+    const void *t = lua_topointer(L, idx);
+    lua_Integer i, n = (lua_Integer)lua_rawlen(L, idx);
+    int k;
+    idx = lua_absindex(L, idx);
+    for (k = 0; k < p->n; ++k)
+        if (p->tables[k] == t)
+            luaL_argerror(L, p->arg, "attempt to dump a recursion table");
+    if (p->n == LON_MAX_LEVEL)
+        luaL_argerror(L, p->arg, "too many nested tables");
+    luaL_checkstack(L, 4, "too many tables");
+    p->tables[p->n++] = t;
     lon_dump_table_begin(D);
+    for (i = 1; i <= n; ++i) {
+        if (lua_rawgeti(L, idx, i) != LUA_TNIL) {
+            lon_dump_integer(D, (lon_Integer)i);
+            lonD_pushvalue(D, L, -1, p);
+        }
+        lua_pop(L, 1);
+    }
+    lua_pushnil(L);
     while (lua_next(L, idx)) {
-        const void *pk = lua_topointer(L, -2);
-        const void *pv = lua_topointer(L, -1);
-        int extra = 0;
-        if ((pk != NULL && lua_rawgetp(L, t, pk) != LUA_TNIL)
-                || (pv != NULL && lua_rawgetp(L, t, pv) != LUA_TNIL))
-            luaL_argerror(L, idx, "attempt to dump a recursion table");
-        extra += (pk != NULL) + (pv != NULL);
-        lonD_pushvalue(D, L, -2-extra, t);
-        lonD_pushvalue(D, L, -1-extra, t);
-        lua_pop(L, extra+1);
+        if (!lua_isinteger(L, -2) || (i = lua_tointeger(L, -2)) < 1
+                || i > n) {
+            lonD_pushvalue(D, L, -2, p);
+            lonD_pushvalue(D, L, -1, p);
+        }
+        lua_pop(L, 1);
     }
     lon_dump_table_end(D);
+    --p->n;
 }
 
-static void lonD_pushvalue(lon_Dumper *D, lua_State *L, int idx, int t) {
+static void lonD_pushvalue(lon_Dumper *D, lua_State *L, int idx,
+                           lonD_LuaPath *p) {
     switch (lua_type(L, idx)) {
     case LUA_TNIL:
         lon_dump_nil(D);
@@ -408,28 +782,21 @@ static void lonD_pushvalue(lon_Dumper *D, lua_State *L, int idx, int t) {
         }
         break;
     case LUA_TTABLE:
-        if (t != 0)
-            lonD_pushtable(D, L, idx, t);
-        else {
-            lua_createtable(L, 0, 2);
-            lua_pushboolean(L, 1);
-            lua_rawsetp(L, -2, lua_topointer(L, lonD_relindex(idx, 2)));
-            t = lua_gettop(L);
-            lonD_pushtable(D, L, lonD_relindex(idx, 1), t);
-            assert(lua_gettop(L) == t);
-            lua_pop(L, 1);
-        }
+        lonD_pushtable(D, L, idx, p);
         break;
     default:
         lua_pushfstring(L,
                 "attempt to dump a %s value",
                 luaL_typename(L, idx));
-        luaL_argerror(L, idx, lua_tostring(L, -1));
+        luaL_argerror(L, p->arg, lua_tostring(L, -1));
     }
 }
 
-LON_API void lon_dump_value(lon_Dumper *D, lua_State *L, int idx)
-{ lonD_pushvalue(D, L, idx, 0); }
+LON_API void lon_dump_value(lon_Dumper *D, lua_State *L, int idx) {
+    lonD_LuaPath p;
+    p.n = 0, p.arg = lua_absindex(L, idx);
+    lonD_pushvalue(D, L, idx, &p);
+}
 
 #endif /* LON_LUA_API */
 
@@ -512,6 +879,15 @@ int lon_encode_utf8(char *buff, unsigned long x) {
     return n;
 }
 
+#define LON_HASHBASIS 2166136261u
+#define lon_hashstep(h, ch) (((h) ^ ((ch)&0xFF)) * 16777619u) /* FNV-1a */
+
+LON_API unsigned lon_hash(const char *s, size_t len) {
+    unsigned h = LON_HASHBASIS;
+    while (len--) h = lon_hashstep(h, *s++);
+    return h;
+}
+
 static int lon_checkneg(const char **s) {
     if (**s == '-') { ++(*s); return 1; }
     else if (**s == '+') ++(*s);
@@ -542,6 +918,43 @@ static lon_Integer lon_str2integer(const char *s, char **endptr) {
     return (lon_Integer)(neg ? 0ull - a : a);
 }
 
+#if !defined(LON_SWAR) && (defined(__BYTE_ORDER__) \
+        && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+        || defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64))
+# define LON_SWAR 1 /* parse 8 digits at once */
+#endif
+
+#if LON_SWAR
+static int lon_isdigit8(unsigned long long x) {
+    return ((x & 0xF0F0F0F0F0F0F0F0ull)
+            | (((x + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4))
+        == 0x3333333333333333ull;
+}
+
+static unsigned long long lon_digit8(unsigned long long x) {
+    x = ((x & 0x0F0F0F0F0F0F0F0Full) * 2561) >> 8;
+    x = ((x & 0x00FF00FF00FF00FFull) * 6553601) >> 16;
+    return ((x & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32;
+}
+#endif /* LON_SWAR */
+
+static const char *lon_scandecimal(const char *s, const char *e,
+                                   unsigned long long *pv) {
+    /* accumulate decimal digits in [s, e), returns end of digits */
+    unsigned long long v = 0;
+#if LON_SWAR
+    unsigned long long x;
+    while (e - s >= 8 && (memcpy(&x, s, 8), lon_isdigit8(x))) {
+        v = v * 100000000u + lon_digit8(x);
+        s += 8;
+    }
+#endif
+    for (; s < e && lon_isdigit(*s); ++s)
+        v = v * 10 + (*s - '0');
+    *pv = v;
+    return s;
+}
+
 static lon_Number lon_strx2number(const char *s, char **endptr) {
     lon_Number r = 0.0;
     int sigdig = 0;  /* number of significant digits */
@@ -646,7 +1059,7 @@ LON_API int lon_addchar(lon_Buffer *B, int ch) {
 }
 
 LON_API int lon_addlstring(lon_Buffer *B, const char *s, size_t len) {
-    char *ptr = (char*)lon_prepbuffsize(B, 1);
+    char *ptr = (char*)lon_prepbuffsize(B, len);
     if (ptr == NULL) return 0;
     memcpy(ptr, s, len);
     return B->size += len;
@@ -655,18 +1068,18 @@ LON_API int lon_addlstring(lon_Buffer *B, const char *s, size_t len) {
 LON_API int lon_addvfstring(lon_Buffer *B, const char *fmt, va_list l) {
     const size_t init_size = 80;
     void *ptr;
-    size_t len;
+    int len;
     va_list l_count;
     if ((ptr = lon_prepbuffsize(B, init_size+1)) == NULL)
         return 0;
     va_copy(l_count, l);
-    len = vsnprintf((char*)ptr, init_size, fmt, l_count);
+    len = vsnprintf((char*)ptr, init_size+1, fmt, l_count);
     va_end(l_count);
     if (len < 0) return 0;
-    if (len > init_size) {
+    if ((size_t)len > init_size) {
         if ((ptr = lon_prepbuffsize(B, len+1)) == NULL)
             return 0;
-        vsnprintf((char*)ptr, len, fmt, l);
+        vsnprintf((char*)ptr, len+1, fmt, l);
     }
     return B->size += len;
 }
@@ -681,6 +1094,87 @@ LON_API int lon_addfstring(lon_Buffer *B, const char *fmt, ...) {
 }
 
 
+/* lon key intern table */
+
+#define lon_keyalign(n) (((n) + sizeof(size_t)-1) & ~(sizeof(size_t)-1))
+#define lon_keys(I)     ((I)->slots + (I)->size)
+
+LON_API void lon_initintern(lon_Intern *I)
+{ memset(I, 0, sizeof(*I)); }
+
+LON_API void lon_setintern(lon_Loader *L, lon_Intern *I)
+{ L->intern = I; }
+
+LON_API void lon_freeintern(lon_Intern *I) {
+    while (I->arena != NULL) {
+        char *prev = *(char**)I->arena;
+        free(I->arena);
+        I->arena = prev;
+    }
+    free(I->slots);
+    lon_initintern(I);
+}
+
+static int lon_resizeintern(lon_Intern *I) {
+    size_t i, newsize = I->size ? I->size*2 : 64;
+    lon_Key **slots = (lon_Key**)malloc((newsize + newsize/2)*sizeof(lon_Key*));
+    if (slots == NULL) return 0;
+    memset(slots, 0, newsize*sizeof(lon_Key*));
+    for (i = 0; i < I->count; ++i) {
+        lon_Key *k = lon_keys(I)[i];
+        size_t h = k->hash & (newsize - 1);
+        while (slots[h] != NULL)
+            h = (h + 1) & (newsize - 1);
+        slots[h] = slots[newsize + i] = k;
+    }
+    free(I->slots);
+    I->slots = slots;
+    I->size = newsize;
+    return 1;
+}
+
+static lon_Key *lon_newkey(lon_Intern *I, size_t len) {
+    size_t size = lon_keyalign(offsetof(lon_Key, s) + len + 1);
+    lon_Key *k;
+    if (I->arena == NULL || I->used + size > LON_KEYARENA) {
+        size_t chunk = lon_keyalign(sizeof(char*));
+        char *arena = (char*)malloc(size + chunk > LON_KEYARENA ?
+                size + chunk : LON_KEYARENA);
+        if (arena == NULL) return NULL;
+        *(char**)arena = I->arena;
+        I->arena = arena;
+        I->used = chunk;
+    }
+    k = (lon_Key*)(I->arena + I->used);
+    I->used += size;
+    return k;
+}
+
+LON_API const lon_Key *lon_intern(lon_Intern *I, const char *s, size_t len,
+                                  unsigned hash) {
+    lon_Key *k;
+    size_t h;
+    if (I->count >= I->size/2 && !lon_resizeintern(I))
+        return NULL;
+    for (h = hash & (I->size - 1); (k = I->slots[h]) != NULL;
+            h = (h + 1) & (I->size - 1))
+        if (k->hash == hash && k->len == len && memcmp(k->s, s, len) == 0)
+            return k;
+    if ((k = lon_newkey(I, len)) == NULL)
+        return NULL;
+    k->hash = hash;
+    k->id = (unsigned)I->count;
+    k->len = len;
+    memcpy(k->s, s, len);
+    k->s[len] = '\0';
+    I->slots[h] = lon_keys(I)[I->count++] = k;
+    return k;
+}
+
+LON_API const lon_Key *lon_getkey(lon_Intern *I, unsigned id)
+{ return id < I->count ? lon_keys(I)[id] : NULL; }
+
+
 /* lon lexer */
 
 #define LON_EOZ (-1) /* end of buffer */
@@ -689,6 +1183,17 @@ LON_API int lon_addfstring(lon_Buffer *B, const char *fmt, ...) {
 #define lonX_save(L,ch)    lon_addchar(&(L)->buffer,(ch))
 #define lonX_endstring(L)  (*lon_prepbuffsize(&(L)->buffer, 1) = '\0')
 #define lonX_save_next(L)  (lonX_save(L,(L)->current), lonX_next(L))
+#define lonX_keep_next(L)  (lonX_keep(L) ? lonX_save_next(L) : lonX_next(L))
+
+#define lonX_allow(L,F) \
+    ((LON_FEATURES & LON_FEAT_##F) && !((L)->strict & LON_FEAT_##F))
+
+/* validation drops token text, except where an index takes its keys */
+#define lonX_keep(L) (!(L)->validate \
+        || ((L)->index && (L)->levels == (L)->index->depth))
+
+#define lonX_rawnumber(L) ((L)->rawnumber)
+#define lonX_rawstring(L) ((L)->rawstring)
 
 enum LON_RESERVED {
     /* terminal symbols denoted by reserved words */
@@ -720,15 +1225,16 @@ static int lonX_next(lon_Loader *L) {
         if (L->current == LON_EOZ)
             return LON_EOZ;
         buff = L->reader(L->ud, &size);
+        L->offset += L->p - L->chunk;
         if (buff == NULL || size == 0) {
             L->n = 0;
-            L->p = NULL;
+            L->p = L->chunk = NULL;
             return L->current = LON_EOZ;
         }
         L->n = size - 1;
-        L->p = buff;
+        L->p = L->chunk = buff;
     }
-    return L->current = *L->p++;
+    return L->current = (unsigned char)*L->p++;
 }
 
 static int lonX_check_next2(lon_Loader *L, const char *set) {
@@ -749,9 +1255,12 @@ static void lonX_addtoken(lon_Loader *L, int token) {
     switch (token) {
     case TK_NAME: case TK_STRING:
     case TK_FLT: case TK_INT:
-        lonX_save(L, '\0');
-        lon_addfstring(&L->errmsg, "'%s'", lon_buffer(&L->buffer));
-        break;
+        if (lon_buffsize(&L->buffer) != 0) { /* not saved in validation */
+            lonX_save(L, '\0');
+            lon_addfstring(&L->errmsg, "'%s'", lon_buffer(&L->buffer));
+            break;
+        }
+        /* FALLTHROUGH */
     default:
         if (token < LON_FIRST_RESERVED) {  /* single-byte symbols? */
             assert(token == (unsigned char)token);
@@ -776,6 +1285,7 @@ static void lonX_error(lon_Loader *L, const char *msg, int token) {
         lon_addstring(&L->errmsg, " near ");
         lonX_addtoken(L, token);
     }
+    *lon_prepbuffsize(&L->errmsg, 1) = '\0';
     if (L->cb && L->cb->on_error)
         L->cb->on_error(L->cb, L->errmsg.buff);
     else if (L->panicf)
@@ -801,7 +1311,7 @@ static int lonX_checkkeyword(const char *s, size_t len) {
     case 'n': KW("nil", TK_NIL); KW("not", TK_NOT); break;
     case 'o': KW("or", TK_OR); break;
     case 'r': KW("repeat", TK_REPEAT); KW("return", TK_RETURN); break;
-    case 't': KW("then", TK_THEN); break;
+    case 't': KW("then", TK_THEN); KW("true", TK_TRUE); break;
     case 'u': KW("until", TK_UNTIL); break;
     case 'w': KW("while", TK_WHILE); break;
 #undef KW
@@ -809,32 +1319,71 @@ static int lonX_checkkeyword(const char *s, size_t len) {
     return TK_NAME;
 }
 
-static int lonX_checknumber(lon_Loader *L) {
-    size_t i, size = lon_buffsize(&L->buffer);
-    char *s = lon_buffer(&L->buffer), *endptr;
-    L->iv = lon_str2integer(s, (char**)&endptr);
+static int lon_str2number(char *s, size_t size, int *decpoint,
+                          lon_Integer *iv, lon_Number *nv) {
+    /* convert NUL terminated numeral 's', returns 0 if malformed */
+    size_t i;
+    char *endptr;
+    *iv = lon_str2integer(s, (char**)&endptr);
     if (endptr-s == size)
         return TK_INT;
-    L->nv = lon_strx2number(s, (char**)&endptr);
+    *nv = lon_strx2number(s, (char**)&endptr);
     if (endptr-s == size)
         return TK_FLT;
-    L->nv = (lon_Number)strtod(s, (char**)&endptr);
+    *nv = (lon_Number)strtod(s, (char**)&endptr);
     if (endptr-s == size)
         return TK_FLT;
-    if (L->decpoint == '\0')
-        L->decpoint = lon_getlocaledecpoint();
-    if (L->decpoint != '.') {
+    if (*decpoint == '\0')
+        *decpoint = lon_getlocaledecpoint();
+    if (*decpoint != '.') {
         for (i = 0; i < size; ++i)
             if (s[i] == '.')
-                s[i] = L->decpoint;
-        L->nv = (lon_Number)strtod(s, (char**)&endptr);
+                s[i] = *decpoint;
+        *nv = (lon_Number)strtod(s, (char**)&endptr);
         if (endptr-s == size)
             return TK_FLT;
     }
-    lonX_error(L, "malformed number", TK_FLT);
     return 0;
 }
 
+static int lonX_checknumber(lon_Loader *L) {
+    int tk = lon_str2number(lon_buffer(&L->buffer),
+            lon_buffsize(&L->buffer), &L->decpoint, &L->iv, &L->nv);
+    if (tk == 0)
+        lonX_error(L, "malformed number", TK_FLT);
+    return tk;
+}
+
+static int lonX_numeraltype(const char *s, const char *e) {
+    /* syntax of numeral only, without conversion; 0 if malformed */
+    int hex = 0, digits = 0, flt = 0;
+    if (e - s > 1 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        hex = 1, s += 2;
+    for (; s < e && (hex ? lon_isxdigit(*s) : lon_isdigit(*s)); ++s)
+        ++digits;
+    if (s < e && *s == '.')
+        for (flt = 1, ++s; s < e && (hex ? lon_isxdigit(*s)
+                    : lon_isdigit(*s)); ++s)
+            ++digits;
+    if (digits != 0 && s < e && (*s | 0x20) == (hex ? 'p' : 'e')) {
+        flt = 1, ++s;
+        if (s < e && (*s == '+' || *s == '-')) ++s;
+        if (s == e || !lon_isdigit(*s)) digits = 0;
+        while (s < e && lon_isdigit(*s)) ++s;
+    }
+    if (digits == 0 || s != e)
+        return 0;
+    return flt ? TK_FLT : TK_INT;
+}
+
+static int lonX_checknumeral(lon_Loader *L) {
+    const char *s = lon_buffer(&L->buffer);
+    int tk = lonX_numeraltype(s, s + lon_buffsize(&L->buffer));
+    if (tk == 0)
+        lonX_error(L, "malformed number", TK_FLT);
+    return tk;
+}
+
 static void lonX_checkescape(lon_Loader *L, int check, const char *msg) {
     if (!check) {
         if (L->current != LON_EOZ)
@@ -843,6 +1392,58 @@ static void lonX_checkescape(lon_Loader *L, int check, const char *msg) {
     }
 }
 
+static void lonX_saverun(lon_Loader *L, int del) {
+    /* save a run of plain characters straight from current chunk */
+    const char *s = L->p - 1, *e = L->p + L->n, *q = s + 1;
+    while (q < e && *q != del && *q != '\\' && !lon_isnewline(*q)
+            && (lonX_allow(L, NONASCII) || (*q & 0x80) == 0))
+        ++q;
+    if (lonX_keep(L)) lon_addlstring(&L->buffer, s, q - s);
+    L->n -= q - L->p;
+    L->p = q;
+    lonX_next(L);
+}
+
+static void lonX_saveclass(lon_Loader *L, int mask) {
+    /* save a run of characters in class 'mask' from current chunk */
+    const char *s = L->p - 1, *e = L->p + L->n, *q = s + 1;
+    while (q < e && lon_checkmask(*q, mask))
+        ++q;
+    lon_addlstring(&L->buffer, s, q - s);
+    L->n -= q - L->p;
+    L->p = q;
+    lonX_next(L);
+}
+
+static int lonX_name(lon_Loader *L) {
+    /* identifier or reserved word, hashed while scanning */
+    unsigned h = LON_HASHBASIS;
+    if (!lonX_keep(L)) { /* only tell keywords, in place if possible */
+        const char *s = L->p - 1, *e = L->p + L->n, *q = s;
+        while (q < e && lon_isalnum(*q)) ++q;
+        if (q < e) {
+            int tk = lonX_checkkeyword(s, q - s);
+            L->n -= q - L->p;
+            L->p = q;
+            lonX_next(L);
+            return tk;
+        }
+    }
+    do {
+        const char *s = L->p - 1, *e = L->p + L->n, *q = s;
+        for (; q < e && lon_isalnum(*q); ++q)
+            h = lon_hashstep(h, *q);
+        lon_addlstring(&L->buffer, s, q - s);
+        L->n -= q - L->p;
+        L->p = q;
+        lonX_next(L);
+    } while (lon_isalnum(L->current));
+    L->hash = h;
+    lonX_endstring(L);
+    return lonX_checkkeyword(lon_buffer(&L->buffer),
+            lon_buffsize(&L->buffer));
+}
+
 static int lonX_checkhexa(lon_Loader *L) {
     lonX_save_next(L);
     lonX_checkescape(L, lon_isxdigit(L->current),
@@ -854,9 +1455,9 @@ static int lonX_sep(lon_Loader *L) {
     int count = 0;
     int s = L->current;
     assert(s == '[' || s == ']');
-    lonX_save_next(L);
+    lonX_keep_next(L);
     while (L->current == '=') {
-        lonX_save_next(L);
+        lonX_keep_next(L);
         count++;
     }
     return (L->current == s) ? count : (-count) - 1;
@@ -916,9 +1517,12 @@ static void lonX_newline(lon_Loader *L) {
 
 static void lonX_long_string(lon_Loader *L, int iscomment, int sep) {
     int line = L->line;  /* initial line (for error message) */
-    lonX_save_next(L);  /* skip 2nd '[' */
-    if (lon_isnewline(L->current))  /* string starts with a newline? */
+    lonX_keep_next(L);  /* skip 2nd '[' */
+    if (lon_isnewline(L->current)) {  /* string starts with a newline? */
+        if (!iscomment && lonX_rawstring(L))
+            lonX_save(L, '\n');  /* literal keeps it */
         lonX_newline(L);  /* skip it */
+    }
     for (;;) {
         switch (L->current) {
         case LON_EOZ:
@@ -930,17 +1534,19 @@ static void lonX_long_string(lon_Loader *L, int iscomment, int sep) {
             break;
         case ']':
             if (lonX_sep(L) == sep) {
-                lonX_save_next(L);
+                lonX_keep_next(L);
                 if (iscomment) lon_resetbuffer(&L->buffer);
                 return;
             }
             break;
         case '\n': case '\r':
-            if (!iscomment) lonX_save(L, '\n');
+            if (!iscomment && lonX_keep(L)) lonX_save(L, '\n');
             lonX_newline(L);
             break;
-        default: 
-            if (!iscomment) lonX_save(L, L->current);
+        default:
+            if (!lonX_allow(L, NONASCII) && (L->current & 0x80))
+                lonX_error(L, "non-ASCII character not allowed", 0);
+            if (!iscomment && lonX_keep(L)) lonX_save(L, L->current);
             lonX_next(L);
         }
     }
@@ -948,7 +1554,7 @@ static void lonX_long_string(lon_Loader *L, int iscomment, int sep) {
 
 static void lonX_string(lon_Loader *L, int del) {
     int c;  /* final character to be saved */
-    lonX_save_next(L);  /* keep delimiter (for error messages) */
+    lonX_keep_next(L);  /* keep delimiter (for error messages) */
     while (L->current != del) {
         switch (L->current) {
         case LON_EOZ:
@@ -969,13 +1575,19 @@ static void lonX_string(lon_Loader *L, int del) {
             case 't': c = '\t'; goto read_save;
             case 'v': c = '\v'; goto read_save;
             case 'x': lonX_hexaesc(L); goto no_save;
-            case 'u': lonX_utf8esc(L); goto no_save;
+            case 'u':
+                if (!lonX_allow(L, UTF8ESC))
+                    lonX_error(L, "escape '\\u' not allowed", TK_STRING);
+                lonX_utf8esc(L);
+                goto no_save;
             case '\n': case '\r':
                 lonX_newline(L); c = '\n'; goto only_save;
             case '\\': case '\"': case '\'':
                 c = L->current; goto read_save;
             case LON_EOZ: goto no_save;
             case 'z': /* zap following span of spaces */
+                if (!lonX_allow(L, ZAPESC))
+                    lonX_error(L, "escape '\\z' not allowed", TK_STRING);
                 lon_truncbuffer(&L->buffer, 1);
                 lonX_next(L);  /* skip the 'z' */
                 while (lon_isspace(L->current)) {
@@ -999,7 +1611,84 @@ only_save:
 no_save:
             break;
         default:
+            if (!lonX_allow(L, NONASCII) && (L->current & 0x80))
+                lonX_error(L, "non-ASCII character not allowed", TK_STRING);
+            lonX_saverun(L, del);
+        }
+    }
+    lonX_keep_next(L);  /* skip delimiter */
+}
+
+static void lonX_literal(lon_Loader *L, int del) {
+    /* short string kept as written: escapes are checked, not decoded */
+    unsigned long r;
+    int i;
+    lonX_save_next(L);
+    while (L->current != del) {
+        switch (L->current) {
+        case LON_EOZ:
+            lonX_error(L, "unfinished string", TK_EOS);
+            break;
+        case '\n':
+        case '\r':
+            lonX_error(L, "unfinished string", TK_STRING);
+            break;
+        case '\\': /* escape sequences */
             lonX_save_next(L);
+            switch (L->current) {
+            case 'a': case 'b': case 'f': case 'n': case 'r': case 't':
+            case 'v': case '\\': case '\"': case '\'':
+                lonX_save_next(L);
+                break;
+            case 'x':
+                lonX_checkhexa(L);
+                lonX_checkhexa(L);
+                lonX_save_next(L);
+                break;
+            case 'u':
+                if (!lonX_allow(L, UTF8ESC))
+                    lonX_error(L, "escape '\\u' not allowed", TK_STRING);
+                lonX_save_next(L);
+                lonX_checkescape(L, L->current == '{', "missing '{'");
+                r = lonX_checkhexa(L);
+                while ((lonX_save_next(L), lon_isxdigit(L->current))) {
+                    r = (r << 4) + lon_hexavalue(L->current);
+                    lonX_checkescape(L, r <= 0x10FFFF,
+                            "UTF-8 value too large");
+                }
+                lonX_checkescape(L, L->current == '}', "missing '}'");
+                lonX_save_next(L);
+                break;
+            case '\n': case '\r':
+                lonX_save(L, '\n');
+                lonX_newline(L);
+                break;
+            case LON_EOZ:
+                break;
+            case 'z':
+                if (!lonX_allow(L, ZAPESC))
+                    lonX_error(L, "escape '\\z' not allowed", TK_STRING);
+                lonX_save_next(L);
+                while (lon_isspace(L->current)) {
+                    if (!lon_isnewline(L->current)) lonX_save_next(L);
+                    else lonX_save(L, '\n'), lonX_newline(L);
+                }
+                break;
+            default:
+                lonX_checkescape(L, lon_isdigit(L->current),
+                        "invalid escape sequence");
+                for (i = 0, r = 0; i < 3 && lon_isdigit(L->current); ++i) {
+                    r = 10*r + L->current - '0';
+                    lonX_save_next(L);
+                }
+                lonX_checkescape(L, r <= UCHAR_MAX,
+                        "decimal escape too large");
+            }
+            break;
+        default:
+            if (!lonX_allow(L, NONASCII) && (L->current & 0x80))
+                lonX_error(L, "non-ASCII character not allowed", TK_STRING);
+            lonX_saverun(L, del);
         }
     }
     lonX_save_next(L);  /* skip delimiter */
@@ -1007,24 +1696,90 @@ no_save:
 
 static int lonX_numeral(lon_Loader *L) {
     const char *expo = "Ee";
+    int digit = lon_mask(DIGIT);
     int first = L->current;
     assert(lon_isdigit(L->current));
     lonX_save_next(L);
-    if (first == '0' && lonX_check_next2(L, "xX"))  /* hexadecimal? */
+    if (first == '0' && lonX_check_next2(L, "xX")) {  /* hexadecimal? */
+        if (!lonX_allow(L, HEXNUM))
+            lonX_error(L, "hexadecimal numeral not allowed", TK_FLT);
         expo = "Pp";
+        digit = lon_mask(XDIGIT);
+    }
     for (;;) {
         if (lonX_check_next2(L, expo))  /* exponent part? */
             lonX_check_next2(L, "-+");  /* optional exponent sign */
-        if (lon_isxdigit(L->current))
-            lonX_save_next(L);
-        else if (L->current == '.')
+        if (lon_checkmask(L->current, digit))
+            lonX_saveclass(L, digit);
+        else if (lon_isxdigit(L->current) || L->current == '.')
             lonX_save_next(L);
         else break;
     }
     lonX_endstring(L);
+    if (L->validate || lonX_rawnumber(L))
+        return lonX_checknumeral(L);
     return lonX_checknumber(L);
 }
 
+static int lonX_skipnumeral(lon_Loader *L) {
+    /* validation: numeral wholly inside current chunk, checked in place
+     * without buffering nor conversion; returns 0 to fall back to
+     * lonX_numeral() (which also reports malformed ones) */
+    const char *s = L->p - 1, *e = L->p + L->n, *q = s;
+    const char *expo = "Ee";
+    int tk;
+    if (e - s > 1 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        if (!lonX_allow(L, HEXNUM)) return 0;
+        expo = "Pp", q += 2;
+    }
+    for (;;) {
+        if (q < e && (*q == expo[0] || *q == expo[1])) {
+            ++q;
+            if (q < e && (*q == '-' || *q == '+')) ++q;
+        }
+        if (q < e && (lon_isxdigit(*q) || *q == '.')) ++q;
+        else break;
+    }
+    if (q == e || (tk = lonX_numeraltype(s, q)) == 0)
+        return 0;
+    L->n -= q - L->p;
+    L->p = q;
+    lonX_next(L);
+    return tk;
+}
+
+static int lonX_fastint(lon_Loader *L) {
+    /* decimal integer wholly inside current chunk, without per-char
+     * buffering; returns 0 to fall back to lonX_numeral() */
+    const char *s = L->p - 1, *e = L->p + L->n;
+    unsigned long long v;
+    const char *q = lon_scandecimal(s, e, &v);
+    if (q == e || q - s > 18 || lon_isalnum(*q) || *q == '.')
+        return 0;
+    lon_addlstring(&L->buffer, s, q - s);
+    lonX_endstring(L);
+    L->iv = (lon_Integer)v;
+    L->n -= q - L->p;
+    L->p = q;
+    lonX_next(L);
+    return TK_INT;
+}
+
+static void lonX_negate(lon_Loader *L, int tk) {
+    if (lonX_rawnumber(L)) {  /* keep sign in numeral text */
+        size_t size = lon_buffsize(&L->buffer);
+        char *s = (lon_prepbuffsize(&L->buffer, 2), lon_buffer(&L->buffer));
+        memmove(s + 1, s, size);
+        s[0] = '-';
+        L->buffer.size = size + 1;
+        lonX_endstring(L);
+    }
+    else if (tk == TK_INT)
+        L->iv = (lon_Integer)(0ull - (unsigned long long)L->iv);
+    else
+        L->nv = -L->nv;
+}
+
 static int lon_lexer(lon_Loader *L) {
     lon_resetbuffer(&L->buffer);
     for (;;) {
@@ -1038,6 +1793,8 @@ static int lon_lexer(lon_Loader *L) {
         case '-':
             lonX_next(L);
             if (L->current != '-') return '-';
+            if (!lonX_allow(L, COMMENT))
+                lonX_error(L, "comment not allowed", 0);
             lonX_next(L);
             if (L->current == '[') {
                 int sep = lonX_sep(L);
@@ -1054,6 +1811,8 @@ static int lon_lexer(lon_Loader *L) {
             {
                 int sep = lonX_sep(L);
                 if (sep >= 0) {
+                    if (!lonX_allow(L, LONGSTR))
+                        lonX_error(L, "long string not allowed", TK_STRING);
                     lonX_long_string(L, 0, sep);
                     L->seplen = sep + 2;
                     return TK_STRING;
@@ -1063,7 +1822,8 @@ static int lon_lexer(lon_Loader *L) {
             }
             return '[';
         case '"': case '\'': /* short literal strings */
-            lonX_string(L, L->current);
+            if (lonX_rawstring(L)) lonX_literal(L, L->current);
+            else lonX_string(L, L->current);
             L->seplen = 1;
             return TK_STRING;
         case '.': /* '.', '..', '...', or number */
@@ -1072,18 +1832,15 @@ static int lon_lexer(lon_Loader *L) {
             else return lonX_numeral(L);
         case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
-            return lonX_numeral(L);
+            {
+                int tk = lonX_keep(L) ? lonX_fastint(L) : lonX_skipnumeral(L);
+                return tk ? tk : lonX_numeral(L);
+            }
         case LON_EOZ: 
             return TK_EOS;
         default:
-            if (lon_isalpha(L->current)) {  /* identifier or reserved word? */
-                do {
-                    lonX_save_next(L);
-                } while (lon_isalnum(L->current));
-                lonX_endstring(L);
-                return lonX_checkkeyword(lon_buffer(&L->buffer),
-                        lon_buffsize(&L->buffer));
-            }
+            if (lon_isalpha(L->current))  /* identifier or reserved word? */
+                return lonX_name(L);
             else {  /* single-char tokens (+ - / ...) */
                 int c = L->current;
                 lonX_next(L);
@@ -1095,179 +1852,568 @@ static int lon_lexer(lon_Loader *L) {
 }
 
 
-/* lon parser */
-
-#define lonY_next(L) ((L)->token = lon_lexer(L))
-
-static void lonY_expr(lon_Loader *L);
+/* lon JSON lexer */
 
-static void lonY_check(lon_Loader *L, int tok) {
-    if (L->token != tok) {
-        lonX_addinfo(L);
-        lonX_addtoken(L, tok);
-        lon_addstring(&L->errmsg, " expected");
-        lonX_error(L, NULL, L->token);
+static int lonJ_isnumeral(const char *s, const char *e) {
+    /* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][-+]?[0-9]+)? */
+    if (s < e && *s == '-') ++s;
+    if (s == e || !lon_isdigit(*s)) return 0;
+    if (*s++ == '0' && s < e && lon_isdigit(*s)) return 0;
+    while (s < e && lon_isdigit(*s)) ++s;
+    if (s < e && *s == '.') {
+        if (++s == e || !lon_isdigit(*s)) return 0;
+        while (s < e && lon_isdigit(*s)) ++s;
     }
+    if (s < e && (*s == 'e' || *s == 'E')) {
+        if (++s < e && (*s == '-' || *s == '+')) ++s;
+        if (s == e || !lon_isdigit(*s)) return 0;
+        while (s < e && lon_isdigit(*s)) ++s;
+    }
+    return s == e;
 }
 
-static int lonY_testnext(lon_Loader *L, int tok) {
-  if (L->token == tok) {
-    lonY_next(L);
-    return 1;
-  }
-  else return 0;
+static void lonJ_badnumeral(lon_Loader *L) {
+    if (L->current != LON_EOZ)
+        lonX_save_next(L);  /* add current to buffer for error message */
+    lonX_error(L, "malformed number", TK_FLT);
 }
 
-static void lonY_checknext(lon_Loader *L, int tok) {
-    lonY_check(L, tok);
-    lonY_next(L);
+static void lonJ_digits(lon_Loader *L) {
+    /* [0-9]+, possibly spanning chunks */
+    if (!lon_isdigit(L->current))
+        lonJ_badnumeral(L);
+    while (lon_isdigit(L->current))
+        lonX_saveclass(L, lon_mask(DIGIT));
 }
 
-static void lonY_checkmatch(lon_Loader *L, int what, int who, int where) {
-    if (!lonY_testnext(L, what)) {
-        if (where == L->line)
-            lonY_check(L, what);
-        else {
-            lonX_addinfo(L);
-            lonX_addtoken(L, what);
-            lon_addstring(&L->errmsg, " expected (to close ");
-            lonX_addtoken(L, who);
-            lon_addfstring(&L->errmsg, " at line %d)", where);
-            lonX_error(L, NULL, L->token);
+static int lonJ_numeral(lon_Loader *L) {
+    /* JSON numeral, scanned by its own grammar (no hexadecimals, no
+     * leading zeros or bare dots); '-0' is a float, as in JavaScript */
+    int neg = (L->current == '-'), tk = 0;
+    if (neg) lonX_next(L);
+    if (!lon_isdigit(L->current))
+        lonX_error(L, "malformed number", '-');
+    if (L->current != '0')
+        tk = lonX_fastint(L);
+    if (tk == 0) {
+        if (L->current == '0') lonX_save_next(L);
+        else lonJ_digits(L);
+        if (L->current == '.')
+            lonX_save_next(L), lonJ_digits(L);
+        if (L->current == 'e' || L->current == 'E') {
+            lonX_save_next(L);
+            if (L->current == '-' || L->current == '+') lonX_save_next(L);
+            lonJ_digits(L);
         }
+        if (lon_isalnum(L->current) || L->current == '.')
+            lonJ_badnumeral(L);
+        lonX_endstring(L);
+        if (L->validate || lonX_rawnumber(L))
+            tk = lonX_checknumeral(L);
+        else
+            tk = lonX_checknumber(L);
     }
+    if (neg && tk == TK_INT && lon_buffsize(&L->buffer) == 1
+            && lon_buffer(&L->buffer)[0] == '0')
+        tk = TK_FLT, L->nv = 0;
+    if (neg) lonX_negate(L, tk);
+    return tk;
 }
 
-static int lonY_field(lon_Loader *L, int index) {
-    /* field: exp | (NAME | '[' exp ']') '=' exp */
-    L->status = LON_STATUS_KEY;
-    switch (L->token) {
-        if (L->token == TK_NAME) {
-    case TK_NAME:
-            if (L->cb && L->cb->on_string)
-                L->cb->on_string(L->cb, lon_buffer(&L->buffer),
-                        lon_buffsize(&L->buffer));
-            lonY_next(L);
-        }
-        else /*if (L->token == '[')*/ {
-    case '[':
-            lonY_next(L);
-            lonY_expr(L);
-            lonY_checknext(L, ']');
-        }
-        lonY_checknext(L, '=');
-        L->status = LON_STATUS_VALUE;
-        lonY_expr(L);
-        return 0;
-    default:
-        if (L->cb && L->cb->on_integer)
-            L->cb->on_integer(L->cb, index);
-        L->status = LON_STATUS_VALUE;
-        lonY_expr(L);
-        return 1;
-    }
+static void lonJ_saveutf8(lon_Loader *L, unsigned long r) {
+    char buff[LON_UTF8_BUFFERSIZE];
+    int n = lon_encode_utf8(buff, r);
+    for (; n > 0; --n)
+        lonX_save(L, buff[LON_UTF8_BUFFERSIZE - n]);
 }
 
-static void lonY_table(lon_Loader *L) {
-    /* table -> '{' [ field { sep field } [sep] ] '}'
-       sep -> ',' | ';' */
-    int index = 1;
-    int line = L->line;
-    int status = L->status;
-    lonY_checknext(L, '{');
-    ++L->levels;
-    if (L->cb && L->cb->on_table_begin)
-        L->cb->on_table_begin(L->cb);
-    do {
-        if (L->token == '}') break;
-        index += lonY_field(L, index);
-    } while (lonY_testnext(L, ',') || lonY_testnext(L, ';'));
-    lonY_checkmatch(L, '}', '{', line);
-    L->status = status;
-    if (L->cb && L->cb->on_table_end)
-        L->cb->on_table_end(L->cb);
-    --L->levels;
+static void lonJ_saverun(lon_Loader *L) {
+    /* like lonX_saverun(), also stopping at control characters */
+    const char *s = L->p - 1, *e = L->p + L->n, *q = s + 1;
+    while (q < e && *q != '"' && *q != '\\' && (unsigned char)*q >= 0x20
+            && (lonX_allow(L, NONASCII) || (*q & 0x80) == 0))
+        ++q;
+    if (lonX_keep(L)) lon_addlstring(&L->buffer, s, q - s);
+    L->n -= q - L->p;
+    L->p = q;
+    lonX_next(L);
 }
 
-static void lonY_expr(lon_Loader *L) {
-    /* exp -> nil | boolean | integer | number | string | table */
-    switch (L->token) {
-    case TK_EOS:
-        return;
-    case TK_NIL:
-        if (L->cb && L->cb->on_nil)
-            L->cb->on_nil(L->cb);
-        break;
-    case TK_TRUE:
-        if (L->cb && L->cb->on_boolean)
-            L->cb->on_boolean(L->cb, 1);
-        break;
-    case TK_FALSE:
-        if (L->cb && L->cb->on_boolean)
-            L->cb->on_boolean(L->cb, 0);
-        break;
-    case TK_INT:
-        if (L->cb && L->cb->on_integer)
-            L->cb->on_integer(L->cb, L->iv);
-        break;
-    case TK_FLT:
-        if (L->cb && L->cb->on_number)
-            L->cb->on_number(L->cb, L->nv);
-        break;
-    case TK_STRING:
-        if (L->cb && L->cb->on_string)
-            L->cb->on_string(L->cb, lon_buffer(&L->buffer)+L->seplen,
-                    lon_buffsize(&L->buffer)-L->seplen*2);
-        break;
-    case '{':
-        lonY_table(L);
-        return;
-    default:
-        lonX_error(L, "unexpected symbol", L->token);
+static void lonJ_string(lon_Loader *L) {
+    unsigned long r, hi = 0;  /* pending high surrogate */
+    int i, c;
+    lonX_save_next(L);  /* keep delimiter (for error messages) */
+    while (L->current != '"') {
+        if (hi && L->current != '\\')
+            lonJ_saveutf8(L, hi), hi = 0;
+        switch (L->current) {
+        case LON_EOZ:
+            lonX_error(L, "unfinished string", TK_EOS);
+            break;
+        case '\n':
+        case '\r':
+            lonX_error(L, "unfinished string", TK_STRING);
+            break;
+        case '\\': /* escape sequences */
+            lonX_save_next(L);  /* keep '\\' for error messages */
+            switch (c = L->current) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case '"': case '\\': case '/': break;
+            case 'u':
+                for (i = 0, r = 0; i < 4; ++i)
+                    r = (r << 4) + lonX_checkhexa(L);
+                lonX_next(L);
+                lon_truncbuffer(&L->buffer, 5);  /* '\\', 'u' and digits */
+                if (hi && r >= 0xDC00 && r <= 0xDFFF)
+                    r = 0x10000 + ((hi - 0xD800) << 10) + (r - 0xDC00);
+                else if (hi)
+                    lonJ_saveutf8(L, hi);
+                hi = 0;
+                if (r >= 0xD800 && r <= 0xDBFF) hi = r;
+                else lonJ_saveutf8(L, r);
+                continue;
+            case LON_EOZ:
+                continue;
+            default:
+                lonX_checkescape(L, 0, "invalid escape sequence");
+            }
+            lonX_next(L);
+            lon_truncbuffer(&L->buffer, 1);
+            if (hi) lonJ_saveutf8(L, hi), hi = 0;
+            lonX_save(L, c);
+            break;
+        default:
+            if ((unsigned char)L->current < 0x20)
+                lonX_checkescape(L, 0, "control character in string");
+            lonJ_saverun(L);
+        }
     }
-    lonY_next(L);
+    if (hi) lonJ_saveutf8(L, hi);
+    lonX_save_next(L);  /* skip delimiter */
 }
 
-static void lonY_expr_list(lon_Loader *L) {
-    /* expr_list -> expr { ',' expr } */
-    L->status = LON_STATUS_TOP;
-    lonY_expr(L);
+static int lonJ_lexer(lon_Loader *L) {
+    lon_resetbuffer(&L->buffer);
     for (;;) {
-        switch (L->token) {
-        case TK_EOS:
-            return;
-        case ',':
-            lonY_next(L);
-            L->status = LON_STATUS_TOP;
-            lonY_expr(L);
+        switch (L->current) {
+        case '\n': case '\r': /* line breaks */
+            lonX_newline(L);
             break;
+        case ' ': case '\t':
+            lonX_next(L);
+            break;
+        case '"':
+            lonJ_string(L);
+            L->seplen = 1;
+            return TK_STRING;
+        case '-': case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return lonJ_numeral(L);
+        case LON_EOZ:
+            return TK_EOS;
         default:
-            lonX_error(L, "<eof> or ',' expected", L->token);
+            if (lon_isalpha(L->current)) {  /* true, false or null */
+                int tk = lonX_name(L);
+                if (tk == TK_TRUE || tk == TK_FALSE) return tk;
+                if (lon_buffsize(&L->buffer) == 4
+                        && memcmp(lon_buffer(&L->buffer), "null", 4) == 0)
+                    return TK_NIL;
+                lonX_error(L, "unexpected symbol", TK_NAME);
+            }
+            else {  /* single-char tokens */
+                int c = L->current;
+                lonX_next(L);
+                return c;
+            }
         }
     }
+    return 0;
 }
 
-static void lon_parser(lon_Loader *L) {
-    L->levels = 0;
-    L->status = LON_STATUS_TOP;
-    if (L->cb && L->cb->on_begin)
-        L->cb->on_begin(L->cb);
-    switch (lonY_next(L)) {
-    case TK_EOS:
-        return;
-    case '{': lonY_table(L); break;
-    case TK_RETURN:
+
+/* lon event tape */
+
+static void lonT_flush(lon_Tape *T) {
+    size_t i;
+    for (i = 0; i < T->count; ++i)
+        if (T->events[i].type == LON_EV_STRING)
+            T->events[i].u.s = lon_buffer(&T->strings)
+                + T->events[i].u.offset;
+    if (T->count != 0 && T->flush)
+        T->flush(T->ud, T->events, T->count);
+    T->count = 0;
+    lon_resetbuffer(&T->strings);
+}
+
+static lon_Event *lonT_add(lon_Loader *L, int type) {
+    lon_Tape *T = L->tape;
+    lon_Event *ev;
+    if (T->count == LON_TAPESIZE)
+        lonT_flush(T);
+    ev = &T->events[T->count++];
+    ev->type   = (unsigned char)type;
+    ev->status = (unsigned char)L->status;
+    ev->depth  = (unsigned short)L->levels;
+    ev->len    = 0;
+    ev->u.i    = 0;
+    return ev;
+}
+
+static void lonT_addstring(lon_Loader *L, const char *s, size_t len) {
+    lon_Event *ev = lonT_add(L, LON_EV_STRING);
+    ev->len = len;
+    ev->u.offset = lon_buffsize(&L->tape->strings);
+    lon_addlstring(&L->tape->strings, s, len);
+}
+
+LON_API void lon_inittape(lon_Tape *T, lon_Flush *flush, void *ud) {
+    T->flush = flush;
+    T->ud = ud;
+    T->count = 0;
+    lon_initbuffer(&T->strings, NULL);
+}
+
+LON_API void lon_settape(lon_Loader *L, lon_Tape *T)
+{ L->tape = T; }
+
+
+/* lon parser */
+
+#define lonY_next(L) \
+    ((L)->token = (L)->json ? lonJ_lexer(L) : lon_lexer(L))
+
+static void lonY_check(lon_Loader *L, int tok) {
+    if (L->token != tok) {
+        lonX_addinfo(L);
+        lonX_addtoken(L, tok);
+        lon_addstring(&L->errmsg, " expected");
+        lonX_error(L, NULL, L->token);
+    }
+}
+
+static int lonY_testnext(lon_Loader *L, int tok) {
+  if (L->token == tok) {
+    lonY_next(L);
+    return 1;
+  }
+  else return 0;
+}
+
+static void lonY_checknext(lon_Loader *L, int tok) {
+    lonY_check(L, tok);
+    lonY_next(L);
+}
+
+static void lonY_checkmatch(lon_Loader *L, int what, int who, int where) {
+    if (!lonY_testnext(L, what)) {
+        if (where == L->line)
+            lonY_check(L, what);
+        else {
+            lonX_addinfo(L);
+            lonX_addtoken(L, what);
+            lon_addstring(&L->errmsg, " expected (to close ");
+            lonX_addtoken(L, who);
+            lon_addfstring(&L->errmsg, " at line %d)", where);
+            lonX_error(L, NULL, L->token);
+        }
+    }
+}
+
+static void lonY_endvalue(lon_Loader *L) {
+    /* a top-level value loaded alone ends on its last token, so nothing
+       after it is read */
+    if (!L->once || L->levels != 0)
         lonY_next(L);
-        /* FALLTHROUGH */
-    default:
-        lonY_expr_list(L);
-        break;
+}
+
+static void lonY_closetable(lon_Loader *L, int what, int who, int where) {
+    if (L->once && L->levels == 1 && L->token == what)
+        return;
+    lonY_checkmatch(L, what, who, where);
+}
+
+static void lonY_negate(lon_Loader *L) {
+    /* '-' numeral */
+    lonY_next(L);
+    if (L->token != TK_INT && L->token != TK_FLT)
+        lonX_error(L, "number expected", L->token);
+    lonX_negate(L, L->token);
+}
+
+#define lonY_indexing(L) ((L)->index && (L)->levels == (L)->index->depth)
+
+static void lonY_beginfield(lon_Loader *L, size_t offset, int line) {
+    lon_IndexEntry e;
+    e.offset = offset, e.size = 0, e.line = line;
+    e.index = 0, e.key = (size_t)-1, e.keylen = 0;
+    lon_addlstring(&L->index->entries, (const char*)&e, sizeof(e));
+}
+
+static size_t lonY_endfield(lon_Loader *L) {
+    /* current token is the separator or '}' after the field */
+    size_t offset = lon_offset(L);
+    lon_IndexEntry *e = (lon_IndexEntry*)(lon_buffer(&L->index->entries)
+            + lon_buffsize(&L->index->entries)) - 1;
+    e->size = offset - 1 - e->offset;
+    return offset;
+}
+
+static void lonY_indexkey(lon_Loader *L, const char *s, size_t len,
+                          lon_Integer index) {
+    lon_IndexEntry *e = (lon_IndexEntry*)(lon_buffer(&L->index->entries)
+            + lon_buffsize(&L->index->entries)) - 1;
+    e->index = index;
+    if (s != NULL) {
+        e->key = lon_buffsize(&L->index->keys);
+        e->keylen = len;
+        lon_addlstring(&L->index->keys, s, len);
+        lon_addchar(&L->index->keys, '\0');
     }
-    L->status = LON_STATUS_TOP;
-    if (L->cb && L->cb->on_end)
+}
+
+
+/* parser events, to the tape or to the callbacks; lon.hpp has the same
+ * functions taking a handler, and shares the grammar below */
+
+static void lonY_onbegin(lon_Loader *L) {
+    if (L->tape)
+        lonT_add(L, LON_EV_BEGIN);
+    else if (L->cb && L->cb->on_begin)
+        L->cb->on_begin(L->cb);
+}
+
+static void lonY_onend(lon_Loader *L) {
+    if (L->tape) {
+        lonT_add(L, LON_EV_END);
+        lonT_flush(L->tape);
+    }
+    else if (L->cb && L->cb->on_end)
         L->cb->on_end(L->cb);
 }
 
+static void lonY_flush(lon_Loader *L) {
+    /* empty input: no value, and no on_end() */
+    if (L->tape) lonT_flush(L->tape);
+}
+
+static void lonY_onnil(lon_Loader *L) {
+    if (L->tape)
+        lonT_add(L, LON_EV_NIL);
+    else if (L->cb && L->cb->on_nil)
+        L->cb->on_nil(L->cb);
+}
+
+static void lonY_onboolean(lon_Loader *L, int b) {
+    if (L->tape)
+        lonT_add(L, LON_EV_BOOLEAN)->u.b = b;
+    else if (L->cb && L->cb->on_boolean)
+        L->cb->on_boolean(L->cb, b);
+}
+
+static void lonY_oninteger(lon_Loader *L, lon_Integer i) {
+    if (L->tape)
+        lonT_add(L, LON_EV_INTEGER)->u.i = i;
+    else if (L->cb && L->cb->on_integer)
+        L->cb->on_integer(L->cb, i);
+}
+
+static void lonY_onnumber(lon_Loader *L, lon_Number n) {
+    if (L->tape)
+        lonT_add(L, LON_EV_NUMBER)->u.n = n;
+    else if (L->cb && L->cb->on_number)
+        L->cb->on_number(L->cb, n);
+}
+
+static void lonY_ontablebegin(lon_Loader *L) {
+    if (L->tape)
+        lonT_add(L, LON_EV_TABLE_BEGIN);
+    else if (L->cb && L->cb->on_table_begin)
+        L->cb->on_table_begin(L->cb);
+}
+
+static void lonY_ontableend(lon_Loader *L) {
+    if (L->tape)
+        lonT_add(L, LON_EV_TABLE_END);
+    else if (L->cb && L->cb->on_table_end)
+        L->cb->on_table_end(L->cb);
+}
+
+static int lonY_haskey(lon_Loader *L) {
+    return L->tape == NULL && L->cb && (L->cb->on_key
+            || (L->intern && L->cb->on_interned_key));
+}
+static void lonY_string(lon_Loader *L, const char *s, size_t len) {
+    if (L->tape)
+        lonT_addstring(L, s, len);
+    else if (L->cb && L->cb->on_string)
+        L->cb->on_string(L->cb, s, len);
+}
+
+static void lonY_index(lon_Loader *L, lon_Integer index) {
+    /* key of positional field */
+    if (L->tape)
+        lonT_add(L, LON_EV_INTEGER)->u.i = index;
+    else if (L->cb && L->cb->on_index)
+        L->cb->on_index(L->cb, index);
+    else if (L->cb && L->cb->on_integer)
+        L->cb->on_integer(L->cb, index);
+}
+
+static void lonY_key(lon_Loader *L, const char *s, size_t len,
+                     unsigned hash) {
+    if (L->intern && L->cb->on_interned_key) {
+        const lon_Key *k = lon_intern(L->intern, s, len, hash);
+        if (k == NULL) longjmp(L->jbuf, LON_ERRMEM);
+        L->cb->on_interned_key(L->cb, k);
+    }
+    else
+        L->cb->on_key(L->cb, s, len, hash);
+}
+
+static void lonY_rawnumber(lon_Loader *L) {
+    L->cb->on_raw_number(L->cb, lon_buffer(&L->buffer),
+            lon_buffsize(&L->buffer), L->token == TK_INT);
+}
+
+static void lonY_rawstring(lon_Loader *L) {
+    L->cb->on_raw_string(L->cb, lon_buffer(&L->buffer),
+            lon_buffsize(&L->buffer));
+}
+
+static void lonY_onintegerarray(lon_Loader *L, lon_Integer first,
+                                const lon_Integer *v, size_t n)
+{ L->cb->on_integer_array(L->cb, first, v, n); }
+
+static void lonY_onnumberarray(lon_Loader *L, lon_Integer first,
+                               const lon_Number *v, size_t n)
+{ L->cb->on_number_array(L->cb, first, v, n); }
+
+static int lonY_isrun(lon_Loader *L) {
+    /* can current token be collected into a numeral run? */
+    if (L->tape || L->cb == NULL || L->cb->on_raw_number
+            || lonY_indexing(L)) return 0;
+    switch (L->token) {
+    case TK_INT: return L->cb->on_integer_array != NULL;
+    case TK_FLT: return L->cb->on_number_array != NULL;
+    }
+    return 0;
+}
+
+
+/* lon binary loader */
+
+#define LON_BT_NIL      0x00
+#define LON_BT_FALSE    0x01
+#define LON_BT_TRUE     0x02
+#define LON_BT_INT      0x03  /* zigzag varint */
+#define LON_BT_FLT      0x04  /* IEEE double, little endian */
+#define LON_BT_STRING   0x05  /* varint length, bytes */
+#define LON_BT_TABLE    0x06  /* fields until LON_BT_END */
+#define LON_BT_END      0x07
+#define LON_BT_KEY      0x08  /* next value is key of a non-positional field */
+#define LON_BT_DEFKEY   0x09  /* string key, added to key dictionary */
+#define LON_BT_REFKEY   0x0A  /* varint index into key dictionary */
+#define LON_BT_INTS     0x0B  /* varint count, zigzag varints */
+#define LON_BT_FLTS     0x0C  /* varint count, IEEE doubles */
+
+#define lonB_zigzag(v)   (((unsigned long long)(v) << 1) ^ (0ull - ((v) < 0)))
+
+static void lonB_error(lon_Loader *L, const char *msg) {
+    lonX_addinfo(L);
+    lon_addfstring(&L->errmsg, "(offset %lu) %s",
+            (unsigned long)lon_offset(L), msg);
+    lonX_error(L, NULL, 0);
+}
+
+static int lonB_byte(lon_Loader *L) {
+    int c = L->current;
+    if (c == LON_EOZ) lonB_error(L, "truncated binary data");
+    lonX_next(L);
+    return c;
+}
+
+static unsigned long long lonB_varint(lon_Loader *L) {
+    unsigned long long u = 0;
+    int c, shift = 0;
+    do {
+        if (shift > 63) lonB_error(L, "malformed varint");
+        c = lonB_byte(L);
+        u |= (unsigned long long)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return u;
+}
+
+static lon_Integer lonB_integer(lon_Loader *L) {
+    unsigned long long u = lonB_varint(L);  /* zigzag encoded */
+    return (lon_Integer)((u >> 1) ^ (0ull - (u & 1)));
+}
+
+static const char *lonB_bytes(lon_Loader *L, size_t len) {
+    /* 'len' bytes from current, in place if current chunk holds them */
+    const char *s;
+    if (len == 0) return "";
+    if (L->current == LON_EOZ) lonB_error(L, "truncated binary data");
+    if (len <= L->n) {
+        s = L->p - 1;
+        L->p += len - 1, L->n -= len - 1;
+        lonX_next(L);
+        return s;
+    }
+    lon_resetbuffer(&L->buffer);
+    while (len > 0) {
+        size_t run = L->n + 1 < len ? L->n + 1 : len;
+        if (L->current == LON_EOZ) lonB_error(L, "truncated binary data");
+        lon_addlstring(&L->buffer, L->p - 1, run);
+        L->p += run - 1, L->n -= run - 1;
+        lonX_next(L);
+        len -= run;
+    }
+    return lon_buffer(&L->buffer);
+}
+
+static lon_Number lonB_number(lon_Loader *L) {
+    const unsigned char *s = (const unsigned char*)lonB_bytes(L, 8);
+    unsigned long long u = 0;
+    double d;
+    int i;
+    for (i = 7; i >= 0; --i)
+        u = (u << 8) | s[i];
+    memcpy(&d, &u, sizeof(d));
+    return (lon_Number)d;
+}
+
+static void lonB_numeral(lon_Loader *L) {
+    /* numeral text for on_raw_number() */
+    lon_resetbuffer(&L->buffer);
+    if (L->token == TK_INT)
+        lon_addfstring(&L->buffer, "%lld", (long long)L->iv);
+    else {
+        lon_addfstring(&L->buffer, "%.17g", (double)L->nv);
+        if (lon_buffer(&L->buffer)[strspn(lon_buffer(&L->buffer),
+                        "-0123456789")] == '\0')
+            lon_addstring(&L->buffer, ".0");  /* looks like an int */
+    }
+    lonX_endstring(L);
+}
+
+
+/* the grammar, lon.hpp instantiates it again on a C++ handler */
+
+#define LON_PARSE_FUNC   static
+#define LON_PARSE_PARAMS lon_Loader *L
+#define LON_PARSE_ARGS   L
+#define LON_PARSER_BODY
+#include "lon.h"
+#undef LON_PARSER_BODY
+#undef LON_PARSE_FUNC
+#undef LON_PARSE_PARAMS
+#undef LON_PARSE_ARGS
+
 
 /* loader routines */
 
@@ -1282,9 +2428,49 @@ typedef struct lon_FileCtx {
     char buff[LON_BUFFERSIZE];
 } lon_FileCtx;
 
+typedef struct lon_RangeCtx {
+    lon_Reader *reader;
+    void *ud;
+    size_t left;
+} lon_RangeCtx;
+
+#ifndef lon_fseek /* offsets past 2GB need more than a 32 bit long */
+# define lon_fseek lonL_fseek
+static int lonL_fseek(FILE *fp, size_t off) {
+# if defined(_WIN32)
+    return _fseeki64(fp, (__int64)off, SEEK_SET);
+# elif (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L) \
+    || defined(_LARGEFILE_SOURCE)
+    off_t o = (off_t)off; /* 64 bit with _FILE_OFFSET_BITS=64 */
+    if (o < 0 || (size_t)o != off) return -1;
+    return fseeko(fp, o, SEEK_SET);
+# else
+    if (off > (size_t)LONG_MAX) return -1;
+    return fseek(fp, (long)off, SEEK_SET);
+# endif
+}
+#endif
+
 LON_API void lon_initloader(lon_Loader *L)
 { memset(L, 0, sizeof(*L)); }
 
+static void lonL_freebuffer(lon_Buffer *B, size_t keep) {
+    /* a heap block up to 'keep' bytes stays for the next load */
+    if (B->capacity <= LON_BUFFERSIZE)
+        lon_initbuffer(B, NULL);
+    else if (B->capacity <= keep)
+        B->jbuf = NULL, lon_resetbuffer(B);
+    else
+        lon_freebuffer(B);
+}
+
+LON_API void lon_freeloader(lon_Loader *L) {
+    /* blocks kept by LON_LOPT_KEEPBUFFER */
+    lonL_freebuffer(&L->buffer, 0);
+    lonL_freebuffer(&L->errmsg, 0);
+    lonL_freebuffer(&L->array, 0);
+}
+
 LON_API void lon_setcallbacks(lon_Loader *L, lon_Callbacks *cb)
 { L->cb = cb; if (cb) cb->loader = L; }
 
@@ -1294,12 +2480,68 @@ LON_API void lon_setpanicf(lon_Loader *L, lon_Panic *f, void *ud)
 LON_API void lon_setdumper(lon_Loader *L, lon_Dumper *dumper)
 { L->dumper = dumper; }
 
+LON_API int lon_setloadopt(lon_Loader *L, int opt, int value) {
+    int oldvalue;
+    switch (opt) {
+    default:
+        return 0;
+    case LON_LOPT_FEATURES:
+        oldvalue = ~L->strict & LON_FEAT_ALL;
+        L->strict = ~value & LON_FEAT_ALL;
+        break;
+    case LON_LOPT_JSON:
+        oldvalue = L->json;
+        L->json = !!value;
+        break;
+    case LON_LOPT_MAXLEVEL:
+        oldvalue = L->maxlevels;
+        L->maxlevels = value < 0 ? 0 : value;
+        break;
+    case LON_LOPT_LUAFLOAT:
+        oldvalue = L->luafloat;
+        L->luafloat = !!value;
+        break;
+    case LON_LOPT_KEEPBUFFER:
+        oldvalue = L->keepbuffer;
+        L->keepbuffer = value < 0 ? 0 : value;
+        break;
+    }
+    return oldvalue;
+}
+
 LON_API int lon_status(lon_Loader *L)
 { return L->status; }
 
 LON_API int lon_levels(lon_Loader *L)
 { return L->levels; }
 
+LON_API size_t lon_offset(lon_Loader *L)
+{ return L->offset + (L->p ? L->p - L->chunk - 1 : 0); }
+
+static int lonL_tonumeral(const char *s, size_t len,
+                          lon_Integer *iv, lon_Number *nv) {
+    char buff[LON_MAXNUMERAL+1];
+    int decpoint = 0;
+    if (len == 0 || len > LON_MAXNUMERAL) return 0;
+    memcpy(buff, s, len);
+    buff[len] = '\0';
+    return lon_str2number(buff, len, &decpoint, iv, nv);
+}
+
+LON_API int lon_tointeger(const char *s, size_t len, lon_Integer *v) {
+    lon_Number n;
+    return lonL_tonumeral(s, len, v, &n) == TK_INT;
+}
+
+LON_API int lon_tonumber(const char *s, size_t len, lon_Number *v) {
+    lon_Integer i;
+    switch (lonL_tonumeral(s, len, &i, v)) {
+    case TK_INT: *v = (lon_Number)i; /* FALLTHROUGH */
+    case TK_FLT: return 1;
+    }
+    return 0;
+}
+
 static void lonL_on_begin(lon_Callbacks *cb)
 { lon_dump_begin(cb->loader->dumper); }
 static void lonL_on_end(lon_Callbacks *cb)
@@ -1314,10 +2556,21 @@ static void lonL_on_number(lon_Callbacks *cb, lon_Number value)
 { lon_dump_number(cb->loader->dumper, value); }
 static void lonL_on_string(lon_Callbacks *cb, const char *s, size_t len)
 { lon_dump_buffer(cb->loader->dumper, s, len); }
+static void lonL_on_raw_number(lon_Callbacks *cb, const char *s, size_t len,
+        int is_int)
+{ (void)is_int; lon_dump_raw(cb->loader->dumper, s, len); }
+static void lonL_on_raw_string(lon_Callbacks *cb, const char *s, size_t len)
+{ lon_dump_raw(cb->loader->dumper, s, len); }
 static void lonL_on_table_begin(lon_Callbacks *cb)
 { lon_dump_table_begin(cb->loader->dumper); }
 static void lonL_on_table_end(lon_Callbacks *cb)
 { lon_dump_table_end(cb->loader->dumper); }
+static void lonL_on_integer_array(lon_Callbacks *cb, lon_Integer index,
+        const lon_Integer *v, size_t n)
+{ (void)index; lon_dump_integer_array(cb->loader->dumper, v, n); }
+static void lonL_on_number_array(lon_Callbacks *cb, lon_Integer index,
+        const lon_Number *v, size_t n)
+{ (void)index; lon_dump_number_array(cb->loader->dumper, v, n); }
 
 static void lonL_initdumpcb(lon_Loader *L, lon_Callbacks *cb) {
     if (L->cb == NULL && L->dumper != NULL) {
@@ -1330,6 +2583,14 @@ static void lonL_initdumpcb(lon_Loader *L, lon_Callbacks *cb) {
         cb->on_string      = lonL_on_string;
         cb->on_table_begin = lonL_on_table_begin;
         cb->on_table_end   = lonL_on_table_end;
+        cb->on_integer_array = lonL_on_integer_array;
+        cb->on_number_array  = lonL_on_number_array;
+        if (L->dumper->opt_verbatim && !L->dumper->opt_binary) {
+            /* transcode: literals go from lexer to output untouched */
+            cb->on_raw_number = lonL_on_raw_number;
+            if (!L->dumper->opt_json)
+                cb->on_raw_string = lonL_on_raw_string;
+        }
         L->cb = cb;
     }
 }
@@ -1351,16 +2612,84 @@ static const char *lonL_filereader(void *ud, size_t *plen) {
     return ctx->buff;
 }
 
+static const char *lonL_rangereader(void *ud, size_t *plen) {
+    lon_RangeCtx *ctx = (lon_RangeCtx*)ud;
+    size_t len;
+    const char *s;
+    if (ctx->left == 0 || (s = ctx->reader(ctx->ud, &len)) == NULL)
+        return NULL;
+    if (len > ctx->left) len = ctx->left;
+    ctx->left -= len;
+    if (plen) *plen = len;
+    return s;
+}
+
+static size_t lonL_filewriter(void *ud, const char *s, size_t len)
+{ return fwrite(s, 1, len, (FILE*)ud); }
+
+static const char *lonL_memerror(lon_Loader *L, char *buff, size_t size) {
+    snprintf(buff, size, "%s:%d: out of memory",
+            (L->name ? L->name : "[=loader]"), L->line+1);
+    return buff;
+}
+
 static void lonL_outofmem(lon_Loader *L) {
     char buff[80];
-    snprintf(buff, 80, "%s:%d: out of memory",
-            (L->name ? L->name : "[=loader]"), L->line+1);
+    lonL_memerror(L, buff, sizeof(buff));
     if (L->cb && L->cb->on_error)
         L->cb->on_error(L->cb, buff);
     else if (L->panicf)
         L->panicf(L->panic_ud, buff);
 }
 
+static void lonL_initbuffer(lon_Loader *L, lon_Buffer *B) {
+    /* reuses a heap block kept by lonL_freebuffer() */
+    if (B->capacity > LON_BUFFERSIZE)
+        B->jbuf = &L->jbuf, lon_resetbuffer(B);
+    else
+        lon_initbuffer(B, &L->jbuf);
+}
+
+static void lonL_reset(lon_Loader *L, lon_Reader *reader, void *ud) {
+    L->reader = reader;
+    L->ud = ud;
+    L->line = 0;
+    L->current = 0, L->n = 0, L->p = NULL;
+    L->chunk = NULL, L->offset = 0;
+    if (L->field)
+        L->offset = L->field->offset, L->line = L->field->line;
+    else if (L->once)
+        L->offset = L->next, L->line = L->nextline;
+    lonL_initbuffer(L, &L->errmsg);
+    lonL_initbuffer(L, &L->buffer);
+    lonL_initbuffer(L, &L->array);
+    L->rawnumber = L->tape == NULL && L->cb && L->cb->on_raw_number;
+    L->rawstring = L->tape == NULL && L->index == NULL
+        && L->cb && L->cb->on_raw_string;
+    if (L->tape) {
+        L->tape->count = 0;
+        L->tape->strings.jbuf = &L->jbuf;
+    }
+    if (L->index) {
+        lon_resetbuffer(&L->index->entries);
+        lon_resetbuffer(&L->index->keys);
+        free(L->index->slots);
+        L->index->slots = NULL;
+        L->index->entries.jbuf = L->index->keys.jbuf = &L->jbuf;
+    }
+}
+
+static void lonL_cleanup(lon_Loader *L) {
+    /* state of one load, shared by lon_break() and lon_validate() */
+    if (L->index)
+        L->index->entries.jbuf = L->index->keys.jbuf = NULL;
+    lonL_freebuffer(&L->buffer, (size_t)L->keepbuffer);
+    lonL_freebuffer(&L->errmsg, (size_t)L->keepbuffer);
+    lonL_freebuffer(&L->array, (size_t)L->keepbuffer);
+    lon_freeintern(&L->bkeys);
+    L->name = NULL;
+}
+
 LON_API int lon_load(lon_Loader *L, lon_Reader *reader, void *ud) {
     int res;
     lon_Callbacks cb = { NULL };
@@ -1370,7 +2699,12 @@ LON_API int lon_load(lon_Loader *L, lon_Reader *reader, void *ud) {
         ls.L = (lua_State*)L->lua_state;
         ls.size = 0;
         ls.capacity = 16;
+        ls.keys = 0;
         luaL_checkstack(ls.L, 16, "too many tables");
+        if (L->intern) {
+            lua_newtable(ls.L);
+            ls.keys = lua_gettop(ls.L);
+        }
         L->lua_state = (void*)&ls;
         lonL_initluacb(L, &cb);
     }
@@ -1378,18 +2712,17 @@ LON_API int lon_load(lon_Loader *L, lon_Reader *reader, void *ud) {
 #endif
     lonL_initdumpcb(L, &cb);
     if (L->cb) L->cb->loader = L;
-    L->reader = reader;
-    L->ud = ud;
-    L->line = 0;
-    L->current = 0, L->n = 0, L->p = NULL;
-    lon_initbuffer(&L->errmsg, &L->jbuf);
-    lon_initbuffer(&L->buffer, &L->jbuf);
+    lonL_reset(L, reader, ud);
     if ((res = setjmp(L->jbuf)) == 0) {
         lonX_next(L);
         lon_parser(L);
     }
     else if (res == LON_ERRMEM)
         lonL_outofmem(L);
+#ifdef LON_LUA_API
+    if (L->lua_state != NULL && ls.keys != 0)
+        lua_remove(ls.L, ls.keys);
+#endif
     lon_break(L, LON_OK);
     return res;
 }
@@ -1403,12 +2736,39 @@ LON_API void lon_break(lon_Loader *L, int res) {
     else
 #endif
     if (L->dumper) L->cb = NULL;
-    lon_freebuffer(&L->buffer);
-    lon_freebuffer(&L->errmsg);
-    L->name = NULL;
+    if (L->tape) {
+        L->tape->count = 0;
+        lon_freebuffer(&L->tape->strings);
+    }
+    lonL_cleanup(L);
     if (res != LON_OK) longjmp(L->jbuf, res);
 }
 
+LON_API int lon_validate(lon_Loader *L, lon_Reader *reader, void *ud) {
+    int res;
+    lon_Callbacks *cb = L->cb;
+    lon_Tape *tape = L->tape;
+    L->cb = NULL, L->tape = NULL;
+    L->validate = 1;
+    lonL_reset(L, reader, ud);
+    if ((res = setjmp(L->jbuf)) == 0) {
+        lonX_next(L);
+        lon_parser(L);
+    }
+    else if (res == LON_ERRMEM)
+        lonL_outofmem(L);
+    L->validate = 0;
+    L->cb = cb, L->tape = tape;
+    lonL_cleanup(L);
+    return res;
+}
+
+LON_API int lon_validate_buffer(lon_Loader *L, const char *s, size_t len) {
+    lon_StringCtx ctx = { len, 0, s };
+    L->name = "[=buffer]";
+    return lon_validate(L, lonL_stringreader, &ctx);
+}
+
 LON_API int lon_load_string(lon_Loader *L, const char *s) {
     lon_StringCtx ctx = { strlen(s), 0, s };
     L->name = "[=string]";
@@ -1423,10 +2783,294 @@ LON_API int lon_load_buffer(lon_Loader *L, const char *s, size_t len) {
 
 LON_API int lon_load_file(lon_Loader *L, const char *filename) {
     lon_FileCtx ctx = { 0 };
-    ctx.fp = fopen(filename, "r");
+    int res;
+    ctx.fp = fopen(filename, "rb");
+    if (ctx.fp == NULL) return LON_ERRFILE;
+    L->name = filename;
+    res = lon_load(L, lonL_filereader, &ctx);
+    fclose(ctx.fp);
+    return res;
+}
+
+LON_API int lon_load_next(lon_Loader *L, lon_Reader *reader, void *ud,
+                          size_t *poffset) {
+    int res;
+    if (*poffset != L->next) L->nextline = 0; /* not resuming */
+    L->next = *poffset;
+    L->once = 1;
+    res = lon_load(L, reader, ud);
+    L->once = 0;
+    if (res != LON_OK) return res;
+    *poffset = L->next = lon_offset(L);
+    L->nextline = L->line;
+    return L->token == TK_EOS ? LON_DONE : LON_OK;
+}
+
+LON_API int lon_load_next_buffer(lon_Loader *L, const char *s, size_t len,
+                                 size_t *poffset) {
+    lon_StringCtx ctx = { 0 };
+    if (*poffset > len) return LON_ERR;
+    ctx.len = len - *poffset, ctx.s = s + *poffset;
+    L->name = "[=buffer]";
+    return lon_load_next(L, lonL_stringreader, &ctx, poffset);
+}
+
+LON_API int lon_load_field(lon_Loader *L, lon_Reader *reader, void *ud,
+                           const lon_IndexEntry *e) {
+    lon_RangeCtx ctx;
+    lon_Index *index = L->index;
+    int res;
+    ctx.reader = reader, ctx.ud = ud, ctx.left = e->size;
+    L->index = NULL, L->field = e;
+    res = lon_load(L, lonL_rangereader, &ctx);
+    L->index = index, L->field = NULL;
+    return res;
+}
+
+LON_API int lon_load_field_buffer(lon_Loader *L, const char *s, size_t len,
+                                  const lon_IndexEntry *e) {
+    lon_StringCtx ctx = { 0 };
+    if (e->offset > len || e->size > len - e->offset) return LON_ERR;
+    ctx.len = e->size, ctx.s = s + e->offset;
+    L->name = "[=buffer]";
+    return lon_load_field(L, lonL_stringreader, &ctx, e);
+}
+
+LON_API int lon_load_field_file(lon_Loader *L, const char *filename,
+                                const lon_IndexEntry *e) {
+    lon_FileCtx ctx = { 0 };
+    int res;
+    ctx.fp = fopen(filename, "rb");
     if (ctx.fp == NULL) return LON_ERRFILE;
+    if (lon_fseek(ctx.fp, e->offset) != 0) {
+        fclose(ctx.fp);
+        return LON_ERRFILE;
+    }
     L->name = filename;
-    return lon_load(L, lonL_filereader, &ctx);
+    res = lon_load_field(L, lonL_filereader, &ctx, e);
+    fclose(ctx.fp);
+    return res;
+}
+
+LON_API int lon_tmpfile(lon_Buffer *name, const char *filename) {
+    /* mode "x" fails if the name is taken, e.g. by another process
+     * writing aside the same file, and the next name is tried */
+    static unsigned long counter;
+    unsigned long seed = (unsigned long)time(NULL) ^ (unsigned long)clock()
+        ^ (unsigned long)(size_t)name;
+    int i;
+    for (i = 0; i < 100; ++i) {
+        FILE *fp;
+        lon_resetbuffer(name);
+        if (!lon_addfstring(name, "%s.%08lx.tmp", filename,
+                    (seed + ++counter * 2654435761ul) & 0xFFFFFFFFul)
+                || !lon_addchar(name, '\0'))
+            return LON_ERRMEM;
+        if ((fp = fopen(lon_buffer(name), "wbx")) != NULL) {
+            fclose(fp);
+            return LON_OK;
+        }
+    }
+    return LON_ERRFILE;
+}
+
+LON_API int lon_replacefile(const char *from, const char *to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING
+            | MOVEFILE_WRITE_THROUGH) ? LON_OK : LON_ERRFILE;
+#else
+    return rename(from, to) == 0 ? LON_OK : LON_ERRFILE;
+#endif
+}
+
+
+/* lon offset index */
+
+typedef struct lonL_IndexReader {
+    lon_Callbacks cb;
+    lon_Index *I;
+    int column;          /* field of entry being read, -1 for depth */
+    lon_IndexEntry e;
+} lonL_IndexReader;
+
+static void lonL_idx_onbegin(lon_Callbacks *cb) {
+    lonL_IndexReader *r = (lonL_IndexReader*)cb;
+    r->I->entries.jbuf = r->I->keys.jbuf = &cb->loader->jbuf;
+}
+
+static void lonL_idx_oninteger(lon_Callbacks *cb, lon_Integer v) {
+    lonL_IndexReader *r = (lonL_IndexReader*)cb;
+    if (lon_status(cb->loader) == LON_STATUS_KEY)
+        r->column = (int)v;
+    else if (lon_levels(cb->loader) == 1 && r->column == -1)
+        r->I->depth = (int)v;
+    else if (lon_levels(cb->loader) == 2) {
+        switch (r->column) {
+        case 1: r->e.offset = (size_t)v; break;
+        case 2: r->e.size = (size_t)v; break;
+        case 3: r->e.line = (int)v; break;
+        case 4: r->e.index = v; break;
+        }
+    }
+}
+
+static void lonL_idx_onstring(lon_Callbacks *cb, const char *s, size_t len) {
+    lonL_IndexReader *r = (lonL_IndexReader*)cb;
+    if (lon_status(cb->loader) == LON_STATUS_KEY)
+        r->column = -1; /* depth = n */
+    else if (lon_levels(cb->loader) == 2 && r->column == 4) {
+        r->e.key = lon_buffsize(&r->I->keys);
+        r->e.keylen = len;
+        lon_addlstring(&r->I->keys, s, len);
+        lon_addchar(&r->I->keys, '\0');
+    }
+}
+
+static void lonL_idx_ontablebegin(lon_Callbacks *cb) {
+    lonL_IndexReader *r = (lonL_IndexReader*)cb;
+    memset(&r->e, 0, sizeof(r->e));
+    r->e.key = (size_t)-1;
+}
+
+static void lonL_idx_ontableend(lon_Callbacks *cb) {
+    lonL_IndexReader *r = (lonL_IndexReader*)cb;
+    if (lon_levels(cb->loader) == 2)
+        lon_addlstring(&r->I->entries, (const char*)&r->e, sizeof(r->e));
+}
+
+LON_API void lon_initindex(lon_Index *I, int depth) {
+    I->depth = depth;
+    lon_initbuffer(&I->entries, NULL);
+    lon_initbuffer(&I->keys, NULL);
+    I->slots = NULL;
+    I->mask = 0;
+}
+
+LON_API void lon_freeindex(lon_Index *I) {
+    lon_freebuffer(&I->entries);
+    lon_freebuffer(&I->keys);
+    free(I->slots);
+    lon_initindex(I, I->depth);
+}
+
+LON_API void lon_setindex(lon_Loader *L, lon_Index *I)
+{ L->index = I; }
+
+LON_API int lon_index_write(lon_Index *I, const char *filename) {
+    /* the index is itself lon: { depth = n, {offset, size, line, key}... } */
+    const lon_IndexEntry *e = (const lon_IndexEntry*)lon_buffer(&I->entries);
+    size_t i, n = lon_buffsize(&I->entries) / sizeof(lon_IndexEntry);
+    lon_Dumper D;
+    int res;
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) return LON_ERRFILE;
+    lon_initdumper(&D);
+    lon_setwriter(&D, lonL_filewriter, fp);
+    lon_setdumpopt(&D, LON_OPT_INDENT, 1);
+    lon_dump_begin(&D);
+    lon_dump_table_begin(&D);
+    lon_dump_string(&D, "depth");
+    lon_dump_integer(&D, I->depth);
+    for (i = 0; i < n; ++i) {
+        lon_dump_integer(&D, (lon_Integer)i + 1);
+        lon_dump_table_begin(&D);
+        lon_dump_integer(&D, 1);
+        lon_dump_integer(&D, (lon_Integer)e[i].offset);
+        lon_dump_integer(&D, 2);
+        lon_dump_integer(&D, (lon_Integer)e[i].size);
+        lon_dump_integer(&D, 3);
+        lon_dump_integer(&D, e[i].line);
+        lon_dump_integer(&D, 4);
+        if (e[i].key != (size_t)-1)
+            lon_dump_buffer(&D, lon_buffer(&I->keys) + e[i].key, e[i].keylen);
+        else
+            lon_dump_integer(&D, e[i].index);
+        lon_dump_table_end(&D);
+    }
+    lon_dump_table_end(&D);
+    lon_dump_end(&D);
+    res = ferror(fp) ? LON_ERRFILE : LON_OK;
+    if (fclose(fp) != 0) res = LON_ERRFILE;
+    return res;
+}
+
+LON_API int lon_index_read(lon_Index *I, const char *filename) {
+    lonL_IndexReader r;
+    lon_Loader L;
+    int res;
+    memset(&r, 0, sizeof(r));
+    r.I = I;
+    r.cb.on_begin       = lonL_idx_onbegin;
+    r.cb.on_integer     = lonL_idx_oninteger;
+    r.cb.on_string      = lonL_idx_onstring;
+    r.cb.on_table_begin = lonL_idx_ontablebegin;
+    r.cb.on_table_end   = lonL_idx_ontableend;
+    lon_resetbuffer(&I->entries);
+    lon_resetbuffer(&I->keys);
+    free(I->slots);
+    I->slots = NULL;
+    lon_initloader(&L);
+    lon_setcallbacks(&L, &r.cb);
+    res = lon_load_file(&L, filename);
+    I->entries.jbuf = I->keys.jbuf = NULL;
+    return res;
+}
+
+LON_API const lon_IndexEntry *lon_index_entries(lon_Index *I, size_t *pn) {
+    if (pn) *pn = lon_buffsize(&I->entries) / sizeof(lon_IndexEntry);
+    return (const lon_IndexEntry*)lon_buffer(&I->entries);
+}
+
+LON_API const char *lon_index_key(lon_Index *I, const lon_IndexEntry *e,
+                                  size_t *plen) {
+    if (e->key == (size_t)-1) return NULL;
+    if (plen) *plen = e->keylen;
+    return lon_buffer(&I->keys) + e->key;
+}
+
+static int lonL_samekey(lon_Index *I, const lon_IndexEntry *e,
+                        const char *s, size_t len) {
+    return e->key != (size_t)-1 && e->keylen == len
+        && memcmp(lon_buffer(&I->keys) + e->key, s, len) == 0;
+}
+
+static void lonL_buildslots(lon_Index *I) {
+    /* equal keys share a slot, so the last one wins */
+    const lon_IndexEntry *e = (const lon_IndexEntry*)lon_buffer(&I->entries);
+    size_t i, n = lon_buffsize(&I->entries) / sizeof(lon_IndexEntry);
+    size_t mask = 15;
+    while (mask < n*2) mask = mask*2 + 1;
+    if ((I->slots = (size_t*)calloc(mask + 1, sizeof(size_t))) == NULL)
+        return;
+    I->mask = mask;
+    for (i = 0; i < n; ++i) {
+        const char *s = lon_index_key(I, &e[i], NULL);
+        size_t h;
+        if (s == NULL) continue;
+        h = lon_hash(s, e[i].keylen) & mask;
+        while (I->slots[h] != 0
+                && !lonL_samekey(I, &e[I->slots[h]-1], s, e[i].keylen))
+            h = (h + 1) & mask;
+        I->slots[h] = i + 1;
+    }
+}
+
+LON_API const lon_IndexEntry *lon_index_find(lon_Index *I, const char *s,
+                                             size_t len) {
+    const lon_IndexEntry *e = (const lon_IndexEntry*)lon_buffer(&I->entries);
+    size_t i, h;
+    if (I->slots == NULL) lonL_buildslots(I);
+    if (I->slots != NULL) {
+        h = lon_hash(s, len) & I->mask;
+        for (; I->slots[h] != 0; h = (h + 1) & I->mask)
+            if (lonL_samekey(I, &e[I->slots[h]-1], s, len))
+                return &e[I->slots[h]-1];
+        return NULL;
+    }
+    for (i = lon_buffsize(&I->entries) / sizeof(lon_IndexEntry); i > 0; --i)
+        if (lonL_samekey(I, &e[i-1], s, len))
+            return &e[i-1];
+    return NULL;
 }
 
 
@@ -1435,6 +3079,7 @@ LON_API int lon_load_file(lon_Loader *L, const char *filename) {
 #define lonD_iskey(D) ((D)->stack[D->levels].iskey)
 #define lonD_subsq(D) ((D)->stack[D->levels].subsq)
 #define lonD_index(D) ((D)->stack[D->levels].index)
+#define lonD_object(D) ((D)->stack[D->levels].object)
 
 #define lonD_addstring(D,s) lonD_addlstring((D),(s),strlen(s))
 
@@ -1478,14 +3123,14 @@ static void lonD_addfstring(lon_Dumper *D, const char *fmt, ...) {
     va_copy(l_try, l);
     len = vsnprintf(D->buffer+D->buff_size, remain, fmt, l_try);
     va_end(l_try);
-    if (len <= remain) goto out;
+    if (len < remain) goto out;  /* output and its '\0' fit */
     lon_dump_flush(D);
-    if (len <= LON_BUFFERSIZE)
+    if (len < LON_BUFFERSIZE)
         vsnprintf(D->buffer+D->buff_size, LON_BUFFERSIZE, fmt, l);
     else if (D->writer) {
-        char *buff = (char*)malloc(len);
+        char *buff = (char*)malloc(len + 1);
         if (buff == NULL) goto out;
-        vsnprintf(buff, len, fmt, l);
+        vsnprintf(buff, len + 1, fmt, l);
         D->writer(D->ud, buff, len);
         free(buff);
         len = 0;
@@ -1524,6 +3169,10 @@ static void lonD_begin(lon_Dumper *D) {
     /* 2. for table key object, add comma, newline and indent */
     if (D->levels == 0 || lonD_iskey(D)) {
         int subsq = lonD_subsq(D);
+        if (D->levels == 0 && D->opt_json) {
+            if (subsq) lonD_addchar(D, '\n');  /* JSON lines */
+            return;
+        }
         if (subsq) lonD_addchar(D, ',');
         if (D->levels == 0 && !subsq) return;
         if (D->levels == 0 || D->opt_no_newline)
@@ -1540,13 +3189,35 @@ static void lonD_end(lon_Dumper *D) {
     if (D->levels == 0) return;
     if (!lonD_iskey(D)) lonD_iskey(D) = 1;
     else {
-        if (!D->opt_compat) lonD_addchar(D, ' ');
-        lonD_addchar(D, '=');
+        if (!D->opt_compat && !D->opt_json) lonD_addchar(D, ' ');
+        lonD_addchar(D, D->opt_json ? ':' : '=');
         if (!D->opt_compat) lonD_addchar(D, ' ');
         lonD_iskey(D) = 0;
     }
 }
 
+static void lonD_addinteger(lon_Dumper *D, lon_Integer v) {
+    char buff[32], *p = buff + sizeof(buff);
+    unsigned long long u = (unsigned long long)v;
+    if (D->opt_int_hexa && !D->opt_json) {
+        lonD_addfstring(D, "0x%llx", u);
+        return;
+    }
+    if (v < 0) u = 0ull - u;
+    do *--p = (char)('0' + u % 10); while ((u /= 10) != 0);
+    if (v < 0) *--p = '-';
+    lonD_addlstring(D, p, buff + sizeof(buff) - p);
+}
+
+static void lonD_addnumber(lon_Dumper *D, lon_Number v) {
+    if (D->opt_flt_hexa && !D->opt_json)
+        lonD_addfstring(D, "%a", v);
+    else if (D->opt_flt_prec == 0)
+        lonD_addfstring(D, "%g", v);
+    else
+        lonD_addfstring(D, "%.*g", (int)D->opt_flt_prec, v);
+}
+
 static void lonD_escapechar(lon_Dumper *D, int ch) {
     int esc = 0;
     switch (ch) {
@@ -1591,6 +3262,115 @@ static void lonD_addescape(lon_Dumper *D, const char *s, size_t len) {
     }
 }
 
+static void lonD_jescape(lon_Dumper *D, const char *s, size_t len) {
+    /* JSON string, bytes >= 0x80 are copied as UTF-8 */
+    const char *p = s, *e = s + len;
+    lonD_addchar(D, '"');
+    for (; p < e; ++p) {
+        int ch = (unsigned char)*p;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') continue;
+        lonD_addlstring(D, s, p - s);
+        s = p + 1;
+        switch (ch) {
+        case '"':  lonD_addstring(D, "\\\""); break;
+        case '\\': lonD_addstring(D, "\\\\"); break;
+        case '\b': lonD_addstring(D, "\\b"); break;
+        case '\f': lonD_addstring(D, "\\f"); break;
+        case '\n': lonD_addstring(D, "\\n"); break;
+        case '\r': lonD_addstring(D, "\\r"); break;
+        case '\t': lonD_addstring(D, "\\t"); break;
+        default:   lonD_addfstring(D, "\\u%04x", ch);
+        }
+    }
+    lonD_addlstring(D, s, e - s);
+    lonD_addchar(D, '"');
+}
+
+static int lonD_jskip(lon_Dumper *D, int delta) {
+    /* swallow a dropped JSON field: 'delta' is 1 for table begin, -1
+     * for table end and 0 for other values; returns 1 if swallowed */
+    if (D->jdrop == 0 || (delta < 0 && D->jskip == 0)) {
+        D->jdrop = 0;
+        return 0;
+    }
+    D->jskip += delta;
+    if (D->jskip == 0 && delta <= 0 && --D->jdrop == 0)
+        lonD_iskey(D) = 1;
+    return 1;
+}
+
+static int lonD_jdrop(lon_Dumper *D, unsigned n) {
+    /* drop a field JSON cannot hold: 'n' is 2 if its key is not
+     * written yet */
+    D->jdrop = n;
+    return 0;
+}
+
+static int lonD_jbegin(lon_Dumper *D, int positional) {
+    /* open the container at its first key, positional keys make an
+     * array and others an object; returns 0 if the field is dropped */
+    if (lonD_jskip(D, 0)) return 0;
+    if (!lonD_iskey(D)) {
+        lonD_begin(D);
+        return 1;
+    }
+    if (!lonD_subsq(D)) {
+        lonD_object(D) = !positional;
+        lonD_addchar(D, positional ? '[' : '{');
+    }
+    else if (!positional && !lonD_object(D))
+        return lonD_jdrop(D, 1);  /* arrays have no keys */
+    lonD_begin(D);
+    return 1;
+}
+
+static void lonD_bbegin(lon_Dumper *D) {
+    /* tag non-positional keys */
+    if (D->levels != 0 && lonD_iskey(D))
+        lonD_addchar(D, LON_BT_KEY);
+}
+
+static void lonD_bend(lon_Dumper *D)
+{ if (D->levels != 0) lonD_iskey(D) = !lonD_iskey(D); }
+
+static void lonD_bvarint(lon_Dumper *D, unsigned long long u) {
+    char buff[10];
+    size_t n = 0;
+    for (; u >= 0x80; u >>= 7)
+        buff[n++] = (char)(u | 0x80);
+    buff[n++] = (char)u;
+    lonD_addlstring(D, buff, n);
+}
+
+static void lonD_bnumber(lon_Dumper *D, lon_Number v) {
+    double d = (double)v;
+    unsigned long long u;
+    char buff[8];
+    int i;
+    memcpy(&u, &d, sizeof(u));
+    for (i = 0; i < 8; ++i, u >>= 8)
+        buff[i] = (char)(u & 0xFF);
+    lonD_addlstring(D, buff, 8);
+}
+
+static int lonD_bkey(lon_Dumper *D, const char *s, size_t len) {
+    /* string key through key dictionary, 0 if it can not be used */
+    size_t count = D->keydict.count;
+    const lon_Key *k;
+    if (D->opt_binary < 2) return 0;
+    if ((k = lon_intern(&D->keydict, s, len, lon_hash(s, len))) == NULL)
+        return 0;
+    if (k->id != count) {
+        lonD_addchar(D, LON_BT_REFKEY);
+        lonD_bvarint(D, k->id);
+        return 1;
+    }
+    lonD_addchar(D, LON_BT_DEFKEY);
+    lonD_bvarint(D, len);
+    lonD_addlstring(D, s, len);
+    return 1;
+}
+
 LON_API void lon_setbuffer(lon_Dumper *D, lon_Buffer *buffer) {
     D->outbuffer = buffer;
     D->writer = lonD_buffwriter;
@@ -1635,6 +3415,18 @@ LON_API int lon_setdumpopt(lon_Dumper *D, int opt, int value) {
         oldvalue = D->opt_str_quote;
         D->opt_str_quote = clamp(value, 0, 16);
         break;
+    case LON_OPT_BINARY:
+        oldvalue = D->opt_binary;
+        D->opt_binary = clamp(value, 0, 3);
+        break;
+    case LON_OPT_VERBATIM:
+        oldvalue = D->opt_verbatim;
+        D->opt_verbatim = !!value;
+        break;
+    case LON_OPT_JSON:
+        oldvalue = D->opt_json;
+        D->opt_json = !!value;
+        break;
 #undef clamp
     }
     return oldvalue;
@@ -1644,10 +3436,17 @@ LON_API void lon_dump_begin(lon_Dumper *D) {
     if (D->opt_indent == 0) D->opt_indent = 3;
     D->levels     = 0;
     D->buff_size  = 0;
+    D->jskip      = 0;
+    D->jdrop      = 0;
     lonD_iskey(D) = 0;
     lonD_subsq(D) = 0;
     lonD_index(D) = 0;
-    if (!D->opt_no_return)
+    lon_freeintern(&D->keydict);
+    if (D->opt_binary) {
+        lonD_addstring(D, LON_BINARY_MAGIC);
+        lonD_addchar(D, LON_BINARY_VERSION);
+    }
+    else if (!D->opt_no_return && !D->opt_json)
         lonD_addstring(D, "return ");
 }
 
@@ -1660,28 +3459,64 @@ LON_API void lon_dump_flush(lon_Dumper *D) {
 LON_API void lon_dump_end(lon_Dumper *D) {
     do lonD_iskey(D) = 0;
     while (lon_dump_table_end(D));
-    if (!D->opt_no_newline && !D->opt_compat)
+    if (!D->opt_no_newline && !D->opt_compat && !D->opt_binary)
         lonD_addchar(D, '\n');
     lon_dump_flush(D);
+    lon_freeintern(&D->keydict);
 }
 
 LON_API int lon_dump_table_begin(lon_Dumper *D) {
     if (D->levels >= LON_MAX_LEVEL-1)
         return 0;
-    lonD_begin(D);
-    if (lonD_iskey(D)) lonD_addchar(D, '[');
-    lonD_addchar(D, '{');
+    if (D->opt_binary) {
+        lonD_bbegin(D);
+        lonD_addchar(D, LON_BT_TABLE);
+    }
+    else if (D->opt_json) {
+        if (lonD_jskip(D, 1)) return 1;
+        if (D->levels != 0 && lonD_iskey(D)) {
+            lonD_jdrop(D, 2);  /* table key */
+            return lonD_jskip(D, 1);
+        }
+        lonD_begin(D);  /* '[' or '{' waits for the first key */
+    }
+    else {
+        lonD_begin(D);
+        if (lonD_iskey(D)) lonD_addchar(D, '[');
+        lonD_addchar(D, '{');
+    }
     ++D->levels;
     lonD_iskey(D) = 1;
     lonD_subsq(D) = 0;
     lonD_index(D) = 0;
+    lonD_object(D) = 0;
     return 1;
 }
 
 LON_API int lon_dump_table_end(lon_Dumper *D) {
-    int subsq = lonD_subsq(D);
+    int subsq = lonD_subsq(D), object = lonD_object(D);
+    if (D->opt_json && !D->opt_binary && lonD_jskip(D, -1)) return 1;
     if (D->levels == 0) return 0;
     --D->levels;
+    if (D->opt_binary) {
+        lonD_addchar(D, LON_BT_END);
+        lonD_bend(D);
+        return 1;
+    }
+    if (D->opt_json) {
+        if (!subsq) lonD_addstring(D, "{}");
+        else {
+            if (D->opt_no_newline)
+                lonD_addchar(D, ' ');
+            else if (!D->opt_compat) {
+                lonD_addchar(D, '\n');
+                lonD_addindent(D);
+            }
+            lonD_addchar(D, object ? '}' : ']');
+        }
+        lonD_end(D);
+        return 1;
+    }
     if (D->opt_no_newline)
         lonD_addchar(D, ' ');
     else if (subsq && !D->opt_compat) {
@@ -1695,6 +3530,20 @@ LON_API int lon_dump_table_end(lon_Dumper *D) {
 }
 
 LON_API int lon_dump_nil(lon_Dumper *D) {
+    if (D->opt_binary) {
+        lonD_bbegin(D);
+        lonD_addchar(D, LON_BT_NIL);
+        lonD_bend(D);
+        return 0;
+    }
+    if (D->opt_json) {
+        if (lonD_jskip(D, 0)) return 0;
+        if (D->levels != 0 && lonD_iskey(D)) return lonD_jdrop(D, 1);
+        lonD_begin(D);
+        lonD_addstring(D, "null");
+        lonD_end(D);
+        return 0;
+    }
     lonD_begin(D);
     if (lonD_iskey(D)) lonD_addstring(D, "['nil']");
     else lonD_addstring(D, "nil");
@@ -1704,6 +3553,20 @@ LON_API int lon_dump_nil(lon_Dumper *D) {
 
 LON_API int lon_dump_boolean(lon_Dumper *D, int v) {
     int iskey = lonD_iskey(D);
+    if (D->opt_binary) {
+        lonD_bbegin(D);
+        lonD_addchar(D, v ? LON_BT_TRUE : LON_BT_FALSE);
+        lonD_bend(D);
+        return 1;
+    }
+    if (D->opt_json) {
+        if (!lonD_jbegin(D, 0)) return 0;
+        if (iskey) lonD_addchar(D, '"');
+        lonD_addstring(D, v ? "true" : "false");
+        if (iskey) lonD_addchar(D, '"');
+        lonD_end(D);
+        return 1;
+    }
     lonD_begin(D);
     if (iskey) lonD_addchar(D, '[');
     if (v) lonD_addstring(D, "true");
@@ -1715,6 +3578,33 @@ LON_API int lon_dump_boolean(lon_Dumper *D, int v) {
 
 LON_API int lon_dump_integer(lon_Dumper *D, lon_Integer v) {
     int iskey = lonD_iskey(D);
+    if (D->opt_binary) {
+        if (D->levels != 0 && iskey && lonD_index(D) + 1 == v) {
+            ++lonD_index(D);  /* positional field */
+            lonD_iskey(D) = 0;
+            return 1;
+        }
+        lonD_bbegin(D);
+        lonD_addchar(D, LON_BT_INT);
+        lonD_bvarint(D, lonB_zigzag(v));
+        lonD_bend(D);
+        return 1;
+    }
+    if (D->opt_json) {
+        int positional = iskey && D->levels != 0 && lonD_index(D) + 1 == v;
+        if (!lonD_jbegin(D, positional)) return 0;
+        if (positional) ++lonD_index(D);
+        if (positional && !lonD_object(D)) {
+            lonD_subsq(D) = 1;
+            lonD_iskey(D) = 0;
+            return 1;
+        }
+        if (iskey) lonD_addchar(D, '"');
+        lonD_addinteger(D, v);
+        if (iskey) lonD_addchar(D, '"');
+        lonD_end(D);
+        return 1;
+    }
     lonD_begin(D);
     if (iskey && lonD_index(D) + 1 == v) {
         ++lonD_index(D);
@@ -1723,10 +3613,7 @@ LON_API int lon_dump_integer(lon_Dumper *D, lon_Integer v) {
     }
     else {
         if (iskey) lonD_addchar(D, '[');
-        if (D->opt_int_hexa)
-            lonD_addfstring(D, "0x%x", v);
-        else
-            lonD_addfstring(D, "%d", v);
+        lonD_addinteger(D, v);
         if (iskey) lonD_addchar(D, ']');
         lonD_end(D);
     }
@@ -1735,14 +3622,27 @@ LON_API int lon_dump_integer(lon_Dumper *D, lon_Integer v) {
 
 LON_API int lon_dump_number(lon_Dumper *D, lon_Number v) {
     int iskey = lonD_iskey(D);
+    if (D->opt_binary) {
+        lonD_bbegin(D);
+        lonD_addchar(D, LON_BT_FLT);
+        lonD_bnumber(D, v);
+        lonD_bend(D);
+        return 1;
+    }
+    if (D->opt_json) {
+        if (!lonD_jbegin(D, 0)) return 0;
+        if (iskey) lonD_addchar(D, '"');
+        if (!iskey && v - v != v - v)
+            lonD_addstring(D, "null");  /* inf and nan */
+        else
+            lonD_addnumber(D, v);
+        if (iskey) lonD_addchar(D, '"');
+        lonD_end(D);
+        return 1;
+    }
     lonD_begin(D);
     if (iskey) lonD_addchar(D, '[');
-    if (D->opt_flt_hexa)
-        lonD_addfstring(D, "%a", v);
-    else if (D->opt_flt_prec == 0)
-        lonD_addfstring(D, "%g", v);
-    else
-        lonD_addfstring(D, "%.*g", (int)D->opt_flt_prec, v);
+    lonD_addnumber(D, v);
     if (iskey) lonD_addchar(D, ']');
     lonD_end(D);
     return 1;
@@ -1750,6 +3650,22 @@ LON_API int lon_dump_number(lon_Dumper *D, lon_Number v) {
 
 LON_API int lon_dump_buffer(lon_Dumper *D, const char *s, size_t len) {
     int iskey = lonD_iskey(D);
+    if (D->opt_binary) {
+        if (D->levels == 0 || !iskey || !lonD_bkey(D, s, len)) {
+            lonD_bbegin(D);
+            lonD_addchar(D, LON_BT_STRING);
+            lonD_bvarint(D, len);
+            lonD_addlstring(D, s, len);
+        }
+        lonD_bend(D);
+        return 1;
+    }
+    if (D->opt_json) {
+        if (!lonD_jbegin(D, 0)) return 0;
+        lonD_jescape(D, s, len);
+        lonD_end(D);
+        return 1;
+    }
     lonD_begin(D);
     if (iskey && lon_isidentifier(s, len)
             && lonX_checkkeyword(s, len) == TK_NAME)
@@ -1763,10 +3679,605 @@ LON_API int lon_dump_buffer(lon_Dumper *D, const char *s, size_t len) {
     return 1;
 }
 
+LON_API int lon_dump_raw(lon_Dumper *D, const char *s, size_t len) {
+    /* numeral or string literal written as is */
+    int iskey = lonD_iskey(D), quoted = len >= 2 && (*s == '"' || *s == '\'');
+    if (D->opt_json && !D->opt_binary && !iskey && lonJ_isnumeral(s, s+len)) {
+        if (!lonD_jbegin(D, 0)) return 0;
+        lonD_addlstring(D, s, len);
+        lonD_end(D);
+        return 1;
+    }
+    if (D->opt_binary || D->opt_json) {
+        lon_Integer i;
+        lon_Number n;
+        switch (lonL_tonumeral(s, len, &i, &n)) {
+        case TK_INT: return lon_dump_integer(D, i);
+        case TK_FLT: return lon_dump_number(D, n);
+        }
+        return 0;  /* literals are not decoded */
+    }
+    lonD_begin(D);
+    if (iskey && quoted && memchr(s, '\\', len) == NULL
+            && lon_isidentifier(s+1, len-2)
+            && lonX_checkkeyword(s+1, len-2) == TK_NAME)
+        lonD_addlstring(D, s+1, len-2);  /* key needs no quoting */
+    else if (iskey && *s == '[') {
+        lonD_addstring(D, "[ ");  /* "[[" would open a long string */
+        lonD_addlstring(D, s, len);
+        lonD_addstring(D, " ]");
+    }
+    else {
+        if (iskey) lonD_addchar(D, '[');
+        lonD_addlstring(D, s, len);
+        if (iskey) lonD_addchar(D, ']');
+    }
+    lonD_end(D);
+    return 1;
+}
+
+static int lonD_arraybegin(lon_Dumper *D) {
+    /* elements of an array are positional fields of current table,
+     * or of a new table if a value is expected */
+    if (D->levels == 0 || lonD_iskey(D)) return 0;
+    return lon_dump_table_begin(D);
+}
+
+static void lonD_element(lon_Dumper *D) {
+    lonD_begin(D);
+    if (D->levels != 0) ++lonD_index(D);
+    lonD_subsq(D) = 1;
+}
+
+static int lonD_jarray(lon_Dumper *D, const lon_Integer *iv,
+                       const lon_Number *nv, size_t n) {
+    int table;
+    size_t i;
+    if (lonD_jskip(D, 0)) return 0;
+    table = lonD_arraybegin(D);
+    for (i = 0; i < n; ++i) {
+        if (D->levels != 0)
+            lon_dump_integer(D, (lon_Integer)lonD_index(D) + 1);
+        if (iv) lon_dump_integer(D, iv[i]);
+        else lon_dump_number(D, nv[i]);
+    }
+    if (table) lon_dump_table_end(D);
+    return 1;
+}
+
+static int lonD_barray(lon_Dumper *D, const lon_Integer *iv,
+                      const lon_Number *nv, size_t n) {
+    int table = lonD_arraybegin(D);
+    size_t i;
+    lonD_addchar(D, iv ? LON_BT_INTS : LON_BT_FLTS);
+    lonD_bvarint(D, n);
+    for (i = 0; i < n; ++i) {
+        if (iv) lonD_bvarint(D, lonB_zigzag(iv[i]));
+        else lonD_bnumber(D, nv[i]);
+    }
+    if (D->levels != 0) lonD_index(D) += n;
+    if (table) lon_dump_table_end(D);
+    return 1;
+}
+
+LON_API int lon_dump_integer_array(lon_Dumper *D, const lon_Integer *v,
+                                   size_t n) {
+    int table;
+    size_t i;
+    if (D->opt_binary) return lonD_barray(D, v, NULL, n);
+    if (D->opt_json) return lonD_jarray(D, v, NULL, n);
+    table = lonD_arraybegin(D);
+    for (i = 0; i < n; ++i) {
+        lonD_element(D);
+        lonD_addinteger(D, v[i]);
+    }
+    if (table) lon_dump_table_end(D);
+    return 1;
+}
+
+LON_API int lon_dump_number_array(lon_Dumper *D, const lon_Number *v,
+                                  size_t n) {
+    int table;
+    size_t i;
+    if (D->opt_binary) return lonD_barray(D, NULL, v, n);
+    if (D->opt_json) return lonD_jarray(D, NULL, v, n);
+    table = lonD_arraybegin(D);
+    for (i = 0; i < n; ++i) {
+        lonD_element(D);
+        lonD_addnumber(D, v[i]);
+    }
+    if (table) lon_dump_table_end(D);
+    return 1;
+}
+
 
 LON_NS_END
 
 #endif /* LON_IMPLEMENTATION */
+
+#ifdef LON_PARSER_BODY
+/* grammar of the parsers, included once by the implementation above with
+ * the LON_PARSE_* macros making it C, and once more by lon.hpp making it
+ * templates on a handler; events go through the lonY_on*() functions */
+
+LON_PARSE_FUNC void lonY_expr(LON_PARSE_PARAMS);
+
+LON_PARSE_FUNC void lonY_literal(LON_PARSE_PARAMS) {
+    /* string token as written, or its decoded content */
+    if (lonX_rawstring(L))
+        lonY_rawstring(LON_PARSE_ARGS);
+    else
+        lonY_string(LON_PARSE_ARGS, lon_buffer(&L->buffer)+L->seplen,
+                lon_buffsize(&L->buffer)-L->seplen*2);
+}
+
+LON_PARSE_FUNC void lonY_flushrun(LON_PARSE_PARAMS, int run,
+                                  lon_Integer first) {
+    size_t size = lon_buffsize(&L->array);
+    if (run == 0) return;
+    L->status = LON_STATUS_VALUE;
+    if (run == TK_INT)
+        lonY_onintegerarray(LON_PARSE_ARGS, first,
+                (const lon_Integer*)lon_buffer(&L->array),
+                size / sizeof(lon_Integer));
+    else
+        lonY_onnumberarray(LON_PARSE_ARGS, first,
+                (const lon_Number*)lon_buffer(&L->array),
+                size / sizeof(lon_Number));
+    lon_resetbuffer(&L->array);
+}
+
+LON_PARSE_FUNC int lonY_field(LON_PARSE_PARAMS, lon_Integer index) {
+    /* field: exp | (NAME | '[' exp ']') '=' exp */
+    L->status = LON_STATUS_KEY;
+    switch (L->token) {
+        if (L->token == TK_NAME) {
+    case TK_NAME:
+            if (lonY_indexing(L))
+                lonY_indexkey(L, lon_buffer(&L->buffer),
+                        lon_buffsize(&L->buffer), 0);
+            if (lonY_haskey(LON_PARSE_ARGS))
+                lonY_key(LON_PARSE_ARGS, lon_buffer(&L->buffer),
+                        lon_buffsize(&L->buffer), L->hash);
+            else
+                lonY_string(LON_PARSE_ARGS, lon_buffer(&L->buffer),
+                        lon_buffsize(&L->buffer));
+            lonY_next(L);
+        }
+        else /*if (L->token == '[')*/ {
+    case '[':
+            lonY_next(L);
+            if (lonY_indexing(L) && L->token == TK_STRING)
+                lonY_indexkey(L, lon_buffer(&L->buffer) + L->seplen,
+                        lon_buffsize(&L->buffer) - L->seplen*2, 0);
+            else if (lonY_indexing(L) && L->token == TK_INT)
+                lonY_indexkey(L, NULL, 0, L->iv);
+            if (L->token == TK_STRING && lonY_haskey(LON_PARSE_ARGS)
+                    && !lonX_rawstring(L)) {
+                const char *s = lon_buffer(&L->buffer) + L->seplen;
+                size_t len = lon_buffsize(&L->buffer) - L->seplen*2;
+                lonY_key(LON_PARSE_ARGS, s, len, lon_hash(s, len));
+                lonY_next(L);
+            }
+            else lonY_expr(LON_PARSE_ARGS);
+            lonY_checknext(L, ']');
+        }
+        lonY_checknext(L, '=');
+        L->status = LON_STATUS_VALUE;
+        lonY_expr(LON_PARSE_ARGS);
+        return 0;
+    default:
+        if (lonY_indexing(L))
+            lonY_indexkey(L, NULL, 0, index);
+        lonY_index(LON_PARSE_ARGS, index);
+        L->status = LON_STATUS_VALUE;
+        lonY_expr(LON_PARSE_ARGS);
+        return 1;
+    }
+}
+
+LON_PARSE_FUNC void lonY_table(LON_PARSE_PARAMS) {
+    /* table -> '{' [ field { sep field } [sep] ] '}'
+       sep -> ',' | ';' */
+    lon_Integer index = 1;
+    int line = L->line;
+    int status = L->status;
+    int run = 0;             /* pending numeral run, and its first index */
+    lon_Integer first = 0;
+    int indexed = L->index && L->levels + 1 == L->index->depth;
+    size_t start = indexed ? lon_offset(L) : 0; /* field after '{' or sep */
+    int startline = L->line;
+    lonY_checknext(L, '{');
+    if (++L->levels > L->maxlevels && L->maxlevels != 0)
+        lonX_error(L, "too many nested tables", 0);
+    lonY_ontablebegin(LON_PARSE_ARGS);
+    do {
+        if (L->token == '}') break;
+        if (indexed) lonY_beginfield(L, start, startline);
+        if (L->token == '-') lonY_negate(L);
+        if (!lonY_isrun(LON_PARSE_ARGS)) {
+            lonY_flushrun(LON_PARSE_ARGS, run, first);
+            run = 0;
+            index += lonY_field(LON_PARSE_ARGS, index);
+            if (indexed) start = lonY_endfield(L), startline = L->line;
+            continue;
+        }
+        if (run != L->token) {
+            lonY_flushrun(LON_PARSE_ARGS, run, first);
+            run = L->token;
+            first = index;
+        }
+        if (run == TK_INT)
+            lon_addlstring(&L->array, (const char*)&L->iv, sizeof(L->iv));
+        else
+            lon_addlstring(&L->array, (const char*)&L->nv, sizeof(L->nv));
+        ++index;
+        lonY_next(L);
+    } while (lonY_testnext(L, ',') || lonY_testnext(L, ';'));
+    lonY_flushrun(LON_PARSE_ARGS, run, first);
+    lonY_closetable(L, '}', '{', line);
+    L->status = status;
+    lonY_ontableend(LON_PARSE_ARGS);
+    --L->levels;
+}
+
+LON_PARSE_FUNC int lonY_scalar(LON_PARSE_PARAMS) {
+    /* emit current token if it is a scalar value */
+    switch (L->token) {
+    case TK_NIL:
+        lonY_onnil(LON_PARSE_ARGS);
+        break;
+    case TK_TRUE:
+    case TK_FALSE:
+        lonY_onboolean(LON_PARSE_ARGS, L->token == TK_TRUE);
+        break;
+    case TK_INT:
+        if (lonX_rawnumber(L))
+            lonY_rawnumber(LON_PARSE_ARGS);
+        else
+            lonY_oninteger(LON_PARSE_ARGS, L->iv);
+        break;
+    case TK_FLT:
+        if (lonX_rawnumber(L))
+            lonY_rawnumber(LON_PARSE_ARGS);
+        else
+            lonY_onnumber(LON_PARSE_ARGS, L->nv);
+        break;
+    case TK_STRING:
+        lonY_literal(LON_PARSE_ARGS);
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+LON_PARSE_FUNC void lonY_expr(LON_PARSE_PARAMS) {
+    /* exp -> nil | boolean | integer | number | string | table */
+    switch (L->token) {
+    case TK_EOS:
+        return;
+    case '{':
+        lonY_table(LON_PARSE_ARGS);
+        return;
+    case '-':
+        lonY_negate(L);
+        lonY_expr(LON_PARSE_ARGS);
+        return;
+    }
+    if (!lonY_scalar(LON_PARSE_ARGS))
+        lonX_error(L, "unexpected symbol", L->token);
+    lonY_endvalue(L);
+}
+
+LON_PARSE_FUNC void lonY_onefield(LON_PARSE_PARAMS) {
+    /* field loaded by lon_load_field(), as a table of just that field */
+    lon_Integer index = L->field->index > 0 ? L->field->index : 1;
+    lonY_next(L);
+    ++L->levels;
+    lonY_ontablebegin(LON_PARSE_ARGS);
+    if (L->token == '-') lonY_negate(L);
+    lonY_field(LON_PARSE_ARGS, index);
+    lonY_check(L, TK_EOS);
+    L->status = LON_STATUS_TOP;
+    lonY_ontableend(LON_PARSE_ARGS);
+    --L->levels;
+}
+
+LON_PARSE_FUNC void lonY_expr_list(LON_PARSE_PARAMS) {
+    /* expr_list -> expr { ',' expr } */
+    L->status = LON_STATUS_TOP;
+    lonY_expr(LON_PARSE_ARGS);
+    for (;;) {
+        switch (L->token) {
+        case TK_EOS:
+            return;
+        case ',':
+            lonY_next(L);
+            L->status = LON_STATUS_TOP;
+            lonY_expr(LON_PARSE_ARGS);
+            break;
+        default:
+            lonX_error(L, "<eof> or ',' expected", L->token);
+        }
+    }
+}
+
+
+/* binary data */
+
+LON_PARSE_FUNC void lonB_key(LON_PARSE_PARAMS, int tag) {
+    const lon_Key *k;
+    if (tag == LON_BT_DEFKEY) {
+        size_t len = (size_t)lonB_varint(L);
+        const char *s = lonB_bytes(L, len);
+        if ((k = lon_intern(&L->bkeys, s, len, lon_hash(s, len))) == NULL)
+            longjmp(L->jbuf, LON_ERRMEM);
+    }
+    else if ((k = lon_getkey(&L->bkeys, (unsigned)lonB_varint(L))) == NULL)
+        lonB_error(L, "invalid key reference");
+    if (lonY_haskey(LON_PARSE_ARGS))
+        lonY_key(LON_PARSE_ARGS, k->s, k->len, k->hash);
+    else
+        lonY_string(LON_PARSE_ARGS, k->s, k->len);
+}
+
+LON_PARSE_FUNC void lonB_value(LON_PARSE_PARAMS, int tag);
+
+LON_PARSE_FUNC lon_Integer lonB_array(LON_PARSE_PARAMS, int tag,
+                                      lon_Integer index) {
+    /* run of positional numerals, returns next index */
+    size_t i, n = (size_t)lonB_varint(L);
+    int run = (tag == LON_BT_INTS ? TK_INT : TK_FLT);
+    L->token = run;
+    if (n != 0 && L->levels != 0 && lonY_isrun(LON_PARSE_ARGS)) {
+        lon_resetbuffer(&L->array);
+        for (i = 0; i < n; ++i) {
+            if (run == TK_INT) {
+                lon_Integer v = lonB_integer(L);
+                lon_addlstring(&L->array, (const char*)&v, sizeof(v));
+            }
+            else {
+                lon_Number v = lonB_number(L);
+                lon_addlstring(&L->array, (const char*)&v, sizeof(v));
+            }
+        }
+        lonY_flushrun(LON_PARSE_ARGS, run, index);
+        return index + (lon_Integer)n;
+    }
+    for (i = 0; i < n; ++i) {
+        if (L->levels != 0) {
+            L->status = LON_STATUS_KEY;
+            lonY_index(LON_PARSE_ARGS, index++);
+            L->status = LON_STATUS_VALUE;
+        }
+        lonB_value(LON_PARSE_ARGS,
+                tag == LON_BT_INTS ? LON_BT_INT : LON_BT_FLT);
+    }
+    return index;
+}
+
+LON_PARSE_FUNC void lonB_table(LON_PARSE_PARAMS) {
+    lon_Integer index = 1;
+    int status = L->status;
+    /* binary input is not eyeballed, so always bound the recursion */
+    if (++L->levels > (L->maxlevels != 0 ? L->maxlevels : LON_MAX_LEVEL))
+        lonB_error(L, "too many nested tables");
+    lonY_ontablebegin(LON_PARSE_ARGS);
+    for (;;) {
+        int tag = lonB_byte(L);
+        L->status = LON_STATUS_KEY;
+        switch (tag) {
+        case LON_BT_END:
+            L->status = status;
+            lonY_ontableend(LON_PARSE_ARGS);
+            --L->levels;
+            return;
+        case LON_BT_KEY:
+            lonB_value(LON_PARSE_ARGS, lonB_byte(L));
+            break;
+        case LON_BT_DEFKEY: case LON_BT_REFKEY:
+            lonB_key(LON_PARSE_ARGS, tag);
+            break;
+        case LON_BT_INTS: case LON_BT_FLTS:
+            index = lonB_array(LON_PARSE_ARGS, tag, index);
+            continue;
+        default:
+            lonY_index(LON_PARSE_ARGS, index++);
+            L->status = LON_STATUS_VALUE;
+            lonB_value(LON_PARSE_ARGS, tag);
+            continue;
+        }
+        L->status = LON_STATUS_VALUE;
+        lonB_value(LON_PARSE_ARGS, lonB_byte(L));
+    }
+}
+
+LON_PARSE_FUNC void lonB_value(LON_PARSE_PARAMS, int tag) {
+    switch (tag) {
+    case LON_BT_NIL:   L->token = TK_NIL; break;
+    case LON_BT_FALSE: L->token = TK_FALSE; break;
+    case LON_BT_TRUE:  L->token = TK_TRUE; break;
+    case LON_BT_INT:
+        L->token = TK_INT;
+        L->iv = lonB_integer(L);
+        if (lonX_rawnumber(L)) lonB_numeral(L);
+        break;
+    case LON_BT_FLT:
+        L->token = TK_FLT;
+        L->nv = lonB_number(L);
+        if (lonX_rawnumber(L)) lonB_numeral(L);
+        break;
+    case LON_BT_STRING:
+        {
+            size_t len = (size_t)lonB_varint(L);
+            lonY_string(LON_PARSE_ARGS, lonB_bytes(L, len), len);
+            return;
+        }
+    case LON_BT_TABLE:
+        lonB_table(LON_PARSE_ARGS);
+        return;
+    default:
+        lonB_error(L, "invalid binary tag");
+    }
+    lonY_scalar(LON_PARSE_ARGS);
+}
+
+LON_PARSE_FUNC void lonB_parser(LON_PARSE_PARAMS) {
+    const char *magic = lonB_bytes(L, sizeof(LON_BINARY_MAGIC)-1);
+    if (memcmp(magic, LON_BINARY_MAGIC, sizeof(LON_BINARY_MAGIC)-1) != 0)
+        lonB_error(L, "not a binary chunk");
+    if (lonB_byte(L) != LON_BINARY_VERSION)
+        lonB_error(L, "binary version mismatch");
+    while (L->current != LON_EOZ) {
+        int tag = lonB_byte(L);
+        L->status = LON_STATUS_TOP;
+        if (tag == LON_BT_INTS || tag == LON_BT_FLTS)
+            lonB_array(LON_PARSE_ARGS, tag, 1);
+        else
+            lonB_value(LON_PARSE_ARGS, tag);
+    }
+}
+
+
+/* lon JSON loader */
+
+LON_PARSE_FUNC void lonJ_value(LON_PARSE_PARAMS);
+
+LON_PARSE_FUNC void lonJ_table(LON_PARSE_PARAMS) {
+    /* object -> '{' [ string ':' value { ',' string ':' value } ] '}'
+       array -> '[' [ value { ',' value } ] ']' */
+    int open = L->token, close = (open == '{' ? '}' : ']');
+    int line = L->line;
+    int status = L->status;
+    int run = 0;             /* pending numeral run, and its first index */
+    lon_Integer first = 0;
+    lon_Integer index = 1;
+    lonY_next(L);
+    if (++L->levels > L->maxlevels && L->maxlevels != 0)
+        lonX_error(L, "too many nested tables", 0);
+    lonY_ontablebegin(LON_PARSE_ARGS);
+    if (L->token != close) do {
+        L->status = LON_STATUS_KEY;
+        if (open == '{') {
+            const char *s;
+            size_t len;
+            if (L->token != TK_STRING)
+                lonX_error(L, "string key expected", L->token);
+            s = lon_buffer(&L->buffer) + 1;
+            len = lon_buffsize(&L->buffer) - 2;
+            if (lonY_haskey(LON_PARSE_ARGS))
+                lonY_key(LON_PARSE_ARGS, s, len, lon_hash(s, len));
+            else
+                lonY_string(LON_PARSE_ARGS, s, len);
+            lonY_next(L);
+            lonY_checknext(L, ':');
+        }
+        else if (lonY_isrun(LON_PARSE_ARGS)) {
+            /* arrays map to positional fields */
+            if (run != L->token) {
+                lonY_flushrun(LON_PARSE_ARGS, run, first);
+                run = L->token;
+                first = index;
+            }
+            if (run == TK_INT)
+                lon_addlstring(&L->array, (const char*)&L->iv, sizeof(L->iv));
+            else
+                lon_addlstring(&L->array, (const char*)&L->nv, sizeof(L->nv));
+            ++index;
+            lonY_next(L);
+            continue;
+        }
+        else {
+            lonY_flushrun(LON_PARSE_ARGS, run, first);
+            run = 0;
+            lonY_index(LON_PARSE_ARGS, index++);
+        }
+        L->status = LON_STATUS_VALUE;
+        lonJ_value(LON_PARSE_ARGS);
+    } while (lonY_testnext(L, ','));
+    lonY_flushrun(LON_PARSE_ARGS, run, first);
+    lonY_closetable(L, close, open, line);
+    L->status = status;
+    lonY_ontableend(LON_PARSE_ARGS);
+    --L->levels;
+}
+
+LON_PARSE_FUNC void lonJ_value(LON_PARSE_PARAMS) {
+    /* value -> object | array | string | number | true | false | null */
+    switch (L->token) {
+    case '{': case '[':
+        lonJ_table(LON_PARSE_ARGS);
+        return;
+    case TK_STRING:  /* escapes are JSON's, never pass the literal */
+        lonY_string(LON_PARSE_ARGS, lon_buffer(&L->buffer) + 1,
+                lon_buffsize(&L->buffer) - 2);
+        break;
+    default:
+        if (!lonY_scalar(LON_PARSE_ARGS))
+            lonX_error(L, "unexpected symbol", L->token);
+    }
+    lonY_endvalue(L);
+}
+
+LON_PARSE_FUNC void lonY_once(LON_PARSE_PARAMS) {
+    /* once -> [ 'return' | ',' ] value, the next value of a list loaded
+       by lon_load_next(); JSON texts are just whitespace separated */
+    int sep = 0;
+    lonY_next(L);
+    if (!L->json && (L->token == TK_RETURN || L->token == ','))
+        sep = L->token, lonY_next(L);
+    if (L->token == TK_EOS) {
+        if (sep == ',')
+            lonX_error(L, "unexpected symbol", L->token);
+        return;
+    }
+    L->status = LON_STATUS_TOP;
+    if (L->json)
+        lonJ_value(LON_PARSE_ARGS);
+    else
+        lonY_expr(LON_PARSE_ARGS);
+}
+
+LON_PARSE_FUNC void lonJ_parser(LON_PARSE_PARAMS) {
+    /* whitespace separated texts, as values of a 'return' list */
+    lonY_next(L);
+    while (L->token != TK_EOS) {
+        L->status = LON_STATUS_TOP;
+        lonJ_value(LON_PARSE_ARGS);
+    }
+}
+
+
+LON_PARSE_FUNC void lon_parser(LON_PARSE_PARAMS) {
+    L->levels = 0;
+    L->status = LON_STATUS_TOP;
+    lonY_onbegin(LON_PARSE_ARGS);
+    if (L->field)
+        lonY_onefield(LON_PARSE_ARGS);
+    else if (L->once)
+        lonY_once(LON_PARSE_ARGS);
+    else if (L->json)
+        lonJ_parser(LON_PARSE_ARGS);
+    else if (L->current == LON_BINARY_MAGIC[0])
+        lonB_parser(LON_PARSE_ARGS);
+    else switch (lonY_next(L)) {
+    case TK_EOS:
+        lonY_flush(LON_PARSE_ARGS);
+        return;
+    case '{': lonY_table(LON_PARSE_ARGS); break;
+    case TK_RETURN:
+        lonY_next(L);
+        /* FALLTHROUGH */
+    default:
+        lonY_expr_list(LON_PARSE_ARGS);
+        break;
+    }
+    L->status = LON_STATUS_TOP;
+    lonY_onend(LON_PARSE_ARGS);
+}
+
+#endif /* LON_PARSER_BODY */
 /* cc: flags+='-s -O3 -mdll -DLON_IMPLEMENTATION'
  * cc: flags+='-DLON_API="__declspec(dllexport)" -xc'
  * cc: output='lon.dll' */
@@ -0,0 +1,256 @@
+/* lon: C++ interface with statically dispatched handlers
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_hpp
+#define lon_hpp
+
+/* unless lon.h's implementation is already included, it is compiled
+ * static into every translation unit that includes this header */
+#ifndef lon_implemented
+# define LON_STATIC_API
+#endif
+#include "lon.h"
+
+#include <string_view>
+#include <type_traits>
+
+
+namespace lon {
+
+/* default (empty) events, derive from it: struct H : lon::Handler<H> */
+
+template <class Derived>
+struct Handler {
+    void on_error(std::string_view) {}
+
+    void on_begin() {}
+    void on_end()   {}
+
+    void on_nil()                 {}
+    void on_boolean(bool)         {}
+    void on_integer(lon_Integer)  {}
+    void on_number(lon_Number)    {}
+    void on_string(std::string_view) {}
+
+    void on_table_begin() {}
+    void on_table_end()   {}
+
+    /* string keys, 'hash' is lon_hash(s) */
+    void on_key(std::string_view s, unsigned)
+    { static_cast<Derived*>(this)->on_string(s); }
+
+    /* optional, called only when Derived declares them:
+     *   on_integer_array(lon_Integer index, const lon_Integer *v, size_t n)
+     *   on_number_array(lon_Integer index, const lon_Number *v, size_t n)
+     *   on_raw_number(std::string_view s, bool is_int)
+     *   on_raw_string(std::string_view s)
+     *   on_interned_key(const lon_Key *key)
+     *   on_index(lon_Integer index) */
+};
+
+/* the grammar of lon.h is instantiated on each handler type, so events
+ * are direct calls of its members; each optional event is sent only when
+ * the handler declares it, as a non-NULL callback would be in C (so
+ * grammar and events are the same) */
+
+namespace detail {
+
+#define LON_HAS_EVENT(name)                                                \
+    template <class H, class = void>                                        \
+    struct has_##name : std::false_type {};                                 \
+    template <class H>                                                      \
+    struct has_##name<H, std::void_t<decltype(&H::name)>>                   \
+        : std::true_type {};
+
+LON_HAS_EVENT(on_integer_array)
+LON_HAS_EVENT(on_number_array)
+LON_HAS_EVENT(on_raw_number)
+LON_HAS_EVENT(on_raw_string)
+LON_HAS_EVENT(on_interned_key)
+LON_HAS_EVENT(on_index)
+#undef LON_HAS_EVENT
+
+/* parser events, the lonY_on*() functions of lon.h on a handler */
+
+template <class H> void lonY_onbegin(lon_Loader *, H &h) { h.on_begin(); }
+template <class H> void lonY_onend(lon_Loader *, H &h)   { h.on_end(); }
+template <class H> void lonY_flush(lon_Loader *, H &)    {}
+
+template <class H> void lonY_onnil(lon_Loader *, H &h) { h.on_nil(); }
+
+template <class H> void lonY_onboolean(lon_Loader *, H &h, int b)
+{ h.on_boolean(b != 0); }
+
+template <class H> void lonY_oninteger(lon_Loader *, H &h, lon_Integer i)
+{ h.on_integer(i); }
+
+template <class H> void lonY_onnumber(lon_Loader *, H &h, lon_Number n)
+{ h.on_number(n); }
+
+template <class H> void lonY_ontablebegin(lon_Loader *, H &h)
+{ h.on_table_begin(); }
+
+template <class H> void lonY_ontableend(lon_Loader *, H &h)
+{ h.on_table_end(); }
+
+template <class H> int lonY_haskey(lon_Loader *, H &) { return 1; }
+
+template <class H>
+void lonY_string(lon_Loader *, H &h, const char *s, size_t len)
+{ h.on_string(std::string_view(s, len)); }
+
+template <class H>
+void lonY_index(lon_Loader *, H &h, lon_Integer index) {
+    if constexpr (has_on_index<H>::value)
+        h.on_index(index);
+    else
+        h.on_integer(index);
+}
+
+template <class H>
+void lonY_key(lon_Loader *L, H &h, const char *s, size_t len,
+              unsigned hash) {
+    if constexpr (has_on_interned_key<H>::value) {
+        if (L->intern) {
+            const lon_Key *k = lon_intern(L->intern, s, len, hash);
+            if (k == NULL) longjmp(L->jbuf, LON_ERRMEM);
+            h.on_interned_key(k);
+            return;
+        }
+    }
+    h.on_key(std::string_view(s, len), hash);
+}
+
+template <class H>
+void lonY_rawnumber(lon_Loader *L, H &h) {
+    if constexpr (has_on_raw_number<H>::value)
+        h.on_raw_number(std::string_view(lon_buffer(&L->buffer),
+                    lon_buffsize(&L->buffer)), L->token == TK_INT);
+}
+
+template <class H>
+void lonY_rawstring(lon_Loader *L, H &h) {
+    if constexpr (has_on_raw_string<H>::value)
+        h.on_raw_string(std::string_view(lon_buffer(&L->buffer),
+                    lon_buffsize(&L->buffer)));
+}
+
+template <class H>
+void lonY_onintegerarray(lon_Loader *, H &h, lon_Integer first,
+                         const lon_Integer *v, size_t n) {
+    if constexpr (has_on_integer_array<H>::value)
+        h.on_integer_array(first, v, n);
+}
+
+template <class H>
+void lonY_onnumberarray(lon_Loader *, H &h, lon_Integer first,
+                        const lon_Number *v, size_t n) {
+    if constexpr (has_on_number_array<H>::value)
+        h.on_number_array(first, v, n);
+}
+
+template <class H>
+int lonY_isrun(lon_Loader *L, H &) {
+    if (has_on_raw_number<H>::value || lonY_indexing(L)) return 0;
+    switch (L->token) {
+    case TK_INT: return has_on_integer_array<H>::value;
+    case TK_FLT: return has_on_number_array<H>::value;
+    }
+    return 0;
+}
+
+#define LON_PARSE_FUNC   template <class H>
+#define LON_PARSE_PARAMS lon_Loader *L, H &h
+#define LON_PARSE_ARGS   L, h
+#define LON_PARSER_BODY
+#include "lon.h"
+#undef LON_PARSER_BODY
+#undef LON_PARSE_FUNC
+#undef LON_PARSE_PARAMS
+#undef LON_PARSE_ARGS
+
+} /* namespace detail */
+
+
+/* loader routines */
+
+template <class H>
+int load(lon_Loader *L, H &h, lon_Reader *reader, void *ud) {
+    /* the loader may longjmp() out of events on error, so handlers
+     * should not throw nor hold objects with destructors across them;
+     * callbacks, tape and panic function of 'L' are not used (nor
+     * changed) by this load */
+    lon_Callbacks *cb = L->cb;
+    lon_Tape *tape = L->tape;
+    lon_Panic *panicf = L->panicf;
+    int res;
+    L->cb = NULL, L->tape = NULL, L->panicf = NULL;
+    lonL_reset(L, reader, ud);
+    L->rawnumber = detail::has_on_raw_number<H>::value;
+    L->rawstring = detail::has_on_raw_string<H>::value && L->index == NULL;
+    if ((res = setjmp(L->jbuf)) == 0) {
+        lonX_next(L);
+        detail::lon_parser(L, h);
+    }
+    else if (res == LON_ERRMEM) {
+        char buff[80];
+        h.on_error(lonL_memerror(L, buff, sizeof(buff)));
+    }
+    else if (lon_buffsize(&L->errmsg) != 0) /* not from lon_break() */
+        h.on_error(std::string_view(lon_buffer(&L->errmsg),
+                    lon_buffsize(&L->errmsg)));
+    L->cb = cb, L->tape = tape, L->panicf = panicf;
+    lonL_cleanup(L);
+    return res;
+}
+
+template <class H>
+int load_buffer(lon_Loader *L, H &h, std::string_view s) {
+    lon_StringCtx ctx = { s.size(), 0, s.data() };
+    L->name = "[=buffer]";
+    return lon::load(L, h, lonL_stringreader, &ctx);
+}
+
+template <class H>
+int load_file(lon_Loader *L, H &h, const char *filename) {
+    lon_FileCtx ctx = { 0 };
+    int res;
+    ctx.fp = fopen(filename, "rb");
+    if (ctx.fp == NULL) return LON_ERRFILE;
+    L->name = filename;
+    res = lon::load(L, h, lonL_filereader, &ctx);
+    fclose(ctx.fp);
+    return res;
+}
+
+class Loader {
+public:
+    Loader() { lon_initloader(&L); }
+    ~Loader() { lon_freeloader(&L); }
+    Loader(const Loader&) = delete;
+    Loader &operator=(const Loader&) = delete;
+
+    lon_Loader *get() { return &L; }
+
+    template <class H>
+    int load(H &h, lon_Reader *reader, void *ud)
+    { return lon::load(&L, h, reader, ud); }
+
+    template <class H>
+    int load_buffer(H &h, std::string_view s)
+    { return lon::load_buffer(&L, h, s); }
+
+    template <class H>
+    int load_file(H &h, const char *filename)
+    { return lon::load_file(&L, h, filename); }
+
+    int setloadopt(int opt, int value)
+    { return lon_setloadopt(&L, opt, value); }
+
+private:
+    lon_Loader L;
+};
+
+} /* namespace lon */
+
+#endif /* lon_hpp */
@@ -0,0 +1,483 @@
+/* lon_diff: structural diff and patch of lon documents
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_diff_h
+#define lon_diff_h
+
+
+#include "lon_dom.h"
+
+LON_NS_BEGIN
+
+#define LON_PATCH_SET "set"
+#define LON_PATCH_DEL "del"
+
+/* dump a patch turning 'a' (a value of 'da') into 'b' (of 'db'), returns
+ * number of operations; identical subtables of a LON_DOM_DEDUP dom are
+ * skipped without being walked */
+LON_API int lon_diff (lon_Dumper *D, lon_Dom *da, const lon_Value *a,
+                      lon_Dom *db, const lon_Value *b);
+
+/* like lon_load(), but the document is 'doc' with 'patch' applied, both
+ * values of 'd'; events go to callbacks or dumper of L, so the result
+ * may be loaded into a dom or dumped again. Loaded into 'd' itself, the
+ * untouched subtables are shared rather than copied */
+LON_API int lon_patch (lon_Loader *L, lon_Dom *d, const lon_Value *doc,
+                       const lon_Value *patch);
+
+
+/* patch documents are a table of operations, applied in order:
+ *
+ *   return {
+ *      { "set", { "server", "ports", 2 }, 8080 },
+ *      { "del", { "server", "debug" } },
+ *   }
+ *
+ * a path is a list of keys from the document root, an empty path is the
+ * document itself; "set" without a value sets nil. Paths through table
+ * keys can not be expressed, the diff sets their parent table whole */
+
+
+LON_NS_END
+
+#endif /* lon_diff_h */
+
+
+#if defined(LON_IMPLEMENTATION) && !defined(lon_diff_implemented)
+#define lon_diff_implemented
+
+
+#include <stdlib.h>
+#include <string.h>
+
+
+LON_NS_BEGIN
+
+
+#define lonP_count(t) ((t)->narray + (t)->nfields)
+
+static const lon_Value *lonP_entry(const lon_Table *t, size_t i,
+                                   lon_Value *key) {
+    /* i-th entry of t, positional values first */
+    if (i < t->narray) {
+        key->type = LON_DT_INTEGER, key->u.i = (lon_Integer)i + 1;
+        return &t->array[i];
+    }
+    *key = t->fields[i - t->narray].key;
+    return &t->fields[i - t->narray].value;
+}
+
+static int lonP_shadowed(lon_Dom *d, const lon_Table *t, size_t i,
+                         const lon_Value *key, const lon_Value *v) {
+    /* a field hidden by a later one of same key */
+    return i >= t->narray && lon_dom_get(d, (lon_Table*)t, key) != v;
+}
+
+
+/* diff */
+
+typedef struct lonP_Diff {
+    lon_Dumper *D;
+    lon_Dom *da, *db;
+    int ops;
+    int depth;
+    lon_Value path[LON_MAX_LEVEL];
+} lonP_Diff;
+
+static void lonP_dumpvalue(lon_Dumper *D, const lon_Value *v) {
+    const lon_Table *t;
+    lon_Value key;
+    size_t i, len;
+    switch (v->type) {
+    case LON_DT_NIL:     lon_dump_nil(D); break;
+    case LON_DT_BOOLEAN: lon_dump_boolean(D, v->u.b); break;
+    case LON_DT_INTEGER: lon_dump_integer(D, v->u.i); break;
+    case LON_DT_NUMBER:  lon_dump_number(D, v->u.n); break;
+    case LON_DT_STRING: case LON_DT_KEY: {
+        const char *s = lon_dom_tostring(v, &len);
+        lon_dump_buffer(D, s, len);
+        break;
+    }
+    case LON_DT_TABLE:
+        t = v->u.t;
+        lon_dump_table_begin(D);
+        for (i = 0; i < lonP_count(t); ++i) {
+            const lon_Value *e = lonP_entry(t, i, &key);
+            lonP_dumpvalue(D, &key);
+            lonP_dumpvalue(D, e);
+        }
+        lon_dump_table_end(D);
+        break;
+    }
+}
+
+static void lonP_op(lonP_Diff *P, const char *op, const lon_Value *v) {
+    int i;
+    lon_dump_integer(P->D, ++P->ops);
+    lon_dump_table_begin(P->D);
+    lon_dump_integer(P->D, 1);
+    lon_dump_string(P->D, op);
+    lon_dump_integer(P->D, 2);
+    lon_dump_table_begin(P->D);
+    for (i = 0; i < P->depth; ++i) {
+        lon_dump_integer(P->D, i + 1);
+        lonP_dumpvalue(P->D, &P->path[i]);
+    }
+    lon_dump_table_end(P->D);
+    if (v != NULL) {
+        lon_dump_integer(P->D, 3);
+        lonP_dumpvalue(P->D, v);
+    }
+    lon_dump_table_end(P->D);
+}
+
+static int lonP_tablekeys(const lon_Table *t) {
+    size_t i;
+    for (i = 0; i < t->nfields; ++i)
+        if (t->fields[i].key.type == LON_DT_TABLE) return 1;
+    return 0;
+}
+
+static int lonP_same(const lon_Value *a, const lon_Value *b) {
+    size_t alen = 0, blen = 0;
+    const char *as = lon_dom_tostring(a, &alen);
+    const char *bs = lon_dom_tostring(b, &blen);
+    if (as == NULL || bs == NULL) return lonO_equal(a, b);
+    return alen == blen && (as == bs || memcmp(as, bs, alen) == 0);
+}
+
+static void lonP_diff(lonP_Diff *P, const lon_Value *a, const lon_Value *b) {
+    const lon_Table *ta, *tb;
+    const lon_Value *v, *o;
+    lon_Value key;
+    size_t i;
+    if (a->type != LON_DT_TABLE || b->type != LON_DT_TABLE) {
+        if (!lonP_same(a, b)) lonP_op(P, LON_PATCH_SET, b);
+        return;
+    }
+    if ((ta = a->u.t) == (tb = b->u.t)) return;
+    if (P->depth >= LON_MAX_LEVEL || lonP_tablekeys(ta)
+            || lonP_tablekeys(tb)) {
+        lonP_op(P, LON_PATCH_SET, b);
+        return;
+    }
+    for (i = 0; i < lonP_count(tb); ++i) {
+        v = lonP_entry(tb, i, &key);
+        if (lonP_shadowed(P->db, tb, i, &key, v)) continue;
+        P->path[P->depth++] = key;
+        if ((o = lon_dom_get(P->da, (lon_Table*)ta, &key)) == NULL)
+            lonP_op(P, LON_PATCH_SET, v);
+        else
+            lonP_diff(P, o, v);
+        --P->depth;
+    }
+    for (i = 0; i < lonP_count(ta); ++i) {
+        v = lonP_entry(ta, i, &key);
+        if (lonP_shadowed(P->da, ta, i, &key, v)
+                || lon_dom_get(P->db, (lon_Table*)tb, &key) != NULL)
+            continue;
+        P->path[P->depth++] = key;
+        lonP_op(P, LON_PATCH_DEL, NULL);
+        --P->depth;
+    }
+}
+
+
+/* patch */
+
+typedef struct lonP_Op {
+    int set;
+    const lon_Table *path;
+    const lon_Value *value;  /* NULL if removed */
+} lonP_Op;
+
+typedef struct lonP_Patch {
+    lon_Callbacks cb;        /* dumper callbacks, installed for the call */
+    lon_Loader *L;
+    lon_Dom *d;
+    lonP_Op *ops;
+    size_t *scratch;         /* merge sort of op indices */
+} lonP_Patch;
+
+static const lon_Value lonP_nil = { LON_DT_NIL };
+
+#define lonP_key(P,k,depth) (&(P)->ops[k].path->array[depth])
+#define lonP_len(P,k)       ((P)->ops[k].path->narray)
+
+static void lonP_error(lon_Loader *L, size_t op, const char *msg) {
+    lon_addfstring(&L->errmsg, "%s: operation %d: %s", L->name,
+            (int)op + 1, msg);
+    lonX_error(L, NULL, 0);
+}
+
+static int lonP_cmp(const lon_Value *a, const lon_Value *b) {
+    /* order keys by type, then value; interned and plain strings mix */
+    int ta = a->type == LON_DT_KEY ? LON_DT_STRING : a->type;
+    int tb = b->type == LON_DT_KEY ? LON_DT_STRING : b->type;
+    if (ta != tb) return ta < tb ? -1 : 1;
+    switch (ta) {
+    case LON_DT_BOOLEAN: return a->u.b - b->u.b;
+    case LON_DT_INTEGER:
+        return a->u.i < b->u.i ? -1 : a->u.i > b->u.i;
+    case LON_DT_NUMBER:
+        return a->u.n < b->u.n ? -1 : a->u.n > b->u.n;
+    case LON_DT_STRING: {
+        size_t alen = 0, blen = 0;
+        const char *as = lon_dom_tostring(a, &alen);
+        const char *bs = lon_dom_tostring(b, &blen);
+        int r = memcmp(as, bs, alen < blen ? alen : blen);
+        return r != 0 ? r : alen < blen ? -1 : alen > blen;
+    }
+    }
+    return 0;
+}
+
+static void lonP_sort(lonP_Patch *P, size_t *ops, size_t n, int depth) {
+    /* stable, so operations on one key keep their order */
+    size_t *tmp = P->scratch, i, j, k, mid = n / 2;
+    if (n < 2) return;
+    lonP_sort(P, ops, mid, depth);
+    lonP_sort(P, ops + mid, n - mid, depth);
+    for (i = 0, j = mid, k = 0; i < mid && j < n; )
+        tmp[k++] = lonP_cmp(lonP_key(P, ops[j], depth),
+                lonP_key(P, ops[i], depth)) < 0 ? ops[j++] : ops[i++];
+    while (i < mid) tmp[k++] = ops[i++];
+    while (j < n) tmp[k++] = ops[j++];
+    memcpy(ops, tmp, n * sizeof(size_t));
+}
+
+static size_t lonP_find(lonP_Patch *P, const size_t *ops, size_t n,
+                        int depth, const lon_Value *key, size_t *pcount) {
+    /* operations of key in sorted ops, returns n if none */
+    size_t lo = 0, hi = n, end;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if (lonP_cmp(lonP_key(P, ops[mid], depth), key) < 0)
+            lo = mid + 1;
+        else hi = mid;
+    }
+    for (end = lo; end < n; ++end)
+        if (lonP_cmp(lonP_key(P, ops[end], depth), key) != 0) break;
+    *pcount = end - lo;
+    return end == lo ? n : lo;
+}
+
+static void lonP_table(lonP_Patch *P, const lon_Table *t, size_t *ops,
+                       size_t n, int depth);
+
+static void lonP_value(lonP_Patch *P, const lon_Value *v, int iskey) {
+    lon_Loader *L = P->L;
+    lon_Callbacks *cb = L->cb;
+    L->status = iskey ? LON_STATUS_KEY : LON_STATUS_VALUE;
+    switch (v->type) {
+    case LON_DT_NIL:
+        if (cb->on_nil) cb->on_nil(cb);
+        break;
+    case LON_DT_BOOLEAN:
+        if (cb->on_boolean) cb->on_boolean(cb, v->u.b);
+        break;
+    case LON_DT_INTEGER:
+        if (cb->on_integer) cb->on_integer(cb, v->u.i);
+        break;
+    case LON_DT_NUMBER:
+        if (cb->on_number) cb->on_number(cb, v->u.n);
+        break;
+    case LON_DT_STRING: case LON_DT_KEY: {
+        size_t len;
+        const char *s = lon_dom_tostring(v, &len);
+        if (iskey && lonY_haskey(L))
+            lonY_key(L, s, len, v->type == LON_DT_KEY ? v->u.key->hash
+                    : lon_hash(s, len));
+        else if (cb->on_string)
+            cb->on_string(cb, s, len);
+        break;
+    }
+    case LON_DT_TABLE:
+        if (cb == &P->d->cb)  /* loading into 'd', share the subtable */
+            lonO_push(P->d, v);
+        else
+            lonP_table(P, v->u.t, NULL, 0, 0);
+        break;
+    }
+}
+
+static const lon_Value *lonP_resolve(lonP_Patch *P, const lon_Value *v,
+                                     size_t **pops, size_t *pn, int depth) {
+    /* value after the last operation replacing the whole value, leaves
+     * operations inside it after that one in *pops */
+    size_t i, *ops = *pops, n = *pn;
+    for (i = n; i > 0; --i)
+        if (lonP_len(P, ops[i-1]) == (size_t)depth) {
+            const lonP_Op *op = &P->ops[ops[i-1]];
+            v = !op->set ? NULL : op->value ? op->value : &lonP_nil;
+            break;
+        }
+    *pops = ops + i, *pn = n - i;
+    if (*pn != 0 && v != NULL && v->type != LON_DT_TABLE)
+        lonP_error(P->L, (*pops)[0], "path is not a table");
+    return v;
+}
+
+static void lonP_field(lonP_Patch *P, const lon_Value *key,
+                       const lon_Value *v, size_t *ops, size_t n,
+                       int depth) {
+    /* emit field 'key', with its operations at 'depth' applied */
+    size_t i;
+    if (n != 0) v = lonP_resolve(P, v, &ops, &n, depth + 1);
+    for (i = 0; v == NULL && i < n; ++i)
+        if (P->ops[ops[i]].set) break;
+    if (v == NULL && i == n) return;  /* nothing set under missing key */
+    lonP_value(P, key, 1);
+    if (n == 0)
+        lonP_value(P, v, 0);
+    else {
+        P->L->status = LON_STATUS_VALUE;
+        lonP_table(P, v ? v->u.t : NULL, ops, n, depth + 1);
+    }
+}
+
+static void lonP_table(lonP_Patch *P, const lon_Table *t, size_t *ops,
+                       size_t n, int depth) {
+    lon_Loader *L = P->L;
+    lon_Callbacks *cb = L->cb;
+    size_t i, count, lo, narray = t ? t->narray : 0;
+    int status = L->status;
+    lon_Value key;
+    if (L->levels >= LON_MAX_LEVEL-1)
+        lonP_error(L, n ? ops[0] : 0, "table too deep");
+    lonP_sort(P, ops, n, depth);
+    ++L->levels;
+    if (cb->on_table_begin) cb->on_table_begin(cb);
+    for (i = 0; i < (t ? lonP_count(t) : 0); ++i) {
+        const lon_Value *v = lonP_entry(t, i, &key);
+        lo = n ? lonP_find(P, ops, n, depth, &key, &count) : n;
+        if (lonP_shadowed(P->d, t, i, &key, v))
+            ;  /* keep only the value lookups see */
+        else if (lo == n) {
+            lonP_value(P, &key, 1);
+            lonP_value(P, v, 0);
+        }
+        else
+            lonP_field(P, &key, v, ops + lo, count, depth);
+        if (i + 1 != narray) continue;
+        /* new positional values extend the array part */
+        key.type = LON_DT_INTEGER;
+        for (key.u.i = (lon_Integer)narray + 1;
+                (lo = lonP_find(P, ops, n, depth, &key, &count)) != n
+                && lon_dom_get(P->d, (lon_Table*)t, &key) == NULL;
+                ++key.u.i, ++narray)
+            lonP_field(P, &key, NULL, ops + lo, count, depth);
+    }
+    for (i = 0; i < n; i += count) {  /* new keys */
+        const lon_Value *k = lonP_key(P, ops[i], depth);
+        lonP_find(P, ops + i, n - i, depth, k, &count);
+        if (k->type == LON_DT_INTEGER && k->u.i <= (lon_Integer)narray
+                && k->u.i > (lon_Integer)(t ? t->narray : 0))
+            continue;  /* extended array part */
+        if (t != NULL && lon_dom_get(P->d, (lon_Table*)t, k) != NULL)
+            continue;
+        lonP_field(P, k, NULL, ops + i, count, depth);
+    }
+    L->status = status;
+    if (cb->on_table_end) cb->on_table_end(cb);
+    --L->levels;
+}
+
+static size_t lonP_parse(lonP_Patch *P, const lon_Value *patch,
+                         lon_Buffer *B) {
+    /* check operations of patch into B, returns their count */
+    lon_Loader *L = P->L;
+    const lon_Table *t;
+    size_t i, j;
+    if (patch->type != LON_DT_TABLE)
+        lonX_error(L, "patch is not a table", 0);
+    t = patch->u.t;
+    for (i = 0; i < t->narray; ++i) {
+        const lon_Table *o = t->array[i].type == LON_DT_TABLE ?
+            t->array[i].u.t : NULL;
+        const char *s;
+        size_t len;
+        lonP_Op op;
+        if (o == NULL || o->narray < 2 || o->nfields != 0
+                || (s = lon_dom_tostring(&o->array[0], &len)) == NULL
+                || len != 3 || (memcmp(s, LON_PATCH_SET, 3) != 0
+                    && memcmp(s, LON_PATCH_DEL, 3) != 0))
+            lonP_error(L, i, "bad operation");
+        op.set = memcmp(s, LON_PATCH_SET, 3) == 0;
+        if (o->array[1].type != LON_DT_TABLE
+                || (op.path = o->array[1].u.t)->nfields != 0)
+            lonP_error(L, i, "path is not a list of keys");
+        for (j = 0; j < op.path->narray; ++j) {
+            int type = op.path->array[j].type;
+            if (type == LON_DT_NIL || type == LON_DT_TABLE
+                    || (type == LON_DT_NUMBER
+                        && op.path->array[j].u.n != op.path->array[j].u.n))
+                lonP_error(L, i, "bad key in path");
+        }
+        op.value = o->narray > 2 ? &o->array[2] : NULL;
+        lon_addlstring(B, (const char*)&op, sizeof(op));
+    }
+    return t->narray;
+}
+
+LON_API int lon_diff(lon_Dumper *D, lon_Dom *da, const lon_Value *a,
+                     lon_Dom *db, const lon_Value *b) {
+    lonP_Diff P;
+    P.D = D, P.da = da, P.db = db;
+    P.ops = 0, P.depth = 0;
+    lon_dump_begin(D);
+    lon_dump_table_begin(D);
+    lonP_diff(&P, a, b);
+    lon_dump_table_end(D);
+    lon_dump_end(D);
+    return P.ops;
+}
+
+LON_API int lon_patch(lon_Loader *L, lon_Dom *d, const lon_Value *doc,
+                      const lon_Value *patch) {
+    lon_Callbacks *prev = L->cb;
+    lon_Buffer ops, order;
+    lonP_Patch P;
+    int res;
+    if (L->cb == NULL && L->dumper == NULL) return LON_ERR;
+    memset(&P.cb, 0, sizeof(P.cb));
+    lonL_initdumpcb(L, &P.cb);
+    L->cb->loader = L;
+    lonL_reset(L, NULL, NULL);
+    L->name = "[=patch]";
+    L->levels = 0;
+    P.L = L, P.d = d;
+    lon_initbuffer(&ops, &L->jbuf);
+    lon_initbuffer(&order, &L->jbuf);
+    if ((res = setjmp(L->jbuf)) == 0) {
+        size_t i, n = lonP_parse(&P, patch, &ops), *idx;
+        P.ops = (lonP_Op*)lon_buffer(&ops);
+        idx = (size_t*)lon_prepbuffsize(&order, n * 2 * sizeof(size_t));
+        P.scratch = idx + n;
+        for (i = 0; i < n; ++i) idx[i] = i;
+        L->status = LON_STATUS_TOP;
+        if (L->cb->on_begin) L->cb->on_begin(L->cb);
+        if ((doc = lonP_resolve(&P, doc, &idx, &n, 0)) != NULL) {
+            if (n == 0)
+                lonP_value(&P, doc, 0);
+            else
+                lonP_table(&P, doc->u.t, idx, n, 0);
+        }
+        else if (n != 0)
+            lonP_table(&P, NULL, idx, n, 0);
+        L->status = LON_STATUS_TOP;
+        if (L->cb->on_end) L->cb->on_end(L->cb);
+    }
+    else if (res == LON_ERRMEM)
+        lonL_outofmem(L);
+    lon_freebuffer(&ops);
+    lon_freebuffer(&order);
+    lon_break(L, LON_OK);
+    L->cb = prev;
+    return res;
+}
+
+
+LON_NS_END
+
+#endif /* LON_IMPLEMENTATION */
@@ -0,0 +1,599 @@
+/* lon_dom: build an in-memory tree from lon data
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_dom_h
+#define lon_dom_h
+
+
+#include "lon.h"
+
+LON_NS_BEGIN
+
+#define LON_DOMARENA 16384 /* size of arena chunk */
+
+#define LON_DOM_DEDUP 0x01 /* share identical subtables */
+
+#define LON_DOM_MININDEX 8 /* smaller tables are scanned linearly */
+
+#define LON_DT_NIL     0
+#define LON_DT_BOOLEAN 1
+#define LON_DT_INTEGER 2
+#define LON_DT_NUMBER  3
+#define LON_DT_STRING  4
+#define LON_DT_KEY     5  /* interned string key */
+#define LON_DT_TABLE   6
+
+typedef struct lon_Value lon_Value;
+typedef struct lon_Entry lon_Entry;
+typedef struct lon_Table lon_Table;
+typedef struct lon_Dom   lon_Dom;
+typedef struct lon_DomStats lon_DomStats;
+
+LON_API void lon_initdom (lon_Dom *d, int flags);
+LON_API void lon_freedom (lon_Dom *d);
+
+LON_API const lon_Value *lon_dom_values (lon_Dom *d, size_t *pn);
+LON_API const char *lon_dom_error (lon_Dom *d);
+LON_API void lon_dom_stats (lon_Dom *d, lon_DomStats *st);
+
+LON_API const char *lon_dom_tostring (const lon_Value *v, size_t *plen);
+
+LON_API int lon_dom_index (lon_Dom *d, lon_Table *t);
+
+LON_API const lon_Value *lon_dom_get      (lon_Dom *d, lon_Table *t,
+                                           const lon_Value *key);
+LON_API const lon_Value *lon_dom_getfield (lon_Dom *d, lon_Table *t,
+                                           const char *s, size_t len);
+LON_API const lon_Value *lon_dom_getindex (lon_Dom *d, lon_Table *t,
+                                           lon_Integer i);
+
+
+/* structs */
+
+struct lon_Value {
+    int type;                 /* LON_DT_* */
+    union {
+        int b;
+        lon_Integer i;
+        lon_Number n;
+        struct { const char *s; size_t len; } str;
+        const lon_Key *key;
+        lon_Table *t;
+    } u;
+};
+
+struct lon_Entry {
+    lon_Value key;
+    lon_Value value;
+};
+
+struct lon_Table {
+    size_t narray;            /* positional values, keys 1..narray */
+    size_t nfields;           /* other entries, in source order */
+    lon_Value *array;
+    lon_Entry *fields;
+    unsigned hash;            /* structural hash of contents */
+    lon_Table *next;          /* hash-consing chain */
+    unsigned *index;          /* field slots, built on first lookup */
+};
+
+struct lon_DomStats {
+    size_t tables;            /* tables completed */
+    size_t shared;            /* tables replaced by an identical one */
+    size_t bytes;             /* arena bytes in use */
+    size_t saved;             /* arena bytes released by sharing */
+};
+
+struct lon_Dom {
+    lon_Callbacks cb;
+    lon_Intern keys;          /* keys not interned by loader */
+    int flags;
+
+    lon_Value *values;        /* top-level values of last load */
+    size_t nvalues;
+
+    /* arena, chunks are linked by their first pointer */
+    char *arena;
+    size_t used;
+
+    /* hash-consing set, and its insert order for rollback */
+    lon_Table **buckets;
+    size_t nbuckets;
+    lon_Buffer consed;
+
+    /* pending keys and values of open tables */
+    lon_Buffer stack;
+    int levels;
+    struct {
+        size_t base;          /* start of entries in stack */
+        char *arena;          /* arena position at table begin */
+        size_t used;
+        size_t bytes;
+        size_t consed;
+    } frames[LON_MAX_LEVEL];
+
+    lon_Buffer indexes;       /* allocated field indexes */
+
+    lon_DomStats stats;
+    char errmsg[128];
+};
+
+
+LON_NS_END
+
+#endif /* lon_dom_h */
+
+
+#if defined(LON_IMPLEMENTATION) && !defined(lon_dom_implemented)
+#define lon_dom_implemented
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+LON_NS_BEGIN
+
+
+/* arena */
+
+#define lonO_align(n) (((n) + sizeof(lon_Value)-1) & ~(sizeof(lon_Value)-1))
+#define lonO_top(d)   (&(d)->frames[(d)->levels])
+
+static void *lonO_alloc(lon_Dom *d, size_t size) {
+    void *p;
+    size = lonO_align(size);
+    if (d->arena == NULL || d->used + size > LON_DOMARENA) {
+        size_t head = lonO_align(sizeof(char*));
+        char *arena = (char*)malloc(head + size > LON_DOMARENA ?
+                head + size : LON_DOMARENA);
+        if (arena == NULL) lon_break(d->cb.loader, LON_ERRMEM);
+        *(char**)arena = d->arena;
+        d->arena = arena;
+        d->used = head;
+    }
+    p = d->arena + d->used;
+    d->used += size;
+    d->stats.bytes += size;
+    return p;
+}
+
+static void lonO_mark(lon_Dom *d) {
+    lonO_top(d)->arena = d->arena;
+    lonO_top(d)->used = d->used;
+    lonO_top(d)->bytes = d->stats.bytes;
+    lonO_top(d)->consed = lon_buffsize(&d->consed) / sizeof(lon_Table*);
+}
+
+static void lonO_rollback(lon_Dom *d) {
+    /* release everything allocated since lonO_mark() */
+    lon_Table **consed = (lon_Table**)lon_buffer(&d->consed);
+    size_t n = lon_buffsize(&d->consed) / sizeof(lon_Table*);
+    while (n > lonO_top(d)->consed) {
+        lon_Table *t = consed[--n], **pt;
+        pt = &d->buckets[t->hash & (d->nbuckets - 1)];
+        while (*pt != t) pt = &(*pt)->next;
+        *pt = t->next;
+    }
+    d->consed.size = n * sizeof(lon_Table*);
+    while (d->arena != lonO_top(d)->arena) {
+        char *prev = *(char**)d->arena;
+        free(d->arena);
+        d->arena = prev;
+    }
+    d->used = lonO_top(d)->used;
+    d->stats.saved += d->stats.bytes - lonO_top(d)->bytes;
+    d->stats.bytes = lonO_top(d)->bytes;
+}
+
+
+/* hash-consing */
+
+static unsigned lonO_mix(unsigned h, unsigned long long v) {
+    v ^= v >> 33;
+    v *= 0xFF51AFD7ED558CCDull;
+    v ^= v >> 33;
+    return (h ^ (unsigned)v ^ (unsigned)(v >> 32)) * 0x9E3779B1u;
+}
+
+static unsigned lonO_hashvalue(unsigned h, const lon_Value *v) {
+    unsigned long long bits = 0;
+    switch (v->type) {
+    case LON_DT_BOOLEAN: bits = (unsigned)v->u.b; break;
+    case LON_DT_INTEGER: bits = (unsigned long long)v->u.i; break;
+    case LON_DT_NUMBER:
+        memcpy(&bits, &v->u.n, sizeof(v->u.n));
+        break;
+    case LON_DT_STRING: bits = lon_hash(v->u.str.s, v->u.str.len); break;
+    case LON_DT_KEY:    bits = v->u.key->hash; break;
+    case LON_DT_TABLE:  bits = v->u.t->hash; break;
+    }
+    return lonO_mix(h ^ (unsigned)v->type, bits);
+}
+
+static int lonO_equal(const lon_Value *a, const lon_Value *b) {
+    /* subtables are already shared, so compare them by identity */
+    if (a->type != b->type) return 0;
+    switch (a->type) {
+    case LON_DT_NIL:     return 1;
+    case LON_DT_BOOLEAN: return a->u.b == b->u.b;
+    case LON_DT_INTEGER: return a->u.i == b->u.i;
+    case LON_DT_NUMBER:
+        return memcmp(&a->u.n, &b->u.n, sizeof(a->u.n)) == 0;
+    case LON_DT_STRING:
+        return a->u.str.len == b->u.str.len
+            && memcmp(a->u.str.s, b->u.str.s, a->u.str.len) == 0;
+    case LON_DT_KEY:
+        return a->u.key == b->u.key || (a->u.key->len == b->u.key->len
+            && memcmp(a->u.key->s, b->u.key->s, a->u.key->len) == 0);
+    case LON_DT_TABLE:   return a->u.t == b->u.t;
+    }
+    return 0;
+}
+
+static int lonO_sametable(const lon_Table *t, const lon_Table *o) {
+    size_t i;
+    if (t->hash != o->hash || t->narray != o->narray
+            || t->nfields != o->nfields)
+        return 0;
+    for (i = 0; i < t->narray; ++i)
+        if (!lonO_equal(&t->array[i], &o->array[i]))
+            return 0;
+    for (i = 0; i < t->nfields; ++i)
+        if (!lonO_equal(&t->fields[i].key, &o->fields[i].key)
+                || !lonO_equal(&t->fields[i].value, &o->fields[i].value))
+            return 0;
+    return 1;
+}
+
+static void lonO_cons(lon_Dom *d, lon_Table *t) {
+    lon_Table **slot;
+    if (d->nbuckets <= lon_buffsize(&d->consed) / sizeof(lon_Table*)) {
+        size_t i, newsize = d->nbuckets ? d->nbuckets*2 : 256;
+        lon_Table **buckets = (lon_Table**)calloc(newsize, sizeof(lon_Table*));
+        if (buckets == NULL) lon_break(d->cb.loader, LON_ERRMEM);
+        for (i = 0; i < d->nbuckets; ++i) {
+            lon_Table *o = d->buckets[i], *next;
+            for (; o != NULL; o = next) {
+                next = o->next;
+                o->next = buckets[o->hash & (newsize - 1)];
+                buckets[o->hash & (newsize - 1)] = o;
+            }
+        }
+        free(d->buckets);
+        d->buckets = buckets;
+        d->nbuckets = newsize;
+    }
+    slot = &d->buckets[t->hash & (d->nbuckets - 1)];
+    t->next = *slot;
+    *slot = t;
+    lon_addlstring(&d->consed, (const char*)&t, sizeof(t));
+}
+
+
+/* builder */
+
+#define LONO_DT_INDEX 7 /* key of a positional field, until lonO_table() */
+
+static void lonO_push(lon_Dom *d, const lon_Value *v)
+{ lon_addlstring(&d->stack, (const char*)v, sizeof(lon_Value)); }
+
+static lon_Table *lonO_table(lon_Dom *d) {
+    /* build table from pending entries, or find an identical one */
+    lon_Value *v = (lon_Value*)(lon_buffer(&d->stack) + lonO_top(d)->base);
+    size_t i, n = (lon_buffsize(&d->stack) - lonO_top(d)->base)
+        / sizeof(lon_Value) / 2;
+    lon_Table t, *o;
+    for (i = 0; i < n; ++i) {  /* leading positional fields */
+        const lon_Value *k = &v[i*2];
+        if (k->type != LONO_DT_INDEX || k->u.i != (lon_Integer)i + 1)
+            break;
+        v[i] = v[i*2+1];
+    }
+    memmove(v + i, v + i*2, (n - i)*sizeof(lon_Entry));
+    t.narray = i, t.nfields = n - i;
+    t.array = v, t.fields = (lon_Entry*)(v + i);
+    for (i = 0; i < t.nfields; ++i) /* later ones override keyed fields */
+        if (t.fields[i].key.type == LONO_DT_INDEX)
+            t.fields[i].key.type = LON_DT_INTEGER;
+    t.hash = lonO_mix(0, t.narray);
+    for (i = 0; i < t.narray + t.nfields*2; ++i)
+        t.hash = lonO_hashvalue(t.hash, &v[i]);
+    ++d->stats.tables;
+    if (d->flags & LON_DOM_DEDUP) {
+        o = d->nbuckets ? d->buckets[t.hash & (d->nbuckets - 1)] : NULL;
+        for (; o != NULL; o = o->next)
+            if (lonO_sametable(&t, o)) {
+                ++d->stats.shared;
+                lonO_rollback(d);
+                return o;
+            }
+    }
+    o = (lon_Table*)lonO_alloc(d, sizeof(lon_Table)
+            + t.narray*sizeof(lon_Value) + t.nfields*sizeof(lon_Entry));
+    *o = t;
+    o->array = (lon_Value*)(o + 1);
+    o->fields = (lon_Entry*)(o->array + o->narray);
+    memcpy(o->array, v, t.narray*sizeof(lon_Value));
+    memcpy(o->fields, t.fields, t.nfields*sizeof(lon_Entry));
+    o->next = NULL, o->index = NULL;
+    if (d->flags & LON_DOM_DEDUP)
+        lonO_cons(d, o);
+    return o;
+}
+
+static void lonO_onbegin(lon_Callbacks *cb) {
+    lon_Dom *d = (lon_Dom*)cb;
+    d->levels = 0;
+    d->stack.jbuf = &cb->loader->jbuf;
+    d->consed.jbuf = &cb->loader->jbuf;
+    lon_resetbuffer(&d->stack);
+    d->values = NULL, d->nvalues = 0;
+    d->errmsg[0] = '\0';
+}
+
+static void lonO_onend(lon_Callbacks *cb) {
+    lon_Dom *d = (lon_Dom*)cb;
+    size_t size = lon_buffsize(&d->stack);
+    d->values = (lon_Value*)lonO_alloc(d, size);
+    memcpy(d->values, lon_buffer(&d->stack), size);
+    d->nvalues = size / sizeof(lon_Value);
+    lon_resetbuffer(&d->stack);
+}
+
+static void lonO_onerror(lon_Callbacks *cb, const char *errmsg) {
+    lon_Dom *d = (lon_Dom*)cb;
+    snprintf(d->errmsg, sizeof(d->errmsg), "%s", errmsg);
+}
+
+static void lonO_onnil(lon_Callbacks *cb) {
+    lon_Value v;
+    v.type = LON_DT_NIL;
+    lonO_push((lon_Dom*)cb, &v);
+}
+
+static void lonO_onboolean(lon_Callbacks *cb, int value) {
+    lon_Value v;
+    v.type = LON_DT_BOOLEAN, v.u.b = value;
+    lonO_push((lon_Dom*)cb, &v);
+}
+
+static void lonO_oninteger(lon_Callbacks *cb, lon_Integer value) {
+    lon_Value v;
+    v.type = LON_DT_INTEGER, v.u.i = value;
+    lonO_push((lon_Dom*)cb, &v);
+}
+
+static void lonO_onindex(lon_Callbacks *cb, lon_Integer index) {
+    lon_Value v;
+    v.type = LONO_DT_INDEX, v.u.i = index;
+    lonO_push((lon_Dom*)cb, &v);
+}
+
+static void lonO_onnumber(lon_Callbacks *cb, lon_Number value) {
+    lon_Value v;
+    v.type = LON_DT_NUMBER, v.u.n = value;
+    lonO_push((lon_Dom*)cb, &v);
+}
+
+static void lonO_onstring(lon_Callbacks *cb, const char *s, size_t len) {
+    lon_Dom *d = (lon_Dom*)cb;
+    char *p = (char*)lonO_alloc(d, len + 1);
+    lon_Value v;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    v.type = LON_DT_STRING, v.u.str.s = p, v.u.str.len = len;
+    lonO_push(d, &v);
+}
+
+static void lonO_oninternedkey(lon_Callbacks *cb, const lon_Key *key) {
+    lon_Value v;
+    v.type = LON_DT_KEY, v.u.key = key;
+    lonO_push((lon_Dom*)cb, &v);
+}
+
+static void lonO_onkey(lon_Callbacks *cb, const char *s, size_t len,
+                       unsigned hash) {
+    lon_Dom *d = (lon_Dom*)cb;
+    const lon_Key *key = lon_intern(&d->keys, s, len, hash);
+    if (key == NULL) lon_break(cb->loader, LON_ERRMEM);
+    lonO_oninternedkey(cb, key);
+}
+
+static void lonO_ontablebegin(lon_Callbacks *cb) {
+    lon_Dom *d = (lon_Dom*)cb;
+    if (d->levels >= LON_MAX_LEVEL-1) {
+        snprintf(d->errmsg, sizeof(d->errmsg), "table too deep");
+        lon_break(cb->loader, LON_ERR);
+    }
+    ++d->levels;
+    lonO_top(d)->base = lon_buffsize(&d->stack);
+    lonO_mark(d);
+}
+
+static void lonO_ontableend(lon_Callbacks *cb) {
+    lon_Dom *d = (lon_Dom*)cb;
+    lon_Value v;
+    v.type = LON_DT_TABLE;
+    v.u.t = lonO_table(d);
+    d->stack.size = lonO_top(d)->base;
+    --d->levels;
+    lonO_push(d, &v);
+}
+
+LON_API void lon_initdom(lon_Dom *d, int flags) {
+    memset(d, 0, sizeof(*d));
+    d->flags = flags;
+    lon_initintern(&d->keys);
+    lon_initbuffer(&d->stack, NULL);
+    lon_initbuffer(&d->consed, NULL);
+    lon_initbuffer(&d->indexes, NULL);
+    d->cb.on_error        = lonO_onerror;
+    d->cb.on_begin        = lonO_onbegin;
+    d->cb.on_end          = lonO_onend;
+    d->cb.on_nil          = lonO_onnil;
+    d->cb.on_boolean      = lonO_onboolean;
+    d->cb.on_integer      = lonO_oninteger;
+    d->cb.on_index        = lonO_onindex;
+    d->cb.on_number       = lonO_onnumber;
+    d->cb.on_string       = lonO_onstring;
+    d->cb.on_key          = lonO_onkey;
+    d->cb.on_interned_key = lonO_oninternedkey;
+    d->cb.on_table_begin  = lonO_ontablebegin;
+    d->cb.on_table_end    = lonO_ontableend;
+}
+
+LON_API void lon_freedom(lon_Dom *d) {
+    unsigned **indexes = (unsigned**)lon_buffer(&d->indexes);
+    size_t i, n = lon_buffsize(&d->indexes) / sizeof(unsigned*);
+    while (d->arena != NULL) {
+        char *prev = *(char**)d->arena;
+        free(d->arena);
+        d->arena = prev;
+    }
+    for (i = 0; i < n; ++i)
+        free(indexes[i]);
+    lon_freebuffer(&d->indexes);
+    free(d->buckets);
+    lon_freeintern(&d->keys);
+    lon_freebuffer(&d->stack);
+    lon_freebuffer(&d->consed);
+    lon_initdom(d, d->flags);
+}
+
+LON_API const lon_Value *lon_dom_values(lon_Dom *d, size_t *pn) {
+    if (pn) *pn = d->nvalues;
+    return d->values;
+}
+
+LON_API const char *lon_dom_error(lon_Dom *d)
+{ return d->errmsg[0] ? d->errmsg : NULL; }
+
+LON_API void lon_dom_stats(lon_Dom *d, lon_DomStats *st)
+{ *st = d->stats; }
+
+LON_API const char *lon_dom_tostring(const lon_Value *v, size_t *plen) {
+    switch (v->type) {
+    case LON_DT_STRING:
+        if (plen) *plen = v->u.str.len;
+        return v->u.str.s;
+    case LON_DT_KEY:
+        if (plen) *plen = v->u.key->len;
+        return v->u.key->s;
+    }
+    return NULL;
+}
+
+
+
+/* index */
+
+static unsigned lonO_noindex[1]; /* small table, scanned linearly */
+
+static unsigned lonO_keyhash(const lon_Value *k) {
+    switch (k->type) {
+    case LON_DT_STRING: return lon_hash(k->u.str.s, k->u.str.len);
+    case LON_DT_KEY:    return k->u.key->hash;
+    case LON_DT_TABLE:  return lonO_mix(0, (size_t)k->u.t);
+    }
+    return lonO_hashvalue(0, k);
+}
+
+static int lonO_samekey(const lon_Value *a, const lon_Value *b) {
+    size_t alen = 0, blen = 0;
+    const char *as = lon_dom_tostring(a, &alen);
+    const char *bs = lon_dom_tostring(b, &blen);
+    if (as == NULL || bs == NULL)
+        return lonO_equal(a, b);
+    return alen == blen && (as == bs || memcmp(as, bs, alen) == 0);
+}
+
+static int lonO_buildindex(lon_Dom *d, lon_Table *t) {
+    /* index[0] is mask, followed by slots of field index + 1; equal
+     * keys share a slot, so the last one wins. Without memory the table
+     * stays scanned linearly */
+    unsigned *index, mask = LON_DOM_MININDEX*2 - 1;
+    size_t i;
+    t->index = lonO_noindex;
+    if (t->nfields < LON_DOM_MININDEX) return 1;
+    while (mask < t->nfields*2 - 1) mask = mask*2 + 1;
+    if ((index = (unsigned*)calloc(mask + 2, sizeof(unsigned))) == NULL
+            || !lon_addlstring(&d->indexes, (const char*)&index,
+                sizeof(index))) {
+        free(index);
+        snprintf(d->errmsg, sizeof(d->errmsg), "out of memory");
+        return 0;
+    }
+    index[0] = mask;
+    for (i = 0; i < t->nfields; ++i) {
+        const lon_Value *k = &t->fields[i].key;
+        unsigned h = lonO_keyhash(k) & mask;
+        while (index[h+1] != 0
+                && !lonO_samekey(&t->fields[index[h+1]-1].key, k))
+            h = (h + 1) & mask;
+        index[h+1] = (unsigned)i + 1;
+    }
+    t->index = index;
+    return 1;
+}
+
+LON_API int lon_dom_index(lon_Dom *d, lon_Table *t) {
+    /* build indexes of all tables in 't' ahead of lookups */
+    size_t i;
+    if (t->index != NULL) return 1; /* shared subtable already done */
+    if (!lonO_buildindex(d, t)) return 0;
+    for (i = 0; i < t->narray; ++i)
+        if (t->array[i].type == LON_DT_TABLE
+                && !lon_dom_index(d, t->array[i].u.t))
+            return 0;
+    for (i = 0; i < t->nfields; ++i) {
+        const lon_Entry *e = &t->fields[i];
+        if ((e->key.type == LON_DT_TABLE && !lon_dom_index(d, e->key.u.t))
+                || (e->value.type == LON_DT_TABLE
+                    && !lon_dom_index(d, e->value.u.t)))
+            return 0;
+    }
+    return 1;
+}
+
+LON_API const lon_Value *lon_dom_get(lon_Dom *d, lon_Table *t,
+                                     const lon_Value *key) {
+    size_t i;
+    if (key->type == LON_DT_INTEGER && key->u.i >= 1
+            && (size_t)key->u.i <= t->narray)
+        return &t->array[key->u.i - 1];
+    if (t->index == NULL) lonO_buildindex(d, t);
+    if (t->index != lonO_noindex) {
+        unsigned mask = t->index[0], h = lonO_keyhash(key) & mask;
+        for (; t->index[h+1] != 0; h = (h + 1) & mask) {
+            const lon_Entry *e = &t->fields[t->index[h+1]-1];
+            if (lonO_samekey(&e->key, key))
+                return &e->value;
+        }
+        return NULL;
+    }
+    for (i = t->nfields; i > 0; --i)
+        if (lonO_samekey(&t->fields[i-1].key, key))
+            return &t->fields[i-1].value;
+    return NULL;
+}
+
+LON_API const lon_Value *lon_dom_getfield(lon_Dom *d, lon_Table *t,
+                                          const char *s, size_t len) {
+    lon_Value key;
+    key.type = LON_DT_STRING, key.u.str.s = s, key.u.str.len = len;
+    return lon_dom_get(d, t, &key);
+}
+
+LON_API const lon_Value *lon_dom_getindex(lon_Dom *d, lon_Table *t,
+                                          lon_Integer i) {
+    lon_Value key;
+    key.type = LON_DT_INTEGER, key.u.i = i;
+    return lon_dom_get(d, t, &key);
+}
+
+
+LON_NS_END
+
+#endif /* LON_IMPLEMENTATION */
@@ -0,0 +1,481 @@
+/* lon_incr: incremental re-parse of edited lon documents
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_incr_h
+#define lon_incr_h
+
+
+#include "lon_dom.h"
+
+LON_NS_BEGIN
+
+#define LON_CHANGE_ADD    0
+#define LON_CHANGE_REMOVE 1
+#define LON_CHANGE_SET    2
+
+typedef struct lon_Incr lon_Incr;
+typedef struct lon_Node lon_Node;
+
+/* path[0] is a top-level value, path[depth-1] the changed field: the new
+ * one, or for LON_CHANGE_REMOVE the removed one. 'old' is the replaced
+ * field of LON_CHANGE_SET. Nodes are only valid during the call */
+typedef void lon_Change (void *ud, int what, const lon_Node *const *path,
+                         int depth, const lon_Node *old);
+
+LON_API void lon_initincr (lon_Incr *I, lon_Change *f, void *ud);
+LON_API void lon_freeincr (lon_Incr *I);
+
+LON_API const char *lon_incr_error (lon_Incr *I);
+
+/* full parse of s, reports changes against the previous document */
+LON_API int lon_incr_load (lon_Incr *I, const char *s, size_t len);
+
+/* s is the whole document after replacing 'oldlen' bytes at 'start' with
+ * 'newlen' bytes; only the smallest enclosing field is parsed again.
+ * On error the tree stays at the last good document, lon_incr_load() it
+ * again once the text is valid */
+LON_API int lon_incr_edit (lon_Incr *I, const char *s, size_t len,
+                           size_t start, size_t oldlen, size_t newlen);
+
+/* pseudo table of top-level values */
+LON_API const lon_Node *lon_incr_root (lon_Incr *I);
+
+
+/* structs */
+
+/* a field with the span of its text, from after the separator before it
+ * to the separator after it, relative to the enclosing field (offsets and
+ * lines of fields after an edit are then fixed up only in its ancestors).
+ * Tables keep their fields in order; table keys are not supported */
+
+struct lon_Node {
+    size_t start, size;
+    int line, lines;         /* line of start, line breaks in span */
+    int positional;          /* key is implicit index */
+    lon_Value key;           /* LON_DT_NIL for top-level values */
+    lon_Value value;         /* LON_DT_TABLE has no u.t, see fields */
+    size_t nfields;
+    lon_Node *fields;
+};
+
+struct lon_Incr {
+    lon_Loader L;
+    lon_Node root;
+    lon_Change *f;
+    void *ud;
+    size_t reparsed;         /* bytes parsed by last load or edit */
+    const lon_Node *path[LON_MAX_LEVEL+1];
+    char errmsg[256];
+};
+
+
+LON_NS_END
+
+#endif /* lon_incr_h */
+
+
+#if defined(LON_IMPLEMENTATION) && !defined(lon_incr_implemented)
+#define lon_incr_implemented
+
+
+#include <stdlib.h>
+#include <string.h>
+
+
+LON_NS_BEGIN
+
+
+typedef struct lonI_Parser {
+    lon_Loader *L;
+    int levels;
+    lon_Buffer stack;        /* fields of open tables */
+    lon_Buffer allocs;       /* blocks of this parse, freed on error */
+} lonI_Parser;
+
+static void *lonI_alloc(lonI_Parser *P, size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) longjmp(P->L->jbuf, LON_ERRMEM);
+    if (!lon_addlstring(&P->allocs, (const char*)&p, sizeof(p))) {
+        free(p);
+        longjmp(P->L->jbuf, LON_ERRMEM);
+    }
+    return p;
+}
+
+static void lonI_string(lonI_Parser *P, lon_Value *v, size_t sep) {
+    lon_Loader *L = P->L;
+    size_t len = lon_buffsize(&L->buffer) - sep*2;
+    char *s = (char*)lonI_alloc(P, len + 1);
+    memcpy(s, lon_buffer(&L->buffer) + sep, len);
+    s[len] = '\0';
+    v->type = LON_DT_STRING;
+    v->u.str.s = s;
+    v->u.str.len = len;
+}
+
+static void lonI_field(lonI_Parser *P, lon_Node *n, lon_Integer *index,
+                       int expronly, size_t base, int baseline);
+
+static void lonI_table(lonI_Parser *P, lon_Node *n, size_t base,
+                       int baseline) {
+    /* fields are relative to n, which starts at base */
+    lon_Loader *L = P->L;
+    size_t top = lon_buffsize(&P->stack);
+    size_t start = lon_offset(L);
+    lon_Integer index = 1;
+    int line = L->line, open = L->line;
+    if (++P->levels >= LON_MAX_LEVEL)
+        lonX_error(L, "too many nested tables", L->token);
+    lonY_checknext(L, '{');
+    do {
+        lon_Node f;
+        if (L->token == '}') break;
+        memset(&f, 0, sizeof(f));
+        f.start = start - base;
+        f.line = line - baseline;
+        lonI_field(P, &f, &index, 0, start, line);
+        f.size = lon_offset(L) - 1 - start;
+        f.lines = L->line - line;
+        lon_addlstring(&P->stack, (const char*)&f, sizeof(f));
+        start = lon_offset(L), line = L->line;
+    } while (lonY_testnext(L, ',') || lonY_testnext(L, ';'));
+    lonY_checkmatch(L, '}', '{', open);
+    --P->levels;
+    n->value.type = LON_DT_TABLE;
+    n->nfields = (lon_buffsize(&P->stack) - top) / sizeof(lon_Node);
+    if (n->nfields != 0) {
+        size_t size = n->nfields * sizeof(lon_Node);
+        n->fields = (lon_Node*)lonI_alloc(P, size);
+        memcpy(n->fields, lon_buffer(&P->stack) + top, size);
+    }
+    P->stack.size = top;
+}
+
+static void lonI_expr(lonI_Parser *P, lon_Node *n, size_t base,
+                      int baseline) {
+    lon_Loader *L = P->L;
+    switch (L->token) {
+    case '{': lonI_table(P, n, base, baseline); return;
+    case '-': lonY_negate(L); break;
+    }
+    switch (L->token) {
+    case TK_NIL:    n->value.type = LON_DT_NIL; break;
+    case TK_TRUE:   n->value.type = LON_DT_BOOLEAN; n->value.u.b = 1; break;
+    case TK_FALSE:  n->value.type = LON_DT_BOOLEAN; n->value.u.b = 0; break;
+    case TK_INT:    n->value.type = LON_DT_INTEGER; n->value.u.i = L->iv; break;
+    case TK_FLT:    n->value.type = LON_DT_NUMBER; n->value.u.n = L->nv; break;
+    case TK_STRING: lonI_string(P, &n->value, L->seplen); break;
+    default:
+        lonX_error(L, "unexpected symbol", L->token);
+    }
+    lonY_next(L);
+}
+
+static void lonI_field(lonI_Parser *P, lon_Node *n, lon_Integer *index,
+                       int expronly, size_t base, int baseline) {
+    /* field: exp | (NAME | '[' exp ']') '=' exp */
+    lon_Loader *L = P->L;
+    if (!expronly && L->token == TK_NAME) {
+        lonI_string(P, &n->key, 0);
+        lonY_next(L);
+    }
+    else if (!expronly && L->token == '[') {
+        lon_Node k;
+        lonY_next(L);
+        if (L->token == '{')
+            lonX_error(L, "table key not supported", L->token);
+        memset(&k, 0, sizeof(k));
+        lonI_expr(P, &k, base, baseline);
+        n->key = k.value;
+        lonY_checknext(L, ']');
+    }
+    else {
+        n->positional = 1;
+        n->key.type = LON_DT_INTEGER;
+        n->key.u.i = (*index)++;
+        lonI_expr(P, n, base, baseline);
+        return;
+    }
+    lonY_checknext(L, '=');
+    lonI_expr(P, n, base, baseline);
+}
+
+static void lonI_root(lonI_Parser *P, lon_Node *root) {
+    /* chunk -> [ 'return' ] [ exp { ',' exp } ] */
+    lon_Loader *L = P->L;
+    size_t start = 0;
+    lon_Integer index = 1;
+    int line = 0;
+    root->value.type = LON_DT_TABLE;
+    if (lonY_next(L) == TK_RETURN) {
+        start = lon_offset(L), line = L->line;
+        lonY_next(L);
+    }
+    while (L->token != TK_EOS) {
+        lon_Node f;
+        memset(&f, 0, sizeof(f));
+        f.start = start, f.line = line;
+        lonI_field(P, &f, &index, 1, start, line);
+        if (L->token != TK_EOS) lonY_check(L, ',');
+        f.size = lon_offset(L) - (L->token == ',') - start;
+        f.lines = L->line - line;
+        lon_addlstring(&P->stack, (const char*)&f, sizeof(f));
+        if (L->token == TK_EOS) break;
+        start = lon_offset(L), line = L->line;
+        lonY_next(L);
+    }
+    root->size = lon_offset(L);
+    root->lines = L->line;
+    root->nfields = lon_buffsize(&P->stack) / sizeof(lon_Node);
+    if (root->nfields != 0) {
+        root->fields = (lon_Node*)lonI_alloc(P, lon_buffsize(&P->stack));
+        memcpy(root->fields, lon_buffer(&P->stack), lon_buffsize(&P->stack));
+    }
+}
+
+static void lonI_one(lonI_Parser *P, lon_Node *n, int expronly,
+                     lon_Integer index, size_t start, int line) {
+    lon_Loader *L = P->L;
+    lonY_next(L);
+    lonI_field(P, n, &index, expronly, start, line);
+    lonY_check(L, TK_EOS);
+    n->size = lon_offset(L) - start;
+    n->lines = L->line - line;
+}
+
+static int lonI_parse(lon_Incr *I, lon_Node *n, const char *s, size_t len,
+                      size_t offset, int line, int mode, lon_Integer index) {
+    /* mode: 0 document, 1 field, 2 top-level value */
+    lon_StringCtx ctx;
+    lonI_Parser P;
+    lon_Loader *L = &I->L;
+    int res;
+    ctx.len = len, ctx.loaded = 0, ctx.s = s;
+    P.L = L, P.levels = 0;
+    lon_initbuffer(&P.stack, &L->jbuf);
+    lon_initbuffer(&P.allocs, NULL);
+    memset(n, 0, sizeof(*n));
+    L->name = "[=incr]";
+    lonL_reset(L, lonL_stringreader, &ctx);
+    L->offset = offset, L->line = line;
+    I->reparsed = len;
+    if ((res = setjmp(L->jbuf)) == 0) {
+        lonX_next(L);
+        if (mode == 0)
+            lonI_root(&P, n);
+        else
+            lonI_one(&P, n, mode == 2, index, offset, line);
+    }
+    else {
+        void **p = (void**)lon_buffer(&P.allocs);
+        size_t i, count = lon_buffsize(&P.allocs) / sizeof(void*);
+        for (i = 0; i < count; ++i) free(p[i]);
+        memset(n, 0, sizeof(*n));
+        if (res == LON_ERRMEM)
+            strcpy(I->errmsg, "out of memory");
+        else {
+            *lon_prepbuffsize(&L->errmsg, 1) = '\0';
+            snprintf(I->errmsg, sizeof(I->errmsg), "%s",
+                    lon_buffer(&L->errmsg));
+        }
+    }
+    lon_freebuffer(&P.stack);
+    lon_freebuffer(&P.allocs);
+    lon_break(L, LON_OK);
+    return res;
+}
+
+static void lonI_freevalue(lon_Value *v)
+{ if (v->type == LON_DT_STRING) free((void*)v->u.str.s); }
+
+static void lonI_freenode(lon_Node *n) {
+    size_t i;
+    lonI_freevalue(&n->key);
+    lonI_freevalue(&n->value);
+    for (i = 0; i < n->nfields; ++i)
+        lonI_freenode(&n->fields[i]);
+    free(n->fields);
+}
+
+static int lonI_same(const lon_Value *a, const lon_Value *b) {
+    if (a->type != b->type) return 0;
+    switch (a->type) {
+    case LON_DT_BOOLEAN: return a->u.b == b->u.b;
+    case LON_DT_INTEGER: return a->u.i == b->u.i;
+    case LON_DT_NUMBER:  return a->u.n == b->u.n;
+    case LON_DT_STRING:  return a->u.str.len == b->u.str.len
+                             && memcmp(a->u.str.s, b->u.str.s,
+                                     a->u.str.len) == 0;
+    }
+    return 1;
+}
+
+static void lonI_diff(lon_Incr *I, int depth, const lon_Node *o,
+                      const lon_Node *n) {
+    /* path[0..depth-1] leads to n, o is the node it replaces */
+    char *matched;
+    size_t i, j;
+    if (o->value.type != LON_DT_TABLE || n->value.type != LON_DT_TABLE) {
+        if (depth > 0 && !lonI_same(&o->value, &n->value))
+            I->f(I->ud, LON_CHANGE_SET, I->path, depth, o);
+        return;
+    }
+    if (depth >= LON_MAX_LEVEL) return;
+    if ((matched = (char*)calloc(o->nfields + 1, 1)) == NULL) return;
+    for (i = 0; i < n->nfields; ++i) {
+        j = i;  /* fields usually keep their order */
+        if (j >= o->nfields || matched[j]
+                || !lonI_same(&o->fields[j].key, &n->fields[i].key))
+            for (j = 0; j < o->nfields; ++j)
+                if (!matched[j] && lonI_same(&o->fields[j].key,
+                            &n->fields[i].key))
+                    break;
+        I->path[depth] = &n->fields[i];
+        if (j == o->nfields)
+            I->f(I->ud, LON_CHANGE_ADD, I->path, depth+1, NULL);
+        else {
+            matched[j] = 1;
+            lonI_diff(I, depth+1, &o->fields[j], &n->fields[i]);
+        }
+    }
+    for (j = 0; j < o->nfields; ++j) {
+        if (matched[j]) continue;
+        I->path[depth] = &o->fields[j];
+        I->f(I->ud, LON_CHANGE_REMOVE, I->path, depth+1, &o->fields[j]);
+    }
+    free(matched);
+}
+
+static int lonI_opencomment(const char *s, size_t len) {
+    /* a '--' on the last line may be a comment eating the separator */
+    size_t i = len;
+    while (i > 0 && s[i-1] != '\n') --i;
+    for (; i + 1 < len; ++i)
+        if (s[i] == '-' && s[i+1] == '-') return 1;
+    return 0;
+}
+
+static void lonI_splice(lon_Node **nodes, int d, long long delta,
+                        int linedelta) {
+    /* fix up spans of ancestors of nodes[d] and fields after them */
+    for (--d; d >= 0; --d) {
+        lon_Node *p = nodes[d];
+        size_t i = (size_t)(nodes[d+1] - p->fields) + 1;
+        p->size = (size_t)((long long)p->size + delta);
+        p->lines += linedelta;
+        for (; i < p->nfields; ++i) {
+            p->fields[i].start = (size_t)((long long)p->fields[i].start
+                    + delta);
+            p->fields[i].line += linedelta;
+        }
+    }
+}
+
+
+/* incremental routines */
+
+LON_API void lon_initincr(lon_Incr *I, lon_Change *f, void *ud) {
+    memset(I, 0, sizeof(*I));
+    lon_initloader(&I->L);
+    I->root.value.type = LON_DT_TABLE;
+    I->f = f, I->ud = ud;
+}
+
+LON_API void lon_freeincr(lon_Incr *I) {
+    lonI_freenode(&I->root);
+    memset(&I->root, 0, sizeof(I->root));
+    I->root.value.type = LON_DT_TABLE;
+}
+
+LON_API const char *lon_incr_error(lon_Incr *I)
+{ return I->errmsg[0] ? I->errmsg : NULL; }
+
+LON_API const lon_Node *lon_incr_root(lon_Incr *I)
+{ return &I->root; }
+
+LON_API int lon_incr_load(lon_Incr *I, const char *s, size_t len) {
+    lon_Node root;
+    int res;
+    I->errmsg[0] = '\0';
+    if ((res = lonI_parse(I, &root, s, len, 0, 0, 0, 0)) != LON_OK)
+        return res;
+    if (I->f) lonI_diff(I, 0, &I->root, &root);
+    lonI_freenode(&I->root);
+    I->root = root;
+    return LON_OK;
+}
+
+LON_API int lon_incr_edit(lon_Incr *I, const char *s, size_t len,
+                          size_t start, size_t oldlen, size_t newlen) {
+    lon_Node *nodes[LON_MAX_LEVEL+1];
+    size_t offsets[LON_MAX_LEVEL+1];
+    int lines[LON_MAX_LEVEL+1];
+    long long delta = (long long)newlen - (long long)oldlen;
+    int d, depth = 0;
+    I->errmsg[0] = '\0';
+    nodes[0] = &I->root, offsets[0] = 0, lines[0] = 0;
+    /* find fields enclosing the edited range, outermost first */
+    while (depth < LON_MAX_LEVEL) {
+        lon_Node *p = nodes[depth];
+        size_t lo = 0, hi = p->nfields;
+        while (lo < hi) {  /* last field starting at or before edit */
+            size_t mid = lo + (hi - lo)/2;
+            if (offsets[depth] + p->fields[mid].start <= start)
+                lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == 0) break;
+        else {
+            lon_Node *f = &p->fields[lo-1];
+            size_t offset = offsets[depth] + f->start;
+            if (start + oldlen > offset + f->size) break;
+            nodes[++depth] = f;
+            offsets[depth] = offset;
+            lines[depth] = lines[depth-1] + f->line;
+        }
+    }
+    /* parse innermost field again, fall back to its parents */
+    for (d = depth; d > 0; --d) {
+        lon_Node n, *f = nodes[d];
+        size_t size = (size_t)((long long)f->size + delta);
+        const char *text = s + offsets[d];
+        int i;
+        if (offsets[d] + size > len) continue;
+        if (lonI_opencomment(text, size)) continue;
+        if (d == 1 && f == I->root.fields && f->start != 0 && size != 0
+                && (lon_isalnum((unsigned char)text[0]) || text[0] == '_'))
+            continue;  /* would join the 'return' keyword */
+        if (lonI_parse(I, &n, text, size, offsets[d], lines[d],
+                    d == 1 ? 2 : 1, f->key.u.i) != LON_OK)
+            continue;
+        if (n.positional != f->positional) {
+            lonI_freenode(&n);
+            continue;
+        }
+        n.start = f->start, n.line = f->line;
+        if (I->f) {
+            for (i = 1; i < d; ++i) I->path[i-1] = nodes[i];
+            if (!lonI_same(&f->key, &n.key)) {
+                I->path[d-1] = f;
+                I->f(I->ud, LON_CHANGE_REMOVE, I->path, d, f);
+                I->path[d-1] = &n;
+                I->f(I->ud, LON_CHANGE_ADD, I->path, d, NULL);
+            }
+            else {
+                I->path[d-1] = &n;
+                lonI_diff(I, d, f, &n);
+            }
+        }
+        lonI_splice(nodes, d, delta, n.lines - f->lines);
+        lonI_freenode(f);
+        *f = n;
+        I->errmsg[0] = '\0';
+        return LON_OK;
+    }
+    return lon_incr_load(I, s, len);
+}
+
+
+LON_NS_END
+
+#endif /* LON_IMPLEMENTATION */
@@ -0,0 +1,597 @@
+/* lon_log: append-only log of keyed lon records
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_log_h
+#define lon_log_h
+
+
+#include "lon.h"
+
+#include <stdio.h>
+
+#ifdef LON_LOG_THREAD
+# include <pthread.h>
+#endif
+
+LON_NS_BEGIN
+
+#define LON_LOG_MAGIC "LONLOG1\n"
+#define LON_LOG_FRAME 12 /* key length, value length, checksum */
+
+typedef struct lon_Log       lon_Log;
+typedef struct lon_LogRecord lon_LogRecord;
+
+/* lon_log_close() must be called even if lon_log_open() failed */
+LON_API int  lon_log_open  (lon_Log *g, const char *filename);
+LON_API void lon_log_close (lon_Log *g);
+
+LON_API const char *lon_log_error (lon_Log *g);
+
+/* write a record: dump its value to the returned dumper, then commit */
+LON_API lon_Dumper *lon_log_begin  (lon_Log *g, const char *key, size_t len);
+LON_API int         lon_log_commit (lon_Log *g);
+
+LON_API int lon_log_put    (lon_Log *g, const char *key, size_t len,
+                            const char *value, size_t vlen);
+LON_API int lon_log_remove (lon_Log *g, const char *key, size_t len);
+
+/* the value returned by lon_log_find() is valid until the next write or
+ * compaction, or until lon_log_find() of a newer record remaps the file */
+LON_API const char *lon_log_find (lon_Log *g, const char *key, size_t len,
+                                  size_t *pvlen);
+LON_API int         lon_log_get  (lon_Log *g, lon_Loader *L,
+                                  const char *key, size_t len);
+
+/* lon_log_compact() is lon_log_compact_start() and _finish() in a row;
+ * writes and reads may go on between the two */
+LON_API int lon_log_compact        (lon_Log *g);
+LON_API int lon_log_compact_start  (lon_Log *g);
+LON_API int lon_log_compact_finish (lon_Log *g);
+
+
+/* structs */
+
+/* file: LON_LOG_MAGIC, then records of a frame of three little endian
+ * 32 bit words (key length, value length, lon_hash() of key and value)
+ * followed by the key and the value chunk; an empty value removes the
+ * key. Reading stops at the first torn or corrupt record, and the next
+ * append overwrites it.
+ *
+ * compaction copies the frames of the live records to a new file, on a
+ * thread with LON_LOG_THREAD; finishing it appends the records written
+ * since, syncs the file and renames it over the log */
+
+struct lon_LogRecord {
+    size_t offset;           /* of value, 0 if key is removed */
+    size_t size;
+};
+
+struct lon_Log {
+    FILE *fp;
+    char *filename;
+    size_t size;             /* end of valid records */
+    size_t records;          /* records in file, including overwritten */
+    size_t live;             /* keys with a value */
+
+    lon_Intern keys;         /* keys seen, by id */
+    lon_Buffer index;        /* lon_LogRecord by key id */
+
+    lon_Dumper D;            /* value of record being written */
+    lon_Buffer value;
+    lon_Buffer key;
+
+    const char *map;         /* file contents for reads */
+    size_t mapsize;
+    int mapped;              /* map is mmap()ed rather than in readbuf */
+    lon_Buffer readbuf;
+
+    lon_Buffer jobs;         /* frames copied by compaction */
+    lon_Buffer tmpname;
+    FILE *tmpfp;
+    size_t compactfrom;      /* size when compaction started */
+    size_t compactsize;      /* of the copied frames */
+    size_t compactrecords;   /* records when compaction started */
+    int compacting;
+    int compactres;          /* result of the copy, and its message */
+    const char *compactmsg;
+#ifdef LON_LOG_THREAD
+    pthread_t thread;
+    int threaded;            /* copy runs on 'thread' */
+#endif
+
+    char errmsg[128];
+};
+
+
+LON_NS_END
+
+#endif /* lon_log_h */
+
+
+#if defined(LON_IMPLEMENTATION) && !defined(lon_log_implemented)
+#define lon_log_implemented
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && !defined(LON_LOG_NO_MMAP)
+# define LON_LOG_MMAP
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+
+LON_NS_BEGIN
+
+
+#define lonG_records(g) ((lon_LogRecord*)lon_buffer(&(g)->index))
+
+static int lonG_error(lon_Log *g, const char *msg, int res) {
+    snprintf(g->errmsg, sizeof(g->errmsg), "%s: %s",
+            g->filename ? g->filename : "[=log]", msg);
+    return res;
+}
+
+static unsigned lonG_u32(const char *p) {
+    const unsigned char *s = (const unsigned char*)p;
+    return s[0] | (s[1] << 8) | ((unsigned)s[2] << 16) | ((unsigned)s[3] << 24);
+}
+
+static void lonG_setu32(char *p, unsigned v) {
+    p[0] = (char)(v & 0xFF), p[1] = (char)((v >> 8) & 0xFF);
+    p[2] = (char)((v >> 16) & 0xFF), p[3] = (char)((v >> 24) & 0xFF);
+}
+
+static unsigned lonG_checksum(const char *key, size_t len,
+                              const char *value, size_t vlen) {
+    unsigned h = lon_hash(key, len);
+    while (vlen--) h = lon_hashstep(h, *value++);
+    return h;
+}
+
+
+/* reading */
+
+static void lonG_unmap(lon_Log *g) {
+#ifdef LON_LOG_MMAP
+    if (g->mapped) munmap((void*)g->map, g->mapsize);
+#endif
+    g->map = NULL, g->mapsize = 0, g->mapped = 0;
+    lon_resetbuffer(&g->readbuf);
+}
+
+static int lonG_map(lon_Log *g, size_t size) {
+    /* make at least 'size' bytes of the file readable from g->map */
+    if (size <= g->mapsize) return LON_OK;
+    lonG_unmap(g);
+    if (g->fp != NULL && fflush(g->fp) != 0)
+        return lonG_error(g, "flush failed", LON_ERRFILE);
+#ifdef LON_LOG_MMAP
+    {
+        struct stat st;
+        int fd = open(g->filename, O_RDONLY);
+        void *map;
+        if (fd < 0) return lonG_error(g, "can not open", LON_ERRFILE);
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < size) {
+            close(fd);
+            return lonG_error(g, "file shrunk", LON_ERRFILE);
+        }
+        map = st.st_size == 0 ? MAP_FAILED : mmap(NULL, (size_t)st.st_size,
+                PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map != MAP_FAILED) {
+            g->map = (const char*)map;
+            g->mapsize = (size_t)st.st_size;
+            g->mapped = 1;
+            return LON_OK;
+        }
+    }
+#endif
+    {
+        size_t bytes;
+        char *buff = lon_prepbuffsize(&g->readbuf, size);
+        if (buff == NULL || fseek(g->fp, 0, SEEK_SET) != 0)
+            return lonG_error(g, "can not read", LON_ERRFILE);
+        bytes = fread(buff, 1, size, g->fp);
+        if (bytes != size)
+            return lonG_error(g, "can not read", LON_ERRFILE);
+        g->readbuf.size = bytes;
+        g->map = buff;
+        g->mapsize = bytes;
+    }
+    return LON_OK;
+}
+
+static lon_LogRecord *lonG_record(lon_Log *g, const char *key, size_t len,
+                                  int create) {
+    const lon_Key *k = NULL;
+    unsigned hash = lon_hash(key, len);
+    if (create) {
+        size_t n = lon_buffsize(&g->index) / sizeof(lon_LogRecord);
+        if ((k = lon_intern(&g->keys, key, len, hash)) == NULL)
+            return NULL;
+        if (k->id >= n) {
+            lon_LogRecord r = { 0, 0 };
+            if (!lon_addlstring(&g->index, (const char*)&r, sizeof(r)))
+                return NULL;
+        }
+    }
+    else if (g->keys.size != 0) {
+        size_t h = hash & (g->keys.size - 1);
+        for (; (k = g->keys.slots[h]) != NULL; h = (h + 1) & (g->keys.size - 1))
+            if (k->hash == hash && k->len == len
+                    && memcmp(k->s, key, len) == 0)
+                break;
+    }
+    return k ? &lonG_records(g)[k->id] : NULL;
+}
+
+static void lonG_update(lon_Log *g, lon_LogRecord *r, size_t offset,
+                        size_t size) {
+    if (r->offset != 0) --g->live;
+    r->offset = size ? offset : 0;
+    r->size = size;
+    if (r->offset != 0) ++g->live;
+    ++g->records;
+}
+
+static int lonG_scan(lon_Log *g, size_t filesize) {
+    /* rebuild index from records, stop at the first bad one */
+    size_t off = sizeof(LON_LOG_MAGIC)-1;
+    int res;
+    if ((res = lonG_map(g, filesize)) != LON_OK)
+        return res;
+    if (memcmp(g->map, LON_LOG_MAGIC, sizeof(LON_LOG_MAGIC)-1) != 0)
+        return lonG_error(g, "not a record log", LON_ERR);
+    while (filesize - off >= LON_LOG_FRAME) {
+        const char *p = g->map + off;
+        size_t len = lonG_u32(p), vlen = lonG_u32(p + 4);
+        lon_LogRecord *r;
+        if (len > filesize - off - LON_LOG_FRAME
+                || vlen > filesize - off - LON_LOG_FRAME - len
+                || lonG_checksum(p + LON_LOG_FRAME, len,
+                    p + LON_LOG_FRAME + len, vlen) != lonG_u32(p + 8))
+            break;
+        if ((r = lonG_record(g, p + LON_LOG_FRAME, len, 1)) == NULL)
+            return lonG_error(g, "out of memory", LON_ERRMEM);
+        lonG_update(g, r, off + LON_LOG_FRAME + len, vlen);
+        off += LON_LOG_FRAME + len + vlen;
+    }
+    g->size = off;
+    return LON_OK;
+}
+
+LON_API int lon_log_open(lon_Log *g, const char *filename) {
+    size_t len = strlen(filename);
+    long filesize;
+    int res;
+    memset(g, 0, sizeof(*g));
+    lon_initintern(&g->keys);
+    lon_initbuffer(&g->index, NULL);
+    lon_initbuffer(&g->value, NULL);
+    lon_initbuffer(&g->key, NULL);
+    lon_initbuffer(&g->readbuf, NULL);
+    lon_initbuffer(&g->jobs, NULL);
+    lon_initbuffer(&g->tmpname, NULL);
+    lon_initdumper(&g->D);
+    if ((g->filename = (char*)malloc(len + 1)) == NULL)
+        return lonG_error(g, "out of memory", LON_ERRMEM);
+    memcpy(g->filename, filename, len + 1);
+    if ((g->fp = fopen(filename, "r+b")) == NULL) {
+        if ((g->fp = fopen(filename, "w+b")) == NULL
+                || fwrite(LON_LOG_MAGIC, 1, sizeof(LON_LOG_MAGIC)-1, g->fp)
+                    != sizeof(LON_LOG_MAGIC)-1)
+            return lonG_error(g, "can not create", LON_ERRFILE);
+    }
+    if (fseek(g->fp, 0, SEEK_END) != 0 || (filesize = ftell(g->fp)) < 0)
+        return lonG_error(g, "can not seek", LON_ERRFILE);
+    if ((size_t)filesize < sizeof(LON_LOG_MAGIC)-1)
+        return lonG_error(g, "not a record log", LON_ERR);
+    if ((res = lonG_scan(g, (size_t)filesize)) != LON_OK)
+        return res;
+    return LON_OK;
+}
+
+static void lonG_abort(lon_Log *g);
+
+LON_API void lon_log_close(lon_Log *g) {
+    lonG_abort(g);
+    lonG_unmap(g);
+    if (g->fp != NULL) fclose(g->fp);
+    free(g->filename);
+    lon_freeintern(&g->keys);
+    lon_freebuffer(&g->index);
+    lon_freebuffer(&g->value);
+    lon_freebuffer(&g->key);
+    lon_freebuffer(&g->readbuf);
+    lon_freebuffer(&g->jobs);
+    lon_freebuffer(&g->tmpname);
+    g->fp = NULL, g->filename = NULL;
+}
+
+LON_API const char *lon_log_error(lon_Log *g)
+{ return g->errmsg[0] ? g->errmsg : NULL; }
+
+LON_API const char *lon_log_find(lon_Log *g, const char *key, size_t len,
+                                 size_t *pvlen) {
+    lon_LogRecord *r = lonG_record(g, key, len, 0);
+    if (r == NULL || r->offset == 0
+            || lonG_map(g, r->offset + r->size) != LON_OK)
+        return NULL;
+    if (pvlen) *pvlen = r->size;
+    return g->map + r->offset;
+}
+
+LON_API int lon_log_get(lon_Log *g, lon_Loader *L, const char *key,
+                        size_t len) {
+    size_t vlen;
+    const char *value = lon_log_find(g, key, len, &vlen);
+    if (value == NULL) return LON_ERR;
+    return lon_load_buffer(L, value, vlen);
+}
+
+
+/* writing */
+
+static int lonG_append(lon_Log *g, FILE *fp, size_t *poffset,
+                       const char *key, size_t len,
+                       const char *value, size_t vlen) {
+    char frame[LON_LOG_FRAME];
+    if (len > 0xFFFFFFFFu || vlen > 0xFFFFFFFFu)
+        return lonG_error(g, "record too large", LON_ERR);
+    lonG_setu32(frame, (unsigned)len);
+    lonG_setu32(frame + 4, (unsigned)vlen);
+    lonG_setu32(frame + 8, lonG_checksum(key, len, value, vlen));
+    if (lon_fseek(fp, *poffset) != 0
+            || fwrite(frame, 1, LON_LOG_FRAME, fp) != LON_LOG_FRAME
+            || fwrite(key, 1, len, fp) != len
+            || (vlen != 0 && fwrite(value, 1, vlen, fp) != vlen))
+        return lonG_error(g, "write failed", LON_ERRFILE);
+    *poffset += LON_LOG_FRAME + len + vlen;
+    return LON_OK;
+}
+
+LON_API int lon_log_put(lon_Log *g, const char *key, size_t len,
+                        const char *value, size_t vlen) {
+    size_t offset = g->size;
+    lon_LogRecord *r;
+    int res;
+    if ((r = lonG_record(g, key, len, 1)) == NULL)
+        return lonG_error(g, "out of memory", LON_ERRMEM);
+    if ((res = lonG_append(g, g->fp, &g->size, key, len, value, vlen))
+            != LON_OK)
+        return res;
+    if (fflush(g->fp) != 0)
+        return lonG_error(g, "flush failed", LON_ERRFILE);
+    lonG_update(g, r, offset + LON_LOG_FRAME + len, vlen);
+    return LON_OK;
+}
+
+LON_API int lon_log_remove(lon_Log *g, const char *key, size_t len)
+{ return lon_log_put(g, key, len, NULL, 0); }
+
+LON_API lon_Dumper *lon_log_begin(lon_Log *g, const char *key, size_t len) {
+    /* dumper options set on g->D are kept */
+    lon_resetbuffer(&g->key);
+    lon_resetbuffer(&g->value);
+    if (!lon_addlstring(&g->key, key, len)) return NULL;
+    lon_setbuffer(&g->D, &g->value);
+    lon_dump_begin(&g->D);
+    return &g->D;
+}
+
+LON_API int lon_log_commit(lon_Log *g) {
+    lon_dump_end(&g->D);
+    return lon_log_put(g, lon_buffer(&g->key), lon_buffsize(&g->key),
+            lon_buffer(&g->value), lon_buffsize(&g->value));
+}
+
+/* compaction */
+
+typedef struct lonG_Job {
+    size_t id;               /* key id */
+    size_t from, size;       /* frame in the log */
+    size_t value, to;        /* value offset in the log and the new file */
+} lonG_Job;
+
+#ifndef _WIN32
+static int lonG_fsync(lon_Log *g, const char *path) {
+    /* fileno() is not C99, so sync through a descriptor of our own */
+    int res, fd = open(path, O_RDONLY);
+    if (fd < 0) return lonG_error(g, "can not sync", LON_ERRFILE);
+    res = fsync(fd);
+    close(fd);
+    return res == 0 ? LON_OK : lonG_error(g, "sync failed", LON_ERRFILE);
+}
+#endif
+
+static int lonG_sync(lon_Log *g, FILE *fp, const char *path) {
+    if (fflush(fp) != 0)
+        return lonG_error(g, "flush failed", LON_ERRFILE);
+#ifdef _WIN32
+    (void)path;
+    if (_commit(_fileno(fp)) != 0)
+        return lonG_error(g, "sync failed", LON_ERRFILE);
+    return LON_OK;
+#else
+    return lonG_fsync(g, path);
+#endif
+}
+
+static int lonG_syncdir(lon_Log *g) {
+    /* make the rename durable; directories can not be synced on Windows */
+#ifndef _WIN32
+    const char *slash = strrchr(g->filename, '/');
+    lon_Buffer dir;
+    int res;
+    if (slash == NULL) return lonG_fsync(g, ".");
+    lon_initbuffer(&dir, NULL);
+    lon_addlstring(&dir, g->filename,
+            slash == g->filename ? 1 : (size_t)(slash - g->filename));
+    if (!lon_addchar(&dir, '\0'))
+        return lonG_error(g, "out of memory", LON_ERRMEM);
+    res = lonG_fsync(g, lon_buffer(&dir));
+    lon_freebuffer(&dir);
+    return res;
+#else
+    (void)g;
+    return LON_OK;
+#endif
+}
+
+static void *lonG_copy(void *ud) {
+    /* runs beside the writer, so touches only the jobs and g->tmpfp */
+    lon_Log *g = (lon_Log*)ud;
+    const lonG_Job *jobs = (const lonG_Job*)lon_buffer(&g->jobs);
+    size_t i, n = lon_buffsize(&g->jobs) / sizeof(lonG_Job);
+    char buff[BUFSIZ];
+    FILE *fp = fopen(g->filename, "rb");
+    if (fp == NULL) {
+        g->compactres = LON_ERRFILE, g->compactmsg = "can not open";
+        return NULL;
+    }
+    for (i = 0; i < n && g->compactres == LON_OK; ++i) {
+        size_t size = jobs[i].size;
+        if (lon_fseek(fp, jobs[i].from) != 0)
+            g->compactres = LON_ERRFILE, g->compactmsg = "can not seek";
+        while (g->compactres == LON_OK && size != 0) {
+            size_t bytes = size < sizeof(buff) ? size : sizeof(buff);
+            if (fread(buff, 1, bytes, fp) != bytes)
+                g->compactres = LON_ERRFILE, g->compactmsg = "can not read";
+            else if (fwrite(buff, 1, bytes, g->tmpfp) != bytes)
+                g->compactres = LON_ERRFILE, g->compactmsg = "write failed";
+            size -= bytes;
+        }
+    }
+    fclose(fp);
+    return NULL;
+}
+
+static void lonG_abort(lon_Log *g) {
+    if (!g->compacting) return;
+#ifdef LON_LOG_THREAD
+    if (g->threaded) pthread_join(g->thread, NULL);
+    g->threaded = 0;
+#endif
+    fclose(g->tmpfp);
+    remove(lon_buffer(&g->tmpname));
+    g->tmpfp = NULL, g->compacting = 0;
+}
+
+static int lonG_start(lon_Log *g, int threaded) {
+    lon_LogRecord *records = lonG_records(g);
+    size_t i, n = lon_buffsize(&g->index) / sizeof(lon_LogRecord);
+    size_t offset = sizeof(LON_LOG_MAGIC)-1;
+    if (g->compacting)
+        return lonG_error(g, "compaction running", LON_ERR);
+    lon_resetbuffer(&g->jobs);
+    for (i = 0; i < n; ++i) {
+        /* live records keep their order */
+        const lon_Key *k = lon_getkey(&g->keys, (unsigned)i);
+        lonG_Job job;
+        if (records[i].offset == 0) continue;
+        job.id = i;
+        job.value = records[i].offset;
+        job.from = job.value - LON_LOG_FRAME - k->len;
+        job.size = LON_LOG_FRAME + k->len + records[i].size;
+        job.to = offset + LON_LOG_FRAME + k->len;
+        offset += job.size;
+        if (!lon_addlstring(&g->jobs, (const char*)&job, sizeof(job)))
+            return lonG_error(g, "out of memory", LON_ERRMEM);
+    }
+    /* a name of our own, others may be compacting the same log */
+    if (lon_tmpfile(&g->tmpname, g->filename) != LON_OK)
+        return lonG_error(g, "can not create", LON_ERRFILE);
+    if ((g->tmpfp = fopen(lon_buffer(&g->tmpname), "w+b")) == NULL) {
+        remove(lon_buffer(&g->tmpname));
+        return lonG_error(g, "can not create", LON_ERRFILE);
+    }
+    g->compacting = 1;
+    g->compactfrom = g->size;
+    g->compactsize = offset;
+    g->compactrecords = g->records;
+    g->compactres = LON_OK, g->compactmsg = NULL;
+    if (fwrite(LON_LOG_MAGIC, 1, sizeof(LON_LOG_MAGIC)-1, g->tmpfp)
+            != sizeof(LON_LOG_MAGIC)-1) {
+        lonG_abort(g);
+        return lonG_error(g, "write failed", LON_ERRFILE);
+    }
+#ifdef LON_LOG_THREAD
+    if (threaded && pthread_create(&g->thread, NULL, lonG_copy, g) == 0) {
+        g->threaded = 1;
+        return LON_OK;
+    }
+#endif
+    (void)threaded;
+    lonG_copy(g);
+    return LON_OK;
+}
+
+LON_API int lon_log_compact_start(lon_Log *g)
+{ return lonG_start(g, 1); }
+
+LON_API int lon_log_compact_finish(lon_Log *g) {
+    lon_LogRecord *records = lonG_records(g);
+    const lonG_Job *jobs = (const lonG_Job*)lon_buffer(&g->jobs);
+    size_t i, n = lon_buffsize(&g->index) / sizeof(lon_LogRecord);
+    size_t njobs = lon_buffsize(&g->jobs) / sizeof(lonG_Job);
+    size_t tail = g->size - g->compactfrom;
+    int res;
+    if (!g->compacting)
+        return lonG_error(g, "no compaction running", LON_ERR);
+#ifdef LON_LOG_THREAD
+    if (g->threaded) pthread_join(g->thread, NULL);
+    g->threaded = 0;
+#endif
+    if (g->compactres != LON_OK)
+        res = lonG_error(g, g->compactmsg, g->compactres);
+    else if ((res = lonG_map(g, g->size)) == LON_OK && tail != 0
+            && fwrite(g->map + g->compactfrom, 1, tail, g->tmpfp) != tail)
+        res = lonG_error(g, "write failed", LON_ERRFILE);
+    if (res == LON_OK)
+        res = lonG_sync(g, g->tmpfp, lon_buffer(&g->tmpname));
+    if (res != LON_OK) {
+        lonG_abort(g);
+        return res;
+    }
+    fclose(g->tmpfp);
+    g->tmpfp = NULL, g->compacting = 0;
+    lonG_unmap(g);
+    fclose(g->fp);
+    g->fp = NULL;
+    if (lon_replacefile(lon_buffer(&g->tmpname), g->filename) != LON_OK) {
+        remove(lon_buffer(&g->tmpname)); /* the log is still in place */
+        res = lonG_error(g, "can not rename", LON_ERRFILE);
+    }
+    if ((g->fp = fopen(g->filename, "r+b")) == NULL)
+        return lonG_error(g, "can not open", LON_ERRFILE);
+    if (res != LON_OK) return res;
+    /* copied values moved to their job's place, later ones by the
+     * space compaction saved */
+    for (i = 0; i < njobs; ++i)
+        if (records[jobs[i].id].offset == jobs[i].value)
+            records[jobs[i].id].offset = jobs[i].to;
+    for (i = 0; i < n; ++i)
+        if (records[i].offset >= g->compactfrom)
+            records[i].offset -= g->compactfrom - g->compactsize;
+    g->size = g->compactsize + tail;
+    g->records = njobs + g->records - g->compactrecords;
+    return lonG_syncdir(g);
+}
+
+LON_API int lon_log_compact(lon_Log *g) {
+    int res = lonG_start(g, 0);
+    return res != LON_OK ? res : lon_log_compact_finish(g);
+}
+
+LON_NS_END
+
+#endif /* LON_IMPLEMENTATION */
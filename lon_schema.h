@@ -0,0 +1,521 @@
+/* lon_schema: decode/encode lon data directly from/to C structs
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_schema_h
+#define lon_schema_h
+
+
+#include "lon.h"
+
+LON_NS_BEGIN
+
+#define LON_SCHEMA_SLOTS 256 /* maximum perfect hash size */
+
+#define LON_FT_BOOL   1  /* bool/char/int... */
+#define LON_FT_INT    2  /* signed integer of 1, 2, 4 or 8 bytes */
+#define LON_FT_FLOAT  3  /* float or double */
+#define LON_FT_STRING 4  /* inline char[N], zero terminated */
+#define LON_FT_STRUCT 5  /* nested struct described by a schema */
+
+typedef struct lon_Field  lon_Field;
+typedef struct lon_Schema lon_Schema;
+typedef struct lon_SchemaDecoder lon_SchemaDecoder;
+
+#define lon_fieldsize(T,m)  sizeof(((T*)0)->m)
+#define lon_fieldcount(T,m) (sizeof(((T*)0)->m)/sizeof(((T*)0)->m[0]))
+
+#define LON_FIELD(T,m,type) \
+    { #m, type, offsetof(T,m), lon_fieldsize(T,m), 0, 0, 0, NULL }
+#define LON_FIELD_STRUCT(T,m,S) \
+    { #m, LON_FT_STRUCT, offsetof(T,m), lon_fieldsize(T,m), 0, 0, 0, &(S) }
+#define LON_FIELD_ARRAY(T,m,type,n) \
+    { #m, type, offsetof(T,m), lon_fieldsize(T,m[0]), lon_fieldcount(T,m), \
+      offsetof(T,n), lon_fieldsize(T,n), NULL }
+#define LON_FIELD_STRUCTARRAY(T,m,S,n) \
+    { #m, LON_FT_STRUCT, offsetof(T,m), lon_fieldsize(T,m[0]), \
+      lon_fieldcount(T,m), offsetof(T,n), lon_fieldsize(T,n), &(S) }
+
+#define LON_SCHEMA(T,fields) \
+    { #T, (fields), sizeof(fields)/sizeof((fields)[0]), 0, 0, { 0 } }
+
+LON_API int  lon_schema_init (lon_Schema *S);
+LON_API const lon_Field *lon_schema_field (lon_Schema *S,
+                                           const char *s, size_t len);
+
+LON_API void lon_initschemadecoder (lon_SchemaDecoder *SD,
+                                    lon_Schema *S, void *out);
+LON_API const char *lon_schema_error (lon_SchemaDecoder *SD);
+
+LON_API int lon_dump_struct (lon_Dumper *D, lon_Schema *S, const void *p);
+
+
+/* structs */
+
+struct lon_Field {
+    const char *name;
+    int type;
+    size_t offset;       /* offset of member in struct */
+    size_t size;         /* size of member (of one element for arrays) */
+    size_t count;        /* capacity of array, 0 for scalar */
+    size_t count_offset; /* offset of array length member */
+    size_t count_size;   /* size of array length member */
+    lon_Schema *schema;  /* schema of LON_FT_STRUCT */
+};
+
+struct lon_Schema {
+    const char *name;
+    const lon_Field *fields;
+    size_t nfields;
+
+    /* perfect hash of field names, built by lon_schema_init() */
+    unsigned seed;
+    unsigned mask;
+    unsigned char slots[LON_SCHEMA_SLOTS]; /* field index + 1 */
+};
+
+struct lon_SchemaDecoder {
+    lon_Callbacks cb;
+    lon_Schema *schema;
+    void *out;
+
+    int levels;   /* decoded table levels */
+    int skip;     /* levels of ignored subtree */
+    struct {
+        lon_Schema *schema;    /* schema of struct */
+        const lon_Field *field;/* current field, or array field */
+        char *base;            /* struct or array address */
+        size_t index;          /* current array element + 1 */
+        size_t count;          /* largest array index seen */
+    } stack[LON_MAX_LEVEL];
+    char errmsg[128];
+};
+
+
+LON_NS_END
+
+#endif /* lon_schema_h */
+
+
+#if defined(LON_IMPLEMENTATION) && !defined(lon_schema_implemented)
+#define lon_schema_implemented
+
+
+#include <stdio.h>
+#include <string.h>
+
+
+LON_NS_BEGIN
+
+
+/* perfect hash */
+
+static unsigned lonS_hash(unsigned seed, unsigned h) {
+    /* reseed lon_hash(), so keys hashed by the lexer can be reused */
+    h = (h ^ seed * 0x9E3779B9u) * 0x85EBCA6Bu;
+    return h ^ (h >> 15);
+}
+
+static int lonS_trymask(lon_Schema *S, unsigned mask) {
+    unsigned seed;
+    for (seed = 0; seed < 1024; ++seed) {
+        size_t i;
+        memset(S->slots, 0, sizeof(S->slots));
+        for (i = 0; i < S->nfields; ++i) {
+            const char *name = S->fields[i].name;
+            unsigned h = lonS_hash(seed, lon_hash(name, strlen(name))) & mask;
+            if (S->slots[h] != 0) break;
+            S->slots[h] = (unsigned char)(i + 1);
+        }
+        if (i == S->nfields) {
+            S->seed = seed;
+            S->mask = mask;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+LON_API int lon_schema_init(lon_Schema *S) {
+    unsigned mask = 1;
+    size_t i;
+    if (S->mask != 0) return 1;
+    if (S->nfields >= LON_SCHEMA_SLOTS/2) return 0;
+    while (mask + 1 < S->nfields*2) mask = mask*2 + 1;
+    for (; mask < LON_SCHEMA_SLOTS; mask = mask*2 + 1)
+        if (lonS_trymask(S, mask)) break;
+    if (mask >= LON_SCHEMA_SLOTS) return 0;
+    for (i = 0; i < S->nfields; ++i) {
+        lon_Schema *sub = S->fields[i].schema;
+        if (sub && sub != S && !lon_schema_init(sub))
+            return 0;
+    }
+    return 1;
+}
+
+static const lon_Field *lonS_field(lon_Schema *S, const char *s, size_t len,
+                                   unsigned hash) {
+    unsigned idx = S->slots[lonS_hash(S->seed, hash) & S->mask];
+    const lon_Field *f;
+    if (idx == 0) return NULL;
+    f = &S->fields[idx - 1];
+    if (strlen(f->name) != len || memcmp(f->name, s, len) != 0)
+        return NULL;  /* keys may hold '\0', so compare lengths first */
+    return f;
+}
+
+LON_API const lon_Field *lon_schema_field(lon_Schema *S,
+                                          const char *s, size_t len)
+{ return lonS_field(S, s, len, lon_hash(s, len)); }
+
+
+/* decoder */
+
+#define lonS_top(SD) (&(SD)->stack[(SD)->levels-1])
+
+static void lonS_error(lon_SchemaDecoder *SD, const char *msg) {
+    lon_Loader *L = SD->cb.loader;
+    const lon_Field *f = SD->levels ? lonS_top(SD)->field : NULL;
+    snprintf(SD->errmsg, sizeof(SD->errmsg), "%s:%d: %s%s%s%s",
+            (L->name ? L->name : "[=loader]"), L->line+1, msg,
+            f ? " (field '" : "", f ? f->name : "", f ? "')" : "");
+    lon_break(L, LON_ERR);
+}
+
+static lon_Integer lonS_getint(const char *p, size_t size) {
+    switch (size) {
+    case 1: return *(const signed char*)p;
+    case 2: return *(const short*)p;
+    case 4: return *(const int*)p;
+    default: return (lon_Integer)*(const long long*)p;
+    }
+}
+
+static void lonS_setint(lon_SchemaDecoder *SD, char *p, size_t size,
+                        lon_Integer v) {
+    switch (size) {
+    case 1: if (v != (signed char)v) break;
+            *(signed char*)p = (signed char)v; return;
+    case 2: if (v != (short)v) break;
+            *(short*)p = (short)v; return;
+    case 4: if (v != (int)v) break;
+            *(int*)p = (int)v; return;
+    case 8: *(long long*)p = (long long)v; return;
+    }
+    lonS_error(SD, "integer out of range");
+}
+
+static void lonS_setnumber(char *p, size_t size, lon_Number v) {
+    if (size == sizeof(float))
+        *(float*)p = (float)v;
+    else
+        *(double*)p = (double)v;
+}
+
+static int lonS_current(lon_SchemaDecoder *SD) {
+    /* true if current event belongs to the decoded table */
+    return !SD->skip && SD->levels != 0
+        && SD->cb.loader->levels == SD->levels;
+}
+
+static void lonS_ignore(lon_SchemaDecoder *SD) {
+    /* ignore value of current field */
+    if (lonS_top(SD)->schema != NULL)
+        lonS_top(SD)->field = NULL;
+    else
+        lonS_top(SD)->index = 0;
+}
+
+static char *lonS_slot(lon_SchemaDecoder *SD, int type) {
+    /* address of the value to store, or NULL to ignore it */
+    const lon_Field *f;
+    char *p;
+    if (!lonS_current(SD)) return NULL;
+    if (lon_status(SD->cb.loader) != LON_STATUS_VALUE) {
+        lonS_ignore(SD); /* unsupported type of key */
+        return NULL;
+    }
+    if ((f = lonS_top(SD)->field) == NULL) return NULL;
+    p = lonS_top(SD)->base;
+    if (lonS_top(SD)->schema != NULL) {
+        if (f->count != 0 || f->type == LON_FT_STRUCT)
+            lonS_error(SD, "table expected");
+        p += f->offset;
+    }
+    else if (lonS_top(SD)->index == 0)
+        return NULL;
+    else /* array element */
+        p += (lonS_top(SD)->index - 1) * f->size;
+    if (f->type != type && !(type == LON_FT_INT && f->type == LON_FT_FLOAT))
+        lonS_error(SD, f->type == LON_FT_STRUCT ?
+                "table expected" : "type mismatch");
+    return p;
+}
+
+static void lonS_onboolean(lon_Callbacks *cb, int value) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    char *p = lonS_slot(SD, LON_FT_BOOL);
+    if (p) lonS_setint(SD, p, lonS_top(SD)->field->size, value);
+}
+
+static void lonS_onnumber(lon_Callbacks *cb, lon_Number value) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    char *p = lonS_slot(SD, LON_FT_FLOAT);
+    if (p) lonS_setnumber(p, lonS_top(SD)->field->size, value);
+}
+
+static void lonS_oninteger(lon_Callbacks *cb, lon_Integer value) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    char *p;
+    if (lonS_current(SD) && lon_status(cb->loader) == LON_STATUS_KEY) {
+        const lon_Field *f = lonS_top(SD)->field;
+        if (lonS_top(SD)->schema != NULL)
+            lonS_top(SD)->field = NULL; /* unknown field of struct */
+        else if (value < 1 || (size_t)value > f->count)
+            lonS_error(SD, "array index out of range");
+        else {
+            lonS_top(SD)->index = (size_t)value;
+            if (lonS_top(SD)->count < (size_t)value)
+                lonS_top(SD)->count = (size_t)value;
+        }
+        return;
+    }
+    if ((p = lonS_slot(SD, LON_FT_INT)) == NULL) return;
+    if (lonS_top(SD)->field->type == LON_FT_FLOAT)
+        lonS_onnumber(cb, (lon_Number)value);
+    else
+        lonS_setint(SD, p, lonS_top(SD)->field->size, value);
+}
+
+static void lonS_onkey(lon_Callbacks *cb, const char *s, size_t len,
+                       unsigned hash) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    if (!lonS_current(SD)) return;
+    if (lonS_top(SD)->schema == NULL)
+        lonS_top(SD)->index = 0;
+    else
+        lonS_top(SD)->field =
+            lonS_field(lonS_top(SD)->schema, s, len, hash);
+}
+
+static void lonS_onstring(lon_Callbacks *cb, const char *s, size_t len) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    char *p;
+    if ((p = lonS_slot(SD, LON_FT_STRING)) == NULL) return;
+    if (len >= lonS_top(SD)->field->size)
+        lonS_error(SD, "string too long");
+    memcpy(p, s, len);
+    p[len] = '\0';
+}
+
+static char *lonS_run(lon_SchemaDecoder *SD, lon_Integer first, size_t n,
+                      int type) {
+    /* address of the elements of a numeral run, or NULL to ignore it */
+    const lon_Field *f;
+    size_t last = (size_t)first - 1 + n;
+    if (!lonS_current(SD) || lonS_top(SD)->schema != NULL)
+        return NULL; /* positional fields of a struct are unknown ones */
+    f = lonS_top(SD)->field;
+    if (first < 1 || last > f->count)
+        lonS_error(SD, "array index out of range");
+    if (f->type != type && !(type == LON_FT_INT && f->type == LON_FT_FLOAT))
+        lonS_error(SD, f->type == LON_FT_STRUCT ?
+                "table expected" : "type mismatch");
+    lonS_top(SD)->index = last;
+    if (lonS_top(SD)->count < last)
+        lonS_top(SD)->count = last;
+    return lonS_top(SD)->base + ((size_t)first - 1) * f->size;
+}
+
+static void lonS_onintegerarray(lon_Callbacks *cb, lon_Integer index,
+                                const lon_Integer *v, size_t n) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    const lon_Field *f;
+    size_t i;
+    char *p = lonS_run(SD, index, n, LON_FT_INT);
+    if (p == NULL) return;
+    f = lonS_top(SD)->field;
+    if (f->type == LON_FT_FLOAT)
+        for (i = 0; i < n; ++i, p += f->size)
+            lonS_setnumber(p, f->size, (lon_Number)v[i]);
+    else if (f->size == sizeof(lon_Integer))
+        memcpy(p, v, n * sizeof(lon_Integer));
+    else
+        for (i = 0; i < n; ++i, p += f->size)
+            lonS_setint(SD, p, f->size, v[i]);
+}
+
+static void lonS_onnumberarray(lon_Callbacks *cb, lon_Integer index,
+                               const lon_Number *v, size_t n) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    const lon_Field *f;
+    size_t i;
+    char *p = lonS_run(SD, index, n, LON_FT_FLOAT);
+    if (p == NULL) return;
+    f = lonS_top(SD)->field;
+    if (f->size == sizeof(lon_Number))
+        memcpy(p, v, n * sizeof(lon_Number));
+    else
+        for (i = 0; i < n; ++i, p += f->size)
+            lonS_setnumber(p, f->size, v[i]);
+}
+
+static void lonS_push(lon_SchemaDecoder *SD, lon_Schema *S,
+                      const lon_Field *f, char *base) {
+    ++SD->levels;
+    lonS_top(SD)->schema = S;
+    lonS_top(SD)->field = f;
+    lonS_top(SD)->base = base;
+    lonS_top(SD)->index = 0;
+    lonS_top(SD)->count = 0;
+}
+
+static void lonS_ontablebegin(lon_Callbacks *cb) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    lon_Loader *L = cb->loader;
+    const lon_Field *f;
+    char *base;
+    if (SD->skip || L->levels != SD->levels + 1)
+        goto skip;
+    if (SD->levels == 0) {
+        /* only decode the first top-level table */
+        if (lon_status(L) != LON_STATUS_TOP || SD->schema == NULL)
+            goto skip;
+        lonS_push(SD, SD->schema, NULL, (char*)SD->out);
+        SD->schema = NULL;
+        return;
+    }
+    if (lon_status(L) != LON_STATUS_VALUE) {
+        lonS_ignore(SD);
+        goto skip;
+    }
+    if ((f = lonS_top(SD)->field) == NULL)
+        goto skip;
+    base = lonS_top(SD)->base;
+    if (lonS_top(SD)->schema != NULL) {
+        base += f->offset;
+        if (f->count != 0) {
+            lonS_push(SD, NULL, f, base);
+            return;
+        }
+    }
+    else if (lonS_top(SD)->index == 0)
+        goto skip;
+    else /* struct element of array */
+        base += (lonS_top(SD)->index - 1) * f->size;
+    if (f->type != LON_FT_STRUCT)
+        lonS_error(SD, "type mismatch");
+    lonS_push(SD, f->schema, NULL, base);
+    return;
+skip:
+    ++SD->skip;
+}
+
+static void lonS_ontableend(lon_Callbacks *cb) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    if (SD->skip) {
+        --SD->skip;
+        return;
+    }
+    if (lonS_top(SD)->schema == NULL) {
+        /* array length is the largest index seen */
+        const lon_Field *f = lonS_top(SD)->field;
+        lonS_setint(SD, lonS_top(SD)->base - f->offset + f->count_offset,
+                f->count_size, (lon_Integer)lonS_top(SD)->count);
+    }
+    --SD->levels;
+}
+
+static void lonS_onerror(lon_Callbacks *cb, const char *errmsg) {
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    snprintf(SD->errmsg, sizeof(SD->errmsg), "%s", errmsg);
+}
+
+static void lonS_onnil(lon_Callbacks *cb) {
+    /* nil value leaves the member untouched */
+    lon_SchemaDecoder *SD = (lon_SchemaDecoder*)cb;
+    if (lonS_current(SD) && lon_status(cb->loader) != LON_STATUS_VALUE)
+        lonS_ignore(SD);
+}
+
+LON_API void lon_initschemadecoder(lon_SchemaDecoder *SD,
+                                   lon_Schema *S, void *out) {
+    memset(SD, 0, sizeof(*SD));
+    SD->schema = S;
+    SD->out = out;
+    SD->cb.on_error       = lonS_onerror;
+    SD->cb.on_nil         = lonS_onnil;
+    SD->cb.on_boolean     = lonS_onboolean;
+    SD->cb.on_integer     = lonS_oninteger;
+    SD->cb.on_number      = lonS_onnumber;
+    SD->cb.on_string      = lonS_onstring;
+    SD->cb.on_key         = lonS_onkey;
+    SD->cb.on_table_begin = lonS_ontablebegin;
+    SD->cb.on_table_end   = lonS_ontableend;
+    SD->cb.on_integer_array = lonS_onintegerarray;
+    SD->cb.on_number_array  = lonS_onnumberarray;
+    if (!lon_schema_init(S)) {
+        snprintf(SD->errmsg, sizeof(SD->errmsg),
+                "can not build field index for '%s'", S->name);
+        SD->schema = NULL;
+    }
+}
+
+LON_API const char *lon_schema_error(lon_SchemaDecoder *SD)
+{ return SD->errmsg[0] ? SD->errmsg : NULL; }
+
+
+/* encoder */
+
+static void lonS_dumpvalue(lon_Dumper *D, const lon_Field *f, const char *p) {
+    switch (f->type) {
+    case LON_FT_BOOL:
+        lon_dump_boolean(D, lonS_getint(p, f->size) != 0);
+        break;
+    case LON_FT_INT:
+        lon_dump_integer(D, lonS_getint(p, f->size));
+        break;
+    case LON_FT_FLOAT:
+        lon_dump_number(D, f->size == sizeof(float) ?
+                (lon_Number)*(const float*)p :
+                (lon_Number)*(const double*)p);
+        break;
+    case LON_FT_STRING:
+        {
+            const char *e = (const char*)memchr(p, '\0', f->size);
+            lon_dump_buffer(D, p, e ? (size_t)(e - p) : f->size);
+        }
+        break;
+    case LON_FT_STRUCT:
+        lon_dump_struct(D, f->schema, p);
+        break;
+    }
+}
+
+LON_API int lon_dump_struct(lon_Dumper *D, lon_Schema *S, const void *p) {
+    size_t i, j, n;
+    if (!lon_dump_table_begin(D)) return 0;
+    for (i = 0; i < S->nfields; ++i) {
+        const lon_Field *f = &S->fields[i];
+        const char *fp = (const char*)p + f->offset;
+        lon_dump_string(D, f->name);
+        if (f->count == 0) {
+            lonS_dumpvalue(D, f, fp);
+            continue;
+        }
+        n = (size_t)lonS_getint((const char*)p + f->count_offset,
+                f->count_size);
+        if (n > f->count) n = f->count;
+        lon_dump_table_begin(D);
+        for (j = 0; j < n; ++j) {
+            lon_dump_integer(D, (lon_Integer)(j + 1));
+            lonS_dumpvalue(D, f, fp + j*f->size);
+        }
+        lon_dump_table_end(D);
+    }
+    return lon_dump_table_end(D);
+}
+
+
+LON_NS_END
+
+#endif /* LON_IMPLEMENTATION */
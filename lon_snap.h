@@ -0,0 +1,623 @@
+/* lon_snap: position independent snapshots of loaded documents
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_snap_h
+#define lon_snap_h
+
+
+#include "lon_dom.h"
+
+LON_NS_BEGIN
+
+#define LON_SNAP_MAGIC   "LONSNAP"
+#define LON_SNAP_VERSION 1
+
+/* values use the LON_DT_* types, keys are stored as LON_DT_STRING */
+
+typedef struct lon_SnapHeader lon_SnapHeader;
+typedef struct lon_SnapValue  lon_SnapValue;
+typedef struct lon_SnapTable  lon_SnapTable;
+typedef struct lon_Snap       lon_Snap;
+
+#define lon_snap_array(t)  ((const lon_SnapValue*)((t) + 1))
+#define lon_snap_fields(t) (lon_snap_array(t) + (t)->narray) /* key, value */
+
+LON_API int lon_snap_write (lon_Dom *d, lon_Buffer *out,
+                            unsigned long long srcsize, long long srcmtime);
+
+LON_API int  lon_snap_open  (lon_Snap *s, const void *data, size_t size);
+LON_API int  lon_snap_load  (lon_Snap *s, const char *snapfile,
+                             const char *srcfile);
+LON_API void lon_snap_close (lon_Snap *s);
+
+LON_API const char *lon_snap_error (lon_Snap *s);
+
+LON_API const lon_SnapValue *lon_snap_values (const lon_Snap *s, size_t *pn);
+
+LON_API const lon_SnapTable *lon_snap_totable (const lon_Snap *s,
+                                               const lon_SnapValue *v);
+LON_API const char *lon_snap_tostring (const lon_Snap *s,
+                                       const lon_SnapValue *v, size_t *plen);
+
+LON_API const lon_SnapValue *lon_snap_getfield (const lon_Snap *s,
+        const lon_SnapTable *t, const char *str, size_t len);
+LON_API const lon_SnapValue *lon_snap_getindex (const lon_Snap *s,
+        const lon_SnapTable *t, lon_Integer i);
+
+
+/* structs */
+
+/* the image is native endian, 8 byte aligned, and refers to its parts
+ * by offsets from the image start, so it can be used where it is
+ * mapped */
+
+struct lon_SnapHeader {
+    char magic[8];               /* LON_SNAP_MAGIC */
+    unsigned version;            /* LON_SNAP_VERSION */
+    unsigned byteorder;          /* 0x01020304 as written */
+    unsigned long long checksum; /* of everything after the header */
+    unsigned long long size;     /* whole image */
+    unsigned long long srcsize;  /* source the image was built from */
+    long long srcmtime;
+    unsigned long long values;   /* offset of top-level values */
+    unsigned long long nvalues;
+};
+
+struct lon_SnapValue {
+    unsigned type;               /* LON_DT_* */
+    unsigned hash;               /* lon_hash() of strings */
+    union {
+        long long i;             /* integer, or boolean */
+        double n;
+        unsigned long long off;  /* string or table */
+    } u;
+};
+
+struct lon_SnapTable {
+    unsigned long long narray;
+    unsigned long long nfields;
+    unsigned mask;               /* index slots - 1, 0 if not indexed */
+    unsigned reserved;
+    /* followed by narray values, nfields key/value pairs, and the
+     * index slots of field index + 1 */
+};
+
+struct lon_Snap {
+    const char *base;
+    size_t size;
+    void *map;                   /* owned memory, if any */
+    size_t mapsize;
+    int mapped;                  /* map is mmap()ed rather than malloc()ed */
+    char errmsg[128];
+};
+
+
+LON_NS_END
+
+#endif /* lon_snap_h */
+
+
+#if defined(LON_IMPLEMENTATION) && !defined(lon_snap_implemented)
+#define lon_snap_implemented
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32) && !defined(LON_SNAP_NO_MMAP)
+# define LON_SNAP_MMAP
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+
+LON_NS_BEGIN
+
+
+#define LON_SNAP_BYTEORDER 0x01020304u
+
+#define lonM_align(n) (((n) + 7) & ~(size_t)7)
+
+static unsigned long long lonM_checksum(const char *p, size_t n) {
+    unsigned long long h = 0xCBF29CE484222325ull, w;
+    for (; n >= sizeof(w); p += sizeof(w), n -= sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        h = (h ^ w) * 0x100000001B3ull;
+        h ^= h >> 32;
+    }
+    if (n != 0) { /* tail, tagged with its length */
+        w = (unsigned long long)n << 56;
+        memcpy(&w, p, n);
+        h = (h ^ w) * 0x100000001B3ull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+static unsigned lonM_keyhash(const lon_SnapValue *k)
+{ return k->type == LON_DT_STRING ? k->hash : lonO_mix(k->type, k->u.off); }
+
+
+/* writer */
+
+typedef struct lonM_Slot {
+    const void *p;               /* table, or NULL for strings */
+    unsigned hash;
+    unsigned long long off;
+} lonM_Slot;
+
+typedef struct lonM_Builder {
+    lon_Buffer *out;
+    lonM_Slot *slots;            /* tables and strings already written */
+    size_t nslots, count;
+    jmp_buf jbuf;
+} lonM_Builder;
+
+static size_t lonM_reserve(lonM_Builder *b, size_t size) {
+    size_t off = lon_buffsize(b->out);
+    size = lonM_align(size);
+    memset(lon_prepbuffsize(b->out, size), 0, size);
+    b->out->size += size;
+    return off;
+}
+
+static lonM_Slot *lonM_find(lonM_Builder *b, const void *p, unsigned hash,
+                            const char *s, size_t len) {
+    size_t i, mask = b->nslots - 1;
+    if (b->count*2 >= b->nslots) {
+        size_t newsize = b->nslots ? b->nslots*2 : 1024;
+        lonM_Slot *slots = (lonM_Slot*)calloc(newsize, sizeof(lonM_Slot));
+        if (slots == NULL) longjmp(b->jbuf, LON_ERRMEM);
+        for (i = 0; i < b->nslots; ++i) {
+            size_t h = b->slots[i].hash & (newsize - 1);
+            if (b->slots[i].off == 0) continue;
+            while (slots[h].off != 0) h = (h + 1) & (newsize - 1);
+            slots[h] = b->slots[i];
+        }
+        free(b->slots);
+        b->slots = slots;
+        b->nslots = newsize;
+        mask = newsize - 1;
+    }
+    for (i = hash & mask; b->slots[i].off != 0; i = (i + 1) & mask) {
+        lonM_Slot *slot = &b->slots[i];
+        const char *o = lon_buffer(b->out) + slot->off;
+        if (slot->hash == hash && slot->p == p && (p != NULL
+                    || (*(unsigned long long*)o == len
+                        && memcmp(o + sizeof(unsigned long long), s, len) == 0)))
+            return slot;
+    }
+    b->slots[i].p = p;
+    b->slots[i].hash = hash;
+    return &b->slots[i]; /* new slot, 'off' set by caller */
+}
+
+static unsigned long long lonM_string(lonM_Builder *b, const char *s,
+                                      size_t len, unsigned hash) {
+    lonM_Slot *slot = lonM_find(b, NULL, hash, s, len);
+    if (slot->off == 0) {
+        unsigned long long n = len;
+        size_t off = lonM_reserve(b, sizeof(n) + len + 1);
+        char *p = lon_buffer(b->out) + off;
+        memcpy(p, &n, sizeof(n));
+        memcpy(p + sizeof(n), s, len);
+        slot->off = off, ++b->count;
+    }
+    return slot->off;
+}
+
+static unsigned long long lonM_table(lonM_Builder *b, const lon_Table *t);
+
+static void lonM_value(lonM_Builder *b, lon_SnapValue *v, const lon_Value *o) {
+    const char *s;
+    size_t len;
+    memset(v, 0, sizeof(*v));
+    v->type = o->type;
+    switch (o->type) {
+    case LON_DT_BOOLEAN: v->u.i = o->u.b; break;
+    case LON_DT_INTEGER: v->u.i = o->u.i; break;
+    case LON_DT_NUMBER:  v->u.n = o->u.n; break;
+    case LON_DT_STRING:
+    case LON_DT_KEY:
+        s = lon_dom_tostring(o, &len);
+        v->type = LON_DT_STRING;
+        v->hash = o->type == LON_DT_KEY ? o->u.key->hash : lon_hash(s, len);
+        v->u.off = lonM_string(b, s, len, v->hash);
+        break;
+    case LON_DT_TABLE: v->u.off = lonM_table(b, o->u.t); break;
+    }
+}
+
+static unsigned long long lonM_table(lonM_Builder *b, const lon_Table *t) {
+    /* tables shared by the DOM are written once */
+    lonM_Slot *slot = lonM_find(b, t, lonO_mix(0, (size_t)t), NULL, 0);
+    size_t i, off, n = t->narray + t->nfields*2;
+    unsigned mask = 0, *index;
+    lon_SnapTable *st;
+    lon_SnapValue v;
+    if (slot->off != 0) return slot->off;
+    if (t->nfields >= LON_DOM_MININDEX) {
+        mask = LON_DOM_MININDEX*2 - 1;
+        while (mask < t->nfields*2 - 1) mask = mask*2 + 1;
+    }
+    off = lonM_reserve(b, sizeof(lon_SnapTable) + n*sizeof(lon_SnapValue)
+            + (mask ? (mask + 1)*sizeof(unsigned) : 0));
+    slot->off = off, ++b->count;
+    for (i = 0; i < n; ++i) {
+        /* children are written after the table, which may move 'out' */
+        const lon_Value *o = i < t->narray ? &t->array[i] :
+            (i - t->narray) & 1 ? &t->fields[(i - t->narray)/2].value :
+            &t->fields[(i - t->narray)/2].key;
+        lonM_value(b, &v, o);
+        memcpy(lon_buffer(b->out) + off + sizeof(lon_SnapTable)
+                + i*sizeof(lon_SnapValue), &v, sizeof(v));
+    }
+    st = (lon_SnapTable*)(lon_buffer(b->out) + off);
+    st->narray = t->narray;
+    st->nfields = t->nfields;
+    st->mask = mask;
+    if (mask == 0) return off;
+    index = (unsigned*)(lon_snap_fields(st) + t->nfields*2);
+    for (i = 0; i < t->nfields; ++i) {
+        /* equal keys were written to the same string, the last one wins */
+        const lon_SnapValue *k = &lon_snap_fields(st)[i*2];
+        unsigned h = lonM_keyhash(k) & mask;
+        while (index[h] != 0) {
+            const lon_SnapValue *o = &lon_snap_fields(st)[(index[h]-1)*2];
+            if (o->type == k->type && o->u.off == k->u.off) break;
+            h = (h + 1) & mask;
+        }
+        index[h] = (unsigned)i + 1;
+    }
+    return off;
+}
+
+LON_API int lon_snap_write(lon_Dom *d, lon_Buffer *out,
+                           unsigned long long srcsize, long long srcmtime) {
+    /* replaces the contents of 'out' with an image of the last load */
+    lonM_Builder b;
+    lon_SnapHeader *h;
+    jmp_buf *jbuf = out->jbuf;
+    size_t i, values;
+    int res;
+    memset(&b, 0, sizeof(b));
+    b.out = out;
+    out->jbuf = &b.jbuf;
+    lon_resetbuffer(out);
+    if ((res = setjmp(b.jbuf)) == 0) {
+        lon_SnapValue v;
+        lonM_reserve(&b, sizeof(lon_SnapHeader));
+        values = lonM_reserve(&b, d->nvalues*sizeof(lon_SnapValue));
+        for (i = 0; i < d->nvalues; ++i) {
+            lonM_value(&b, &v, &d->values[i]);
+            memcpy(lon_buffer(out) + values + i*sizeof(v), &v, sizeof(v));
+        }
+        h = (lon_SnapHeader*)lon_buffer(out);
+        memcpy(h->magic, LON_SNAP_MAGIC, sizeof(LON_SNAP_MAGIC));
+        h->version = LON_SNAP_VERSION;
+        h->byteorder = LON_SNAP_BYTEORDER;
+        h->size = lon_buffsize(out);
+        h->srcsize = srcsize;
+        h->srcmtime = srcmtime;
+        h->values = values;
+        h->nvalues = d->nvalues;
+        h->checksum = lonM_checksum(lon_buffer(out) + sizeof(*h),
+                lon_buffsize(out) - sizeof(*h));
+    }
+    out->jbuf = jbuf;
+    free(b.slots);
+    return res;
+}
+
+
+/* reader */
+
+static int lonM_error(lon_Snap *s, const char *msg) {
+    snprintf(s->errmsg, sizeof(s->errmsg), "%s", msg);
+    return LON_ERR;
+}
+
+typedef struct lonM_Checker {
+    const char *base;
+    size_t size;
+    unsigned char *seen;         /* one bit per 8 byte aligned offset */
+    size_t *stack, n, cap;       /* tables waiting to be checked */
+    int nomem;
+} lonM_Checker;
+
+static int lonM_checkvalue(lonM_Checker *c, const lon_SnapValue *v) {
+    unsigned long long off = v->u.off, len;
+    size_t bit = (size_t)(off / 8);
+    switch (v->type) {
+    case LON_DT_NIL: case LON_DT_BOOLEAN:
+    case LON_DT_INTEGER: case LON_DT_NUMBER:
+        return 1;
+    case LON_DT_STRING:
+        if (off % 8 != 0 || off < sizeof(lon_SnapHeader)
+                || off > c->size - sizeof(len) - 1)
+            return 0;
+        memcpy(&len, c->base + off, sizeof(len));
+        return len <= c->size - off - sizeof(len) - 1;
+    case LON_DT_TABLE:
+        if (off % 8 != 0 || off < sizeof(lon_SnapHeader)
+                || off > c->size - sizeof(lon_SnapTable))
+            return 0;
+        if (c->seen[bit/8] & (1u << bit%8)) return 1;
+        c->seen[bit/8] |= (unsigned char)(1u << bit%8);
+        if (c->n == c->cap) {
+            size_t newcap = c->cap ? c->cap*2 : 64;
+            size_t *stack = (size_t*)realloc(c->stack,
+                    newcap*sizeof(size_t));
+            if (stack == NULL) return c->nomem = 1, 0;
+            c->stack = stack, c->cap = newcap;
+        }
+        c->stack[c->n++] = (size_t)off;
+        return 1;
+    }
+    return 0;
+}
+
+static int lonM_checktable(lonM_Checker *c, size_t off) {
+    const lon_SnapTable *t = (const lon_SnapTable*)(c->base + off);
+    const lon_SnapValue *v = lon_snap_array(t);
+    size_t i, n, room = (c->size - off - sizeof(*t)) / sizeof(lon_SnapValue);
+    if (t->narray > room || t->nfields > (room - t->narray) / 2)
+        return 0;
+    n = (size_t)(t->narray + t->nfields*2);
+    for (i = 0; i < n; ++i)
+        if (!lonM_checkvalue(c, &v[i])) return 0;
+    if (t->mask != 0) {
+        /* a power of two, with a free slot to end every probe */
+        const unsigned *index = (const unsigned*)(v + n);
+        size_t used = 0;
+        room = (c->size - off - sizeof(*t) - n*sizeof(lon_SnapValue))
+            / sizeof(unsigned);
+        if ((t->mask & (t->mask + 1)) != 0 || t->mask >= room)
+            return 0;
+        for (i = 0; i <= t->mask; ++i) {
+            if (index[i] > t->nfields) return 0;
+            used += index[i] != 0;
+        }
+        if (used > t->mask) return 0;
+    }
+    return 1;
+}
+
+static const char *lonM_check(const char *base, size_t size) {
+    /* each table is checked once, so shared (or cyclic) ones are fine */
+    const lon_SnapHeader *h = (const lon_SnapHeader*)base;
+    const lon_SnapValue *v = (const lon_SnapValue*)(base + h->values);
+    lonM_Checker c;
+    size_t i;
+    int ok = h->values % 8 == 0 && h->values >= sizeof(*h);
+    c.base = base, c.size = size;
+    c.stack = NULL, c.n = c.cap = 0, c.nomem = 0;
+    if ((c.seen = (unsigned char*)calloc(size/64 + 1, 1)) == NULL)
+        return "out of memory";
+    for (i = 0; ok && i < (size_t)h->nvalues; ++i)
+        ok = lonM_checkvalue(&c, &v[i]);
+    while (ok && c.n != 0)
+        ok = lonM_checktable(&c, c.stack[--c.n]);
+    free(c.stack);
+    free(c.seen);
+    return ok ? NULL : c.nomem ? "out of memory" : "corrupt snapshot";
+}
+
+LON_API int lon_snap_open(lon_Snap *s, const void *data, size_t size) {
+    /* 'data' must stay valid and 8 byte aligned while 's' is used */
+    const lon_SnapHeader *h = (const lon_SnapHeader*)data;
+    const char *msg;
+    s->base = NULL, s->size = 0, s->errmsg[0] = '\0';
+    if (size < sizeof(*h)
+            || memcmp(h->magic, LON_SNAP_MAGIC, sizeof(LON_SNAP_MAGIC)) != 0)
+        return lonM_error(s, "not a snapshot");
+    if (h->version != LON_SNAP_VERSION || h->byteorder != LON_SNAP_BYTEORDER)
+        return lonM_error(s, "snapshot version mismatch");
+    if (h->size != size || h->values > size
+            || h->nvalues > (size - h->values) / sizeof(lon_SnapValue))
+        return lonM_error(s, "truncated snapshot");
+    if (h->checksum != lonM_checksum((const char*)data + sizeof(*h),
+                size - sizeof(*h)))
+        return lonM_error(s, "snapshot checksum mismatch");
+    if ((msg = lonM_check((const char*)data, size)) != NULL)
+        return lonM_error(s, msg);
+    s->base = (const char*)data;
+    s->size = size;
+    return LON_OK;
+}
+
+static void lonM_unmap(lon_Snap *s) {
+#ifdef LON_SNAP_MMAP
+    if (s->mapped) munmap(s->map, s->mapsize);
+    else
+#endif
+    free(s->map);
+    s->map = NULL, s->mapsize = 0, s->mapped = 0;
+}
+
+static int lonM_map(lon_Snap *s, const char *filename) {
+    int res;
+#ifdef LON_SNAP_MMAP
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return LON_ERRFILE;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return LON_ERRFILE;
+    }
+    s->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        return LON_ERRFILE;
+    }
+    s->mapsize = (size_t)st.st_size;
+    s->mapped = 1;
+#else
+    FILE *fp = fopen(filename, "rb");
+    long size;
+    if (fp == NULL) return LON_ERRFILE;
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0
+            || fseek(fp, 0, SEEK_SET) != 0
+            || (s->map = malloc((size_t)size)) == NULL) {
+        fclose(fp);
+        return LON_ERRFILE;
+    }
+    s->mapsize = fread(s->map, 1, (size_t)size, fp);
+    fclose(fp);
+#endif
+    if ((res = lon_snap_open(s, s->map, s->mapsize)) != LON_OK)
+        lonM_unmap(s);
+    return res;
+}
+
+static int lonM_rebuild(lon_Snap *s, const char *snapfile, const char *srcfile,
+                        const struct stat *src) {
+    /* written aside under a name of its own and renamed, as other
+     * processes may have the old snapshot mapped or be rebuilding it */
+    lon_Loader L;
+    lon_Dom d;
+    lon_Buffer B, tmpname;
+    FILE *fp = NULL;
+    int res;
+    lon_initloader(&L);
+    lon_initdom(&d, LON_DOM_DEDUP);
+    lon_initbuffer(&B, NULL);
+    lon_initbuffer(&tmpname, NULL);
+    lon_setcallbacks(&L, &d.cb);
+    if ((res = lon_load_file(&L, srcfile)) != LON_OK)
+        lonM_error(s, lon_dom_error(&d) ? lon_dom_error(&d) : srcfile);
+    else if ((res = lon_snap_write(&d, &B, (unsigned long long)src->st_size,
+                    (long long)src->st_mtime)) != LON_OK)
+        lonM_error(s, "out of memory");
+    else if ((res = lon_tmpfile(&tmpname, snapfile)) != LON_OK)
+        lonM_error(s, "can not create snapshot");
+    else if ((fp = fopen(lon_buffer(&tmpname), "wb")) == NULL
+            || fwrite(lon_buffer(&B), 1, lon_buffsize(&B), fp)
+                != lon_buffsize(&B)
+            || (res = fclose(fp), fp = NULL, res) != 0
+            || (res = lon_replacefile(lon_buffer(&tmpname), snapfile))
+                != LON_OK) {
+        if (fp != NULL) fclose(fp);
+        remove(lon_buffer(&tmpname));
+        res = lonM_error(s, "can not write snapshot");
+    }
+    lon_freebuffer(&tmpname);
+    lon_freebuffer(&B);
+    lon_freedom(&d);
+    return res;
+}
+
+LON_API int lon_snap_load(lon_Snap *s, const char *snapfile,
+                          const char *srcfile) {
+    /* map 'snapfile', rebuilding it from 'srcfile' when it is stale.
+     * Staleness is judged by the size and mtime of 'srcfile' only, so
+     * an edit keeping both is missed; remove the snapshot after such
+     * edits. A NULL 'srcfile' maps 'snapfile' unchecked */
+    struct stat src;
+    int res;
+    memset(s, 0, sizeof(*s));
+    if (srcfile == NULL)
+        return lonM_map(s, snapfile);
+    if (stat(srcfile, &src) != 0) {
+        lonM_error(s, "can not stat source");
+        return LON_ERRFILE;
+    }
+    if ((res = lonM_map(s, snapfile)) == LON_OK) {
+        const lon_SnapHeader *h = (const lon_SnapHeader*)s->base;
+        if (h->srcsize == (unsigned long long)src.st_size
+                && h->srcmtime == (long long)src.st_mtime)
+            return LON_OK;
+    }
+    lonM_unmap(s);
+    if ((res = lonM_rebuild(s, snapfile, srcfile, &src)) != LON_OK)
+        return res;
+    return lonM_map(s, snapfile);
+}
+
+LON_API void lon_snap_close(lon_Snap *s) {
+    lonM_unmap(s);
+    s->base = NULL, s->size = 0;
+}
+
+LON_API const char *lon_snap_error(lon_Snap *s)
+{ return s->errmsg[0] ? s->errmsg : NULL; }
+
+LON_API const lon_SnapValue *lon_snap_values(const lon_Snap *s, size_t *pn) {
+    const lon_SnapHeader *h = (const lon_SnapHeader*)s->base;
+    if (h == NULL) {
+        if (pn) *pn = 0;
+        return NULL;
+    }
+    if (pn) *pn = (size_t)h->nvalues;
+    return (const lon_SnapValue*)(s->base + h->values);
+}
+
+LON_API const lon_SnapTable *lon_snap_totable(const lon_Snap *s,
+                                              const lon_SnapValue *v) {
+    if (v == NULL || v->type != LON_DT_TABLE) return NULL;
+    return (const lon_SnapTable*)(s->base + v->u.off);
+}
+
+LON_API const char *lon_snap_tostring(const lon_Snap *s,
+                                      const lon_SnapValue *v, size_t *plen) {
+    const char *p;
+    if (v == NULL || v->type != LON_DT_STRING) return NULL;
+    p = s->base + v->u.off;
+    if (plen) *plen = (size_t)*(const unsigned long long*)p;
+    return p + sizeof(unsigned long long);
+}
+
+static const lon_SnapValue *lonM_get(const lon_Snap *s,
+        const lon_SnapTable *t, const lon_SnapValue *key,
+        const char *str, size_t len) {
+    const lon_SnapValue *fields = lon_snap_fields(t);
+    const lon_SnapValue *k;
+    size_t i, klen;
+#define lonM_samekey(k) ((k)->type == key->type && (key->type == LON_DT_STRING ?\
+            (k)->hash == key->hash && lon_snap_tostring(s, (k), &klen) != NULL \
+            && klen == len && memcmp(s->base + (k)->u.off                   \
+                + sizeof(unsigned long long), str, len) == 0 :              \
+            (k)->u.i == key->u.i))
+    if (t->mask != 0) {
+        const unsigned *index = (const unsigned*)(fields + t->nfields*2);
+        unsigned h = lonM_keyhash(key) & t->mask;
+        for (; index[h] != 0; h = (h + 1) & t->mask) {
+            k = &fields[(index[h]-1)*2];
+            if (lonM_samekey(k)) return k + 1;
+        }
+        return NULL;
+    }
+    for (i = (size_t)t->nfields; i > 0; --i) {
+        k = &fields[(i-1)*2];
+        if (lonM_samekey(k)) return k + 1;
+    }
+    return NULL;
+#undef lonM_samekey
+}
+
+LON_API const lon_SnapValue *lon_snap_getfield(const lon_Snap *s,
+        const lon_SnapTable *t, const char *str, size_t len) {
+    lon_SnapValue key;
+    memset(&key, 0, sizeof(key));
+    key.type = LON_DT_STRING, key.hash = lon_hash(str, len);
+    return lonM_get(s, t, &key, str, len);
+}
+
+LON_API const lon_SnapValue *lon_snap_getindex(const lon_Snap *s,
+        const lon_SnapTable *t, lon_Integer i) {
+    lon_SnapValue key;
+    if (i >= 1 && (unsigned long long)i <= t->narray)
+        return &lon_snap_array(t)[i - 1];
+    memset(&key, 0, sizeof(key));
+    key.type = LON_DT_INTEGER, key.u.i = i;
+    return lonM_get(s, t, &key, NULL, 0);
+}
+
+
+LON_NS_END
+
+#endif /* LON_IMPLEMENTATION */
@@ -0,0 +1,419 @@
+/* lon_zio: readers for gzip and zstd compressed lon inputs
+ * author: starwing
+ * copyright: MIT licence (c) 2016 */
+#ifndef lon_zio_h
+#define lon_zio_h
+
+
+#include "lon.h"
+
+#include <stdio.h>
+
+#if !defined(_WIN32) && !defined(LON_ZIO_NO_THREAD)
+# define LON_ZIO_THREAD
+# include <pthread.h>
+#endif
+
+LON_NS_BEGIN
+
+#define LON_ZIO_PLAIN 0
+#define LON_ZIO_GZIP  1 /* needs LON_USE_ZLIB */
+#define LON_ZIO_ZSTD  2 /* needs LON_USE_ZSTD */
+
+#ifndef LON_ZIO_CHUNK
+# define LON_ZIO_CHUNK 65536 /* bytes of a ring slot */
+#endif
+
+#ifndef LON_ZIO_SLOTS
+# define LON_ZIO_SLOTS 4
+#endif
+
+typedef struct lon_ZReader lon_ZReader;
+
+/* lon_zclose() must be called even if lon_zopen() or lon_zinit() failed;
+ * the compression is detected by the magic bytes of the input */
+LON_API int  lon_zopen  (lon_ZReader *Z, const char *filename);
+LON_API int  lon_zinit  (lon_ZReader *Z, lon_Reader *reader, void *ud);
+LON_API void lon_zclose (lon_ZReader *Z);
+
+LON_API int         lon_zformat (lon_ZReader *Z);
+LON_API const char *lon_zerror  (lon_ZReader *Z);
+
+/* lon_Reader over the decompressed input, ud is the lon_ZReader */
+LON_API const char *lon_zreader (void *ud, size_t *plen);
+
+LON_API int lon_load_zfile (lon_Loader *L, const char *filename);
+
+
+/* structs */
+
+/* with LON_ZIO_THREAD a producer thread decompresses into a ring of
+ * LON_ZIO_SLOTS chunks, a chunk returned by lon_zreader() is given back
+ * to the producer on the next call; without it lon_zreader() decompresses
+ * one chunk at a time itself. Plain inputs are passed through */
+
+struct lon_ZReader {
+    int format;
+    lon_Reader *reader;      /* compressed input */
+    void *ud;
+    FILE *fp;                /* opened by lon_zopen() */
+    char *fbuff;
+
+    char magic[4];           /* read for detection, served first */
+    size_t magiclen;
+    const char *rest;        /* of the chunk read for detection */
+    size_t restlen;
+    const char *in;          /* pending compressed input */
+    size_t inlen;
+    int eof;                 /* reader returned NULL */
+    int done;                /* decompressor at end of a frame */
+    void *stream;            /* z_stream or ZSTD_DStream */
+
+    char *slots;
+    size_t lens[LON_ZIO_SLOTS];
+    unsigned head, count;    /* filled slots start at head - count */
+    int held;                /* slot returned by last lon_zreader() */
+    int finished;            /* a zero length slot was queued */
+#ifdef LON_ZIO_THREAD
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int started, stop;
+#endif
+
+    char errmsg[128];
+};
+
+
+LON_NS_END
+
+#endif /* lon_zio_h */
+
+
+#if defined(LON_IMPLEMENTATION) && !defined(lon_zio_implemented)
+#define lon_zio_implemented
+
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LON_USE_ZLIB
+# include <zlib.h>
+#endif
+
+#ifdef LON_USE_ZSTD
+# include <zstd.h>
+#endif
+
+
+LON_NS_BEGIN
+
+
+#define lonZ_slot(Z,i) ((Z)->slots + (size_t)(i) * LON_ZIO_CHUNK)
+
+static int lonZ_error(lon_ZReader *Z, const char *msg, int res) {
+    /* the first error wins, later ones are consequences */
+    if (Z->errmsg[0] == '\0')
+        snprintf(Z->errmsg, sizeof(Z->errmsg), "%s", msg);
+    return res;
+}
+
+static const char *lonZ_filereader(void *ud, size_t *plen) {
+    lon_ZReader *Z = (lon_ZReader*)ud;
+    size_t len = fread(Z->fbuff, 1, LON_ZIO_CHUNK, Z->fp);
+    if (len == 0) {
+        if (ferror(Z->fp)) lonZ_error(Z, "read error", LON_ERRFILE);
+        return NULL;
+    }
+    *plen = len;
+    return Z->fbuff;
+}
+
+static int lonZ_input(lon_ZReader *Z) {
+    /* make Z->in non-empty, 0 at end of compressed input */
+    while (Z->inlen == 0) {
+        if (Z->restlen != 0)
+            Z->in = Z->rest, Z->inlen = Z->restlen, Z->restlen = 0;
+        else if (Z->eof || (Z->in = Z->reader(Z->ud, &Z->inlen)) == NULL)
+            return Z->eof = 1, Z->inlen = 0, 0;
+    }
+    return 1;
+}
+
+static void lonZ_detect(lon_ZReader *Z) {
+    while (Z->magiclen < sizeof(Z->magic)) {
+        size_t len = 0, n;
+        const char *s = Z->reader(Z->ud, &len);
+        if (s == NULL) { Z->eof = 1; break; }
+        n = sizeof(Z->magic) - Z->magiclen;
+        if (n > len) n = len;
+        memcpy(Z->magic + Z->magiclen, s, n);
+        Z->magiclen += n;
+        Z->rest = s + n, Z->restlen = len - n;
+    }
+    Z->in = Z->magic, Z->inlen = Z->magiclen;
+    Z->format = LON_ZIO_PLAIN;
+    if (Z->magiclen >= 2 && memcmp(Z->magic, "\x1F\x8B", 2) == 0)
+        Z->format = LON_ZIO_GZIP;
+    else if (Z->magiclen == 4 && memcmp(Z->magic, "\x28\xB5\x2F\xFD", 4) == 0)
+        Z->format = LON_ZIO_ZSTD;
+}
+
+
+/* decompressors */
+
+#ifdef LON_USE_ZLIB
+static int lonZ_gzopen(lon_ZReader *Z) {
+    z_stream *zs = (z_stream*)calloc(1, sizeof(z_stream));
+    if ((Z->stream = zs) == NULL)
+        return lonZ_error(Z, "out of memory", LON_ERRMEM);
+    if (inflateInit2(zs, 15 + 32) != Z_OK) { /* gzip header */
+        free(zs), Z->stream = NULL;
+        return lonZ_error(Z, "can not initialize zlib", LON_ERRMEM);
+    }
+    return LON_OK;
+}
+
+static size_t lonZ_gzfill(lon_ZReader *Z, char *out, size_t size) {
+    z_stream *zs = (z_stream*)Z->stream;
+    zs->next_out = (Bytef*)out, zs->avail_out = (uInt)size;
+    while (zs->avail_out != 0 && lonZ_input(Z)) {
+        size_t feed;
+        int r;
+        if (Z->done) { /* concatenated gzip members */
+            if (inflateReset(zs) != Z_OK) break;
+            Z->done = 0;
+        }
+        /* avail_in is an uInt, larger inputs are fed in parts */
+        feed = Z->inlen < UINT_MAX ? Z->inlen : UINT_MAX;
+        zs->next_in = (Bytef*)Z->in, zs->avail_in = (uInt)feed;
+        r = inflate(zs, Z_NO_FLUSH);
+        Z->in = (const char*)zs->next_in, Z->inlen -= feed - zs->avail_in;
+        if (r == Z_STREAM_END)
+            Z->done = 1;
+        else if (r != Z_OK) {
+            lonZ_error(Z, zs->msg ? zs->msg : "corrupt gzip data", LON_ERR);
+            return 0;
+        }
+    }
+    if (zs->avail_out != 0 && !Z->done)
+        lonZ_error(Z, "truncated gzip data", LON_ERR);
+    return size - zs->avail_out;
+}
+
+static void lonZ_gzclose(lon_ZReader *Z) {
+    if (Z->stream) inflateEnd((z_stream*)Z->stream);
+    free(Z->stream);
+}
+#endif /* LON_USE_ZLIB */
+
+#ifdef LON_USE_ZSTD
+static int lonZ_zstdopen(lon_ZReader *Z) {
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    if ((Z->stream = ds) == NULL)
+        return lonZ_error(Z, "out of memory", LON_ERRMEM);
+    if (ZSTD_isError(ZSTD_initDStream(ds)))
+        return lonZ_error(Z, "can not initialize zstd", LON_ERRMEM);
+    Z->done = 1; /* nothing is not a truncated frame */
+    return LON_OK;
+}
+
+static size_t lonZ_zstdfill(lon_ZReader *Z, char *out, size_t size) {
+    ZSTD_outBuffer ob;
+    ob.dst = out, ob.size = size, ob.pos = 0;
+    while (ob.pos < size && lonZ_input(Z)) {
+        ZSTD_inBuffer ib;
+        size_t r;
+        ib.src = Z->in, ib.size = Z->inlen, ib.pos = 0;
+        r = ZSTD_decompressStream((ZSTD_DStream*)Z->stream, &ob, &ib);
+        Z->in += ib.pos, Z->inlen -= ib.pos;
+        if (ZSTD_isError(r)) {
+            lonZ_error(Z, ZSTD_getErrorName(r), LON_ERR);
+            return 0;
+        }
+        Z->done = (r == 0);
+    }
+    if (ob.pos < size && !Z->done)
+        lonZ_error(Z, "truncated zstd data", LON_ERR);
+    return ob.pos;
+}
+
+static void lonZ_zstdclose(lon_ZReader *Z)
+{ if (Z->stream) ZSTD_freeDStream((ZSTD_DStream*)Z->stream); }
+#endif /* LON_USE_ZSTD */
+
+static size_t lonZ_fill(lon_ZReader *Z, char *out) {
+    /* decompress a chunk, 0 at end of input or on error */
+    if (Z->errmsg[0]) return 0;
+#ifdef LON_USE_ZLIB
+    if (Z->format == LON_ZIO_GZIP) return lonZ_gzfill(Z, out, LON_ZIO_CHUNK);
+#endif
+#ifdef LON_USE_ZSTD
+    if (Z->format == LON_ZIO_ZSTD) return lonZ_zstdfill(Z, out, LON_ZIO_CHUNK);
+#endif
+    (void)out;
+    return 0;
+}
+
+
+/* ring */
+
+#ifdef LON_ZIO_THREAD
+static void *lonZ_producer(void *ud) {
+    lon_ZReader *Z = (lon_ZReader*)ud;
+    for (;;) {
+        unsigned slot;
+        size_t len;
+        pthread_mutex_lock(&Z->lock);
+        while (Z->count == LON_ZIO_SLOTS && !Z->stop)
+            pthread_cond_wait(&Z->cond, &Z->lock);
+        slot = Z->head;
+        if (Z->stop) {
+            pthread_mutex_unlock(&Z->lock);
+            break;
+        }
+        pthread_mutex_unlock(&Z->lock);
+        len = lonZ_fill(Z, lonZ_slot(Z, slot));
+        pthread_mutex_lock(&Z->lock);
+        Z->lens[slot] = len;
+        Z->head = (slot + 1) % LON_ZIO_SLOTS, ++Z->count;
+        pthread_cond_broadcast(&Z->cond);
+        pthread_mutex_unlock(&Z->lock);
+        if (len == 0) break;
+    }
+    return NULL;
+}
+#endif
+
+static int lonZ_start(lon_ZReader *Z) {
+    lonZ_detect(Z);
+    if (Z->errmsg[0]) return LON_ERRFILE;
+    if (Z->format == LON_ZIO_PLAIN) return LON_OK;
+#ifdef LON_USE_ZLIB
+    if (Z->format == LON_ZIO_GZIP && lonZ_gzopen(Z) != LON_OK)
+        return LON_ERRMEM;
+#else
+    if (Z->format == LON_ZIO_GZIP)
+        return lonZ_error(Z, "gzip input needs LON_USE_ZLIB", LON_ERR);
+#endif
+#ifdef LON_USE_ZSTD
+    if (Z->format == LON_ZIO_ZSTD && lonZ_zstdopen(Z) != LON_OK)
+        return LON_ERRMEM;
+#else
+    if (Z->format == LON_ZIO_ZSTD)
+        return lonZ_error(Z, "zstd input needs LON_USE_ZSTD", LON_ERR);
+#endif
+    if ((Z->slots = (char*)malloc(LON_ZIO_SLOTS * LON_ZIO_CHUNK)) == NULL)
+        return lonZ_error(Z, "out of memory", LON_ERRMEM);
+#ifdef LON_ZIO_THREAD
+    pthread_mutex_init(&Z->lock, NULL);
+    pthread_cond_init(&Z->cond, NULL);
+    if (pthread_create(&Z->thread, NULL, lonZ_producer, Z) != 0) {
+        pthread_cond_destroy(&Z->cond);
+        pthread_mutex_destroy(&Z->lock);
+        return lonZ_error(Z, "can not start thread", LON_ERR);
+    }
+    Z->started = 1;
+#endif
+    return LON_OK;
+}
+
+LON_API const char *lon_zreader(void *ud, size_t *plen) {
+    lon_ZReader *Z = (lon_ZReader*)ud;
+    unsigned tail;
+    if (Z->format == LON_ZIO_PLAIN) {
+        if (!lonZ_input(Z)) return NULL;
+        *plen = Z->inlen, Z->inlen = 0;
+        return Z->in;
+    }
+    if (Z->slots == NULL || Z->finished) return NULL;
+#ifdef LON_ZIO_THREAD
+    if (!Z->started) return NULL;
+    pthread_mutex_lock(&Z->lock);
+    if (Z->held) {
+        Z->held = 0, --Z->count;
+        pthread_cond_broadcast(&Z->cond);
+    }
+    while (Z->count == 0)
+        pthread_cond_wait(&Z->cond, &Z->lock);
+    Z->held = 1;
+    tail = (Z->head + LON_ZIO_SLOTS - Z->count) % LON_ZIO_SLOTS;
+    pthread_mutex_unlock(&Z->lock);
+#else
+    tail = 0;
+    Z->lens[0] = lonZ_fill(Z, lonZ_slot(Z, 0));
+#endif
+    if ((*plen = Z->lens[tail]) == 0) {
+        Z->finished = 1;
+        return NULL;
+    }
+    return lonZ_slot(Z, tail);
+}
+
+
+/* API */
+
+LON_API int lon_zinit(lon_ZReader *Z, lon_Reader *reader, void *ud) {
+    memset(Z, 0, sizeof(*Z));
+    Z->reader = reader, Z->ud = ud;
+    return lonZ_start(Z);
+}
+
+LON_API int lon_zopen(lon_ZReader *Z, const char *filename) {
+    memset(Z, 0, sizeof(*Z));
+    Z->reader = lonZ_filereader, Z->ud = Z;
+    if ((Z->fp = fopen(filename, "rb")) == NULL)
+        return lonZ_error(Z, "can not open file", LON_ERRFILE);
+    if ((Z->fbuff = (char*)malloc(LON_ZIO_CHUNK)) == NULL)
+        return lonZ_error(Z, "out of memory", LON_ERRMEM);
+    return lonZ_start(Z);
+}
+
+LON_API void lon_zclose(lon_ZReader *Z) {
+#ifdef LON_ZIO_THREAD
+    if (Z->started) {
+        pthread_mutex_lock(&Z->lock);
+        Z->stop = 1;
+        pthread_cond_broadcast(&Z->cond);
+        pthread_mutex_unlock(&Z->lock);
+        pthread_join(Z->thread, NULL);
+        pthread_cond_destroy(&Z->cond);
+        pthread_mutex_destroy(&Z->lock);
+        Z->started = 0;
+    }
+#endif
+#ifdef LON_USE_ZLIB
+    if (Z->format == LON_ZIO_GZIP) lonZ_gzclose(Z);
+#endif
+#ifdef LON_USE_ZSTD
+    if (Z->format == LON_ZIO_ZSTD) lonZ_zstdclose(Z);
+#endif
+    if (Z->fp) fclose(Z->fp);
+    free(Z->fbuff);
+    free(Z->slots);
+    Z->stream = NULL, Z->fp = NULL, Z->fbuff = Z->slots = NULL;
+}
+
+LON_API int lon_zformat(lon_ZReader *Z)
+{ return Z->format; }
+
+LON_API const char *lon_zerror(lon_ZReader *Z)
+{ return Z->errmsg[0] ? Z->errmsg : NULL; }
+
+LON_API int lon_load_zfile(lon_Loader *L, const char *filename) {
+    lon_ZReader Z;
+    int res = lon_zopen(&Z, filename);
+    if (res == LON_OK) {
+        L->name = filename;
+        res = lon_load(L, lon_zreader, &Z);
+    }
+    lon_zclose(&Z);
+    /* a parse error may be caused by the input being cut short */
+    return lon_zerror(&Z) != NULL && res != LON_ERRMEM ? LON_ERRFILE : res;
+}
+
+
+LON_NS_END
+
+#endif /* LON_IMPLEMENTATION */
@@ -12,33 +12,130 @@ extern "C" {
 #define LON_LUA_API
 #include "lon.h"
 
-#define LON_DUMPER "lon.Dumper"
+#include <errno.h>
+#ifdef _WIN32
+# include <io.h>
+# define lon_write _write
+#else
+# include <unistd.h>
+# define lon_write write
+#endif
+
+#define LON_DUMPER  "lon.Dumper"
+#define LON_DECODER "lon.Decoder"
+#define LON_EACH    "lon.Each"
+
+#ifndef LON_DECODER_MAXKEYS
+# define LON_DECODER_MAXKEYS 4096 /* interned keys kept across decodes */
+#endif
+
+#ifndef LON_DECODER_KEEPBUFFER
+# define LON_DECODER_KEEPBUFFER 65536 /* buffer bytes kept across decodes */
+#endif
 
 /* dumper */
 
+#define LON_SINK_BUFFER 0  /* collected in B, returned by finish() */
+#define LON_SINK_FILE   1
+#define LON_SINK_FUNC   2
+#define LON_SINK_FD     3
+
 typedef struct lonL_Dumper {
     lon_Dumper D;
     lon_Buffer B;
     lua_State *L;
+    int sink;      /* where output goes, LON_SINK_* */
+    int streaming; /* between begin() and finish() */
+    int writing;   /* inside the sink function */
+    int ref;       /* file handle or function, in the registry */
+    FILE *fp;
+    int fd;
 } lonL_Dumper;
 
+static void dump_sinkerror(lonL_Dumper *D) {
+    luaL_error(D->L, "cannot write dump: %s", strerror(errno));
+}
+
 static size_t dump_writer(void *ud, const char *s, size_t len) {
     lonL_Dumper *D = (lonL_Dumper*)ud;
-    if (!lon_addlstring(&D->B, s, len))
-        luaL_error(D->L, "out of memory");
+    size_t n;
+    int status;
+    switch (D->sink) {
+    case LON_SINK_BUFFER:
+        if (!lon_addlstring(&D->B, s, len))
+            luaL_error(D->L, "out of memory");
+        break;
+    case LON_SINK_FILE:
+        if (fwrite(s, 1, len, D->fp) != len)
+            dump_sinkerror(D);
+        break;
+    case LON_SINK_FUNC:
+        luaL_checkstack(D->L, 2, "dump callback");
+        lua_rawgeti(D->L, LUA_REGISTRYINDEX, D->ref);
+        lua_pushlstring(D->L, s, len);
+        D->writing = 1;  /* the dumper is mid-value, keep it out of reach */
+        status = lua_pcall(D->L, 1, 0, 0);
+        D->writing = 0;
+        if (status != LUA_OK)
+            lua_error(D->L);
+        break;
+    case LON_SINK_FD:
+        for (n = 0; n < len; ) {
+            int bytes = (int)lon_write(D->fd, s + n, (unsigned)(len - n));
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes <= 0)
+                dump_sinkerror(D);
+            n += (size_t)bytes;
+        }
+        break;
+    }
     return len;
 }
 
+static void dump_release(lonL_Dumper *D) {
+    /* back to the buffer sink, dropping any pending stream */
+    luaL_unref(D->L, LUA_REGISTRYINDEX, D->ref);
+    D->ref = LUA_NOREF;
+    D->sink = LON_SINK_BUFFER;
+    D->streaming = 0;
+    D->fp = NULL;
+    lon_resetbuffer(&D->B);
+}
+
+static lonL_Dumper *dump_check(lua_State *L) {
+    lonL_Dumper *D = (lonL_Dumper*)luaL_checkudata(L, 1, LON_DUMPER);
+    if (D->writing)
+        luaL_error(L, "dumper is writing, cannot use it from its sink");
+    D->L = L; /* errors and callbacks go to the calling thread */
+    return D;
+}
+
+static int dump_fileclosed(lonL_Dumper *D) {
+    /* the file sink may have been closed since begin() */
+    int closed;
+    if (D->sink != LON_SINK_FILE) return 0;
+    lua_rawgeti(D->L, LUA_REGISTRYINDEX, D->ref);
+    closed = ((luaL_Stream*)lua_touserdata(D->L, -1))->closef == NULL;
+    lua_pop(D->L, 1);
+    return closed;
+}
+
 static int Ldump_option(lua_State *L) {
     static const char *opts[] = {
         "compat", "indent", "newline", "return",
         "int_hexa", "num_hexa", "num_precision",
         "quote", NULL
     };
-    lonL_Dumper *D = (lonL_Dumper*)luaL_checkudata(L, 1, LON_DUMPER);
+    static const int flags[] = {
+        LON_OPT_COMPAT, LON_OPT_INDENT, LON_OPT_NEWLINE, LON_OPT_RETURN,
+        LON_OPT_INTHEXA, LON_OPT_FLTHEXA, LON_OPT_FLTPREC,
+        LON_OPT_QUOTE
+    };
+    lonL_Dumper *D = dump_check(L);
     int type = lua_type(L, 2);
     if (type == LUA_TSTRING) {
-        int flag = luaL_checkoption(L, 2, NULL, opts);
+        int flag = flags[luaL_checkoption(L, 2, NULL, opts)];
         if (lua_isnoneornil(L, 3)) {
             int value = lon_setdumpopt(&D->D, flag, 0);
             lon_setdumpopt(&D->D, flag, value);
@@ -51,8 +148,9 @@ static int Ldump_option(lua_State *L) {
         luaL_checktype(L, 2, LUA_TTABLE);
         lua_pushnil(L);
         while (lua_next(L, 2)) {
-            int flag = luaL_checkoption(L, -2, NULL, opts);
-            int value = (int)luaL_checkinteger(L, -1);
+            int flag = flags[luaL_checkoption(L, -2, NULL, opts)];
+            int value = lua_isboolean(L, -1) ? lua_toboolean(L, -1)
+                : (int)luaL_checkinteger(L, -1);
             lon_setdumpopt(&D->D, flag, value);
             lua_pop(L, 1);
         }
@@ -66,8 +164,15 @@ static int Ldump_new(lua_State *L) {
     luaL_setmetatable(L, LON_DUMPER);
     lon_initdumper(&D->D);
     lon_initbuffer(&D->B, NULL);
-    lon_setwriter(&D->D, dump_writer, &D);
+    lon_setwriter(&D->D, dump_writer, D);
+    D->sink = LON_SINK_BUFFER;
+    D->streaming = 0;
+    D->writing = 0;
+    D->ref = LUA_NOREF;
+    D->fp = NULL;
+    D->fd = -1;
     if (!lua_isnoneornil(L, 1)) {
+        lua_insert(L, 1);
         lua_pushcfunction(L, Ldump_option);
         lua_insert(L, 1);
         lua_call(L, lua_gettop(L)-1, 1);
@@ -77,20 +182,80 @@ static int Ldump_new(lua_State *L) {
 }
 
 static int Ldump_delete(lua_State *L) {
-    lonL_Dumper *D = (lonL_Dumper*)luaL_checkudata(L, 1, LON_DUMPER);
-    lon_resetbuffer(&D->B);
+    lonL_Dumper *D = dump_check(L);
+    dump_release(D);
+    lon_freebuffer(&D->B);
     return 0;
 }
 
 static int Ldump_dump(lua_State *L) {
-    lonL_Dumper *D = (lonL_Dumper*)luaL_checkudata(L, 1, LON_DUMPER);
+    lonL_Dumper *D = dump_check(L);
     int i, top = lua_gettop(L);
+    if (D->streaming)
+        return luaL_error(L, "dumper is streaming, finish() it first");
     lon_resetbuffer(&D->B);
     lon_dump_begin(&D->D);
-    for (i = 1; i <= top; ++i)
+    for (i = 2; i <= top; ++i)
         lon_dump_value(&D->D, L, i);
     lon_dump_end(&D->D);
     lua_pushlstring(L, lon_buffer(&D->B), lon_buffsize(&D->B));
+    lon_resetbuffer(&D->B);
+    return 1;
+}
+
+static int Ldump_begin(lua_State *L) {
+    /* d:begin([sink]): sink is a file handle, a function called with
+       each chunk, or a file descriptor; with none, finish() returns
+       the whole dump as a string */
+    lonL_Dumper *D = dump_check(L);
+    luaL_Stream *fh = (luaL_Stream*)luaL_testudata(L, 2, LUA_FILEHANDLE);
+    dump_release(D);
+    if (fh != NULL) {
+        if (fh->closef == NULL)
+            return luaL_error(L, "attempt to use a closed file");
+        D->sink = LON_SINK_FILE, D->fp = fh->f;
+    }
+    else if (lua_isfunction(L, 2))
+        D->sink = LON_SINK_FUNC;
+    else if (lua_isinteger(L, 2))
+        D->sink = LON_SINK_FD, D->fd = (int)lua_tointeger(L, 2);
+    else if (!lua_isnoneornil(L, 2))
+        return luaL_argerror(L, 2, "file, function or file descriptor expected");
+    if (D->sink != LON_SINK_BUFFER) {
+        lua_pushvalue(L, 2); /* keeps the handle alive, too */
+        D->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    D->streaming = 1;
+    lon_dump_begin(&D->D);
+    lua_settop(L, 1); return 1;
+}
+
+static int Ldump_value(lua_State *L) {
+    lonL_Dumper *D = dump_check(L);
+    int i, top = lua_gettop(L);
+    if (!D->streaming)
+        return luaL_error(L, "dumper is not streaming, begin() it first");
+    if (dump_fileclosed(D))
+        return luaL_error(L, "attempt to use a closed file");
+    for (i = 2; i <= top; ++i)
+        lon_dump_value(&D->D, L, i);
+    lua_settop(L, 1); return 1;
+}
+
+static int Ldump_finish(lua_State *L) {
+    lonL_Dumper *D = dump_check(L);
+    if (!D->streaming)
+        return luaL_error(L, "dumper is not streaming, begin() it first");
+    if (dump_fileclosed(D)) {
+        dump_release(D);  /* the stream is lost, do not keep it pending */
+        return luaL_error(L, "attempt to use a closed file");
+    }
+    lon_dump_end(&D->D);
+    if (D->sink == LON_SINK_BUFFER)
+        lua_pushlstring(L, lon_buffer(&D->B), lon_buffsize(&D->B));
+    else
+        lua_settop(L, 1);
+    dump_release(D);
     return 1;
 }
 
@@ -102,6 +267,9 @@ static void open_dumper(lua_State *L) {
         ENTRY(delete),
         ENTRY(option),
         ENTRY(dump),
+        ENTRY(begin),
+        ENTRY(value),
+        ENTRY(finish),
 #undef  ENTRY
         { NULL, NULL }
     };
@@ -113,6 +281,292 @@ static void open_dumper(lua_State *L) {
 }
 
 
+/* decoder */
+
+typedef struct lonL_Decoder {
+    lon_Loader L;
+    lon_Intern keys;
+    int loading; /* lon_load() left by a Lua error */
+} lonL_Decoder;
+
+static void load_recover(lon_Loader *L, int *loading) {
+    /* lua_state still points into the interrupted lon_load() */
+    if (*loading) {
+        L->lua_state = NULL;
+        L->cb = NULL;
+        lon_break(L, LON_OK);
+        *loading = 0;
+    }
+}
+
+static int Ldec_option(lua_State *L) {
+    static const char *opts[] = {
+        "features", "json", "maxlevel", "float", NULL
+    };
+    static const int flags[] = {
+        LON_LOPT_FEATURES, LON_LOPT_JSON, LON_LOPT_MAXLEVEL,
+        LON_LOPT_LUAFLOAT
+    };
+    lonL_Decoder *D = (lonL_Decoder*)luaL_checkudata(L, 1, LON_DECODER);
+    int type = lua_type(L, 2);
+    if (type == LUA_TSTRING) {
+        int flag = flags[luaL_checkoption(L, 2, NULL, opts)];
+        if (lua_isnoneornil(L, 3)) {
+            int value = lon_setloadopt(&D->L, flag, 0);
+            lon_setloadopt(&D->L, flag, value);
+            lua_pushinteger(L, value);
+            return 1;
+        }
+        lon_setloadopt(&D->L, flag, (int)luaL_checkinteger(L, 3));
+    }
+    else {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_pushnil(L);
+        while (lua_next(L, 2)) {
+            int flag = flags[luaL_checkoption(L, -2, NULL, opts)];
+            int value = lua_isboolean(L, -1) ? lua_toboolean(L, -1)
+                : (int)luaL_checkinteger(L, -1);
+            lon_setloadopt(&D->L, flag, value);
+            lua_pop(L, 1);
+        }
+    }
+    lua_settop(L, 1); return 1;
+}
+
+static int Ldec_new(lua_State *L) {
+    lonL_Decoder *D = (lonL_Decoder*)lua_newuserdata(L, sizeof(lonL_Decoder));
+    luaL_setmetatable(L, LON_DECODER);
+    lon_initloader(&D->L);
+    lon_initintern(&D->keys);
+    lon_setintern(&D->L, &D->keys);
+    lon_setloadopt(&D->L, LON_LOPT_KEEPBUFFER, LON_DECODER_KEEPBUFFER);
+    D->loading = 0;
+    if (!lua_isnoneornil(L, 1)) {
+        lua_insert(L, 1);
+        lua_pushcfunction(L, Ldec_option);
+        lua_insert(L, 1);
+        lua_call(L, lua_gettop(L)-1, 1);
+        return 1;
+    }
+    return 1;
+}
+
+static int Ldec_delete(lua_State *L) {
+    lonL_Decoder *D = (lonL_Decoder*)luaL_checkudata(L, 1, LON_DECODER);
+    load_recover(&D->L, &D->loading);
+    lon_freeloader(&D->L);
+    lon_freeintern(&D->keys);
+    return 0;
+}
+
+static int Ldec_decode(lua_State *L) {
+    /* errors are raised, not returned as lon.decode() does */
+    lonL_Decoder *D = (lonL_Decoder*)luaL_checkudata(L, 1, LON_DECODER);
+    size_t len;
+    const char *s = luaL_checklstring(L, 2, &len);
+    int top;
+    load_recover(&D->L, &D->loading);
+    lua_settop(L, 2);
+    top = lua_gettop(L);
+    lon_setluastate(&D->L, L);
+    D->loading = 1;
+    lon_load_buffer(&D->L, s, len);
+    D->loading = 0;
+    if (D->keys.count > LON_DECODER_MAXKEYS) {
+        lon_freeintern(&D->keys);
+        lon_initintern(&D->keys);
+    }
+    return lua_gettop(L) - top;
+}
+
+static void open_decoder(lua_State *L) {
+    luaL_Reg libs[] = {
+        { "__gc", Ldec_delete },
+#define ENTRY(name) { #name, Ldec_##name }
+        ENTRY(new),
+        ENTRY(delete),
+        ENTRY(option),
+        ENTRY(decode),
+#undef  ENTRY
+        { NULL, NULL }
+    };
+    if (luaL_newmetatable(L, LON_DECODER)) {
+        luaL_setfuncs(L, libs, 0);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+    }
+}
+
+
+/* iterator */
+
+typedef struct lonL_Each {
+    lon_Loader L;
+    lon_Intern keys;
+    int loading;       /* lon_load() left by a Lua error */
+    int done;
+    FILE *fp;          /* NULL when iterating over a string */
+    int owned;         /* fp opened by lon.each(), closed when done */
+    size_t pos, end;   /* next value and end of input */
+    size_t next;       /* next byte handed to the loader */
+    size_t bpos, blen; /* file offset and size of buffered bytes */
+    const char *name;
+    lua_State *ls;
+    char buff[LON_BUFFERSIZE];
+} lonL_Each;
+
+static void each_close(lonL_Each *E) {
+    if (E->owned && E->fp != NULL)
+        fclose(E->fp);
+    E->fp = NULL;
+    E->done = 1;
+}
+
+static const char *each_reader(void *ud, size_t *plen) {
+    /* a value ends inside the last bytes read, so the next one mostly
+       starts from them without seeking back */
+    lonL_Each *E = (lonL_Each*)ud;
+    size_t off, len;
+    if (E->next >= E->end) return NULL;
+    if (E->next < E->bpos || E->next > E->bpos + E->blen) {
+        if (lon_fseek(E->fp, E->next) != 0)
+            luaL_error(E->ls, "%s: cannot seek", E->name);
+        E->bpos = E->next, E->blen = 0;
+    }
+    if (E->next == E->bpos + E->blen) {
+        E->bpos = E->next;
+        E->blen = fread(E->buff, 1, LON_BUFFERSIZE, E->fp);
+        if (E->blen == 0) {
+            if (ferror(E->fp))
+                luaL_error(E->ls, "%s: read error", E->name);
+            return NULL;
+        }
+    }
+    off = E->next - E->bpos;
+    len = E->blen - off;
+    if (len > E->end - E->next) len = E->end - E->next;
+    E->next += len;
+    if (plen) *plen = len;
+    return E->buff + off;
+}
+
+static int each_step(lua_State *L) {
+    lonL_Each *E = (lonL_Each*)lua_touserdata(L, lua_upvalueindex(1));
+    int res;
+    load_recover(&E->L, &E->loading);
+    if (E->done) return 0;
+    if (E->fp != NULL && !E->owned) {
+        luaL_Stream *fh = (luaL_Stream*)lua_touserdata(L, lua_upvalueindex(2));
+        if (fh->closef == NULL)
+            return luaL_error(L, "attempt to use a closed file");
+    }
+    lua_settop(L, 0);
+    lon_setluastate(&E->L, L);
+    E->ls = L;
+    E->loading = 1;
+    if (E->fp == NULL) {
+        const char *s = lua_tostring(L, lua_upvalueindex(2));
+        res = lon_load_next_buffer(&E->L, s, E->end, &E->pos);
+    }
+    else {
+        E->next = E->pos;
+        E->L.name = E->name;
+        res = lon_load_next(&E->L, each_reader, E, &E->pos);
+    }
+    E->loading = 0;
+    if (E->keys.count > LON_DECODER_MAXKEYS) {
+        lon_freeintern(&E->keys);
+        lon_initintern(&E->keys);
+    }
+    if (res == LON_DONE) {
+        each_close(E);
+        return 0;
+    }
+    if (res != LON_OK)
+        return luaL_error(L, "unknown error");
+    lua_pushinteger(L, (lua_Integer)E->pos + 1);
+    lua_insert(L, 1);
+    return lua_gettop(L);
+}
+
+static int Leach_delete(lua_State *L) {
+    lonL_Each *E = (lonL_Each*)luaL_checkudata(L, 1, LON_EACH);
+    load_recover(&E->L, &E->loading);
+    each_close(E);
+    lon_freeloader(&E->L);
+    lon_freeintern(&E->keys);
+    return 0;
+}
+
+static int Leach(lua_State *L) {
+    /* for pos, value in lon.each(source [, i [, j]]): the top-level
+       values of a string, a file handle or "@filename", with the
+       position just after each, where a later lon.each() can resume;
+       i and j are string.sub() positions, but files take no negative
+       ones but j = -1 (to the end), as their size is not known */
+    luaL_Stream *fh = (luaL_Stream*)luaL_testudata(L, 1, LUA_FILEHANDLE);
+    size_t len = 0;
+    const char *s = fh ? NULL : luaL_checklstring(L, 1, &len);
+    lua_Integer i = luaL_optinteger(L, 2, 0);
+    lua_Integer j = luaL_optinteger(L, 3, -1);
+    lonL_Each *E;
+    lua_settop(L, 1);
+    E = (lonL_Each*)lua_newuserdata(L, sizeof(lonL_Each));
+    lon_initloader(&E->L);
+    lon_initintern(&E->keys);
+    lon_setintern(&E->L, &E->keys);
+    lon_setloadopt(&E->L, LON_LOPT_KEEPBUFFER, LON_DECODER_KEEPBUFFER);
+    E->loading = E->done = E->owned = 0;
+    E->fp = NULL;
+    E->bpos = E->blen = 0;
+    E->name = NULL;
+    luaL_setmetatable(L, LON_EACH);
+    if (s != NULL && *s != '@') { /* string.sub() positions */
+        if (i < 0) i = (size_t)-i > len ? 1 : (lua_Integer)len + i + 1;
+        else if (i == 0) i = 1;
+        else if ((size_t)i > len) i = (lua_Integer)len + 1;
+        if (j < 0) j = (size_t)-j > len ? 0 : (lua_Integer)len + j + 1;
+        else if ((size_t)j > len) j = (lua_Integer)len;
+        E->pos = (size_t)i - 1;
+        E->end = j < i ? E->pos : (size_t)j;
+    }
+    else {
+        luaL_argcheck(L, i >= 0, 2, "negative position in a file");
+        luaL_argcheck(L, j >= -1, 3, "negative position in a file");
+        if (fh != NULL) {
+            if (fh->closef == NULL)
+                return luaL_error(L, "attempt to use a closed file");
+            E->fp = fh->f, E->name = "[=file]";
+        }
+        else if ((E->fp = fopen(s+1, "rb")) != NULL)
+            E->owned = 1, E->name = s+1;
+        else
+            return luaL_error(L, "cannot open %s", s+1);
+        if (i > 0 && lon_fseek(E->fp, i-1) != 0)
+            return luaL_error(L, "%s: cannot seek", E->name);
+        if (i > 0)
+            E->pos = (size_t)i - 1;
+        else {
+            long pos = fh != NULL ? ftell(E->fp) : 0;
+            E->pos = pos < 0 ? 0 : (size_t)pos;
+        }
+        E->bpos = E->pos;
+        E->end = j < 0 ? (size_t)-1 : (size_t)j;
+    }
+    lua_pushvalue(L, 1);
+    lua_pushcclosure(L, each_step, 2);
+    return 1;
+}
+
+static void open_each(lua_State *L) {
+    if (luaL_newmetatable(L, LON_EACH)) {
+        lua_pushcfunction(L, Leach_delete);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+}
+
+
 /* high level interface */
 
 static size_t buff_writer(void *ud, const char *s, size_t len) {
@@ -147,18 +601,25 @@ static int safe_decode(lua_State *L) {
 
 static int Ldecode(lua_State *L) {
     lon_Loader loader;
+    lon_Intern keys;
+    int nret = 2;
     luaL_checkstring(L, 1);
     lua_settop(L, 1);
     lon_initloader(&loader);
+    lon_initintern(&keys);
+    lon_setintern(&loader, &keys);
     lua_pushcfunction(L, safe_decode);
     lua_pushlightuserdata(L, &loader);
     lua_pushvalue(L, 1);
     if (lua_pcall(L, 2, LUA_MULTRET, 0) == LUA_OK)
-        return lua_gettop(L)-1;
-    lon_break(&loader, LON_OK);
-    lua_pushnil(L);
-    lua_insert(L, -2);
-    return 2;
+        nret = lua_gettop(L)-1;
+    else {
+        lon_break(&loader, LON_OK);
+        lua_pushnil(L);
+        lua_insert(L, -2);
+    }
+    lon_freeintern(&keys);
+    return nret;
 }
 
 LUALIB_API int luaopen_lon(lua_State *L) {
@@ -166,11 +627,18 @@ LUALIB_API int luaopen_lon(lua_State *L) {
 #define ENTRY(name) { #name, L##name }
         ENTRY(encode),
         ENTRY(decode),
+        ENTRY(each),
 #undef  ENTRY
         { NULL, NULL }
     };
     open_dumper(L);
+    open_decoder(L);
+    open_each(L);
     luaL_newlib(L, libs);
+    luaL_getmetatable(L, LON_DUMPER);
+    lua_setfield(L, -2, "Dumper");
+    luaL_getmetatable(L, LON_DECODER);
+    lua_setfield(L, -2, "Decoder");
     return 1;
 }
 
@@ -1,15 +1,135 @@
 #define LON_IMPLEMENTATION
+#ifndef _WIN32
+# define LON_LOG_THREAD
+#endif
 #include "lon.h"
+#include "lon_schema.h"
+#include "lon_dom.h"
+#include "lon_snap.h"
+#include "lon_log.h"
+#include "lon_incr.h"
+#include "lon_diff.h"
+#include "lon_zio.h"
+
+typedef struct Point { int x, y; } Point;
+typedef struct Shape {
+    char name[16];
+    double scale;
+    Point points[4];
+    size_t npoints;
+} Shape;
+
+static lon_Field point_fields[] = {
+    LON_FIELD(Point, x, LON_FT_INT),
+    LON_FIELD(Point, y, LON_FT_INT),
+};
+static lon_Schema point_schema = LON_SCHEMA(Point, point_fields);
+
+static lon_Field shape_fields[] = {
+    LON_FIELD(Shape, name, LON_FT_STRING),
+    LON_FIELD(Shape, scale, LON_FT_FLOAT),
+    LON_FIELD_STRUCTARRAY(Shape, points, point_schema, npoints),
+};
+static lon_Schema shape_schema = LON_SCHEMA(Shape, shape_fields);
+
+typedef struct Series {
+    int ids[4];
+    size_t nids;
+    double xs[3];
+    short nxs;
+    float fs[2];
+    int nfs;
+} Series;
+
+static lon_Field series_fields[] = {
+    LON_FIELD_ARRAY(Series, ids, LON_FT_INT, nids),
+    LON_FIELD_ARRAY(Series, xs, LON_FT_FLOAT, nxs),
+    LON_FIELD_ARRAY(Series, fs, LON_FT_FLOAT, nfs),
+};
+static lon_Schema series_schema = LON_SCHEMA(Series, series_fields);
 
 static void on_error(void *ud, const char *errmsg) {
     printf("%s\n", errmsg);
 }
 
+static void on_events(void *ud, const lon_Event *evs, size_t n) {
+    static const char *names[] = { "begin", "end", "nil", "boolean",
+        "integer", "number", "string", "table_begin", "table_end" };
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        const lon_Event *ev = &evs[i];
+        printf("%*s%s/%d", ev->depth*2, "", names[ev->type], ev->status);
+        switch (ev->type) {
+        case LON_EV_BOOLEAN: printf(" %s", ev->u.b ? "true" : "false"); break;
+        case LON_EV_INTEGER: printf(" %d", (int)ev->u.i); break;
+        case LON_EV_NUMBER:  printf(" %g", (double)ev->u.n); break;
+        case LON_EV_STRING:  printf(" '%.*s'", (int)ev->len, ev->u.s); break;
+        }
+        printf("\n");
+    }
+    printf("-- %d events\n", (int)n);
+}
+
+static void on_raw_number(lon_Callbacks *cb, const char *s, size_t len,
+                          int is_int) {
+    lon_Integer i = 0;
+    lon_Number n = 0;
+    if (is_int) lon_tointeger(s, len, &i);
+    lon_tonumber(s, len, &n);
+    printf("raw %.*s %s %d %g\n", (int)len, s, is_int ? "int" : "flt",
+            (int)i, (double)n);
+}
+
+static void on_key(lon_Callbacks *cb, const char *s, size_t len,
+                   unsigned hash) {
+    printf("key %.*s %s\n", (int)len, s,
+            hash == lon_hash(s, len) ? "ok" : "bad hash");
+}
+
+static void on_interned_key(lon_Callbacks *cb, const lon_Key *key) {
+    printf("key #%u %s\n", key->id, key->s);
+}
+
 static size_t writer(void *ud, const char *s, size_t len) {
     printf("%.*s", len, s);
     return len;
 }
 
+static void on_change(void *ud, int what, const lon_Node *const *path,
+                      int depth, const lon_Node *old) {
+    static const char *names[] = { "add", "remove", "set" };
+    int i;
+    printf("change %s", names[what]);
+    for (i = 0; i < depth; ++i) {
+        const lon_Value *k = &path[i]->key;
+        if (k->type == LON_DT_STRING) printf(" %s", k->u.str.s);
+        else printf(" [%d]", (int)k->u.i);
+    }
+    if (old && old->value.type == LON_DT_INTEGER)
+        printf(" (was %d)", (int)old->value.u.i);
+    printf("\n");
+}
+
+static int edit(lon_Incr *I, char *doc, size_t start, size_t oldlen,
+                const char *s) {
+    size_t len = strlen(doc), newlen = strlen(s);
+    memmove(doc + start + newlen, doc + start + oldlen,
+            len - start - oldlen + 1);
+    memcpy(doc + start, s, newlen);
+    return lon_incr_edit(I, doc, strlen(doc), start, oldlen, newlen);
+}
+
+static int same_node(const lon_Node *a, const lon_Node *b) {
+    size_t i;
+    if (a->start != b->start || a->size != b->size || a->line != b->line
+            || a->lines != b->lines || a->nfields != b->nfields
+            || a->value.type != b->value.type)
+        return 0;
+    for (i = 0; i < a->nfields; ++i)
+        if (!same_node(&a->fields[i], &b->fields[i])) return 0;
+    return 1;
+}
+
 #define LOAD(str) lon_load_buffer(&L, "" str, sizeof(str)-1)
 
 int main(void) {
@@ -42,6 +162,510 @@ int main(void) {
     LOAD("--abc");
     LOAD("--[[abc]]");
     LOAD("--[[abc]]1");
+    LOAD("return -1, {-1,2,-3.5,4.25,x=-2,[-1]=-1e3,12345678901234,5}");
+    {
+        lon_Integer iv[] = { 1, -2, 3 };
+        lon_Number nv[] = { 0.5f, -1.5f };
+        lon_dump_begin(&D);
+        lon_dump_integer_array(&D, iv, 3);
+        lon_dump_table_begin(&D);
+        lon_dump_string(&D, "n");
+        lon_dump_number_array(&D, nv, 2);
+        lon_dump_number_array(&D, nv, 2);
+        lon_dump_table_end(&D);
+        lon_dump_end(&D);
+    }
+
+    /* strict subset */
+    lon_setloadopt(&L, LON_LOPT_FEATURES, LON_FEAT_STRICT);
+    LOAD("return {1,2,'abc',[\"k\"]=1.5}");
+    LOAD("1 -- comment");
+    LOAD("[[long]]");
+    LOAD("'a\\z  b'");
+    LOAD("'\\u{41}'");
+    LOAD("'\xe4\xb8\xad'");
+    LOAD("0x10");
+    lon_setloadopt(&L, LON_LOPT_FEATURES, LON_FEAT_ALL);
+
+    /* schema */
+    {
+        lon_SchemaDecoder SD;
+        Shape shape = { "" };
+        lon_initschemadecoder(&SD, &shape_schema, &shape);
+        lon_setcallbacks(&L, &SD.cb);
+        LOAD("{name='tri',scale=2,points={{x=1,y=2},{x=3},{y=4}},z=0}");
+        lon_dump_begin(&D);
+        lon_dump_struct(&D, &shape_schema, &shape);
+        lon_dump_end(&D);
+        lon_initschemadecoder(&SD, &shape_schema, &shape);
+        lon_setcallbacks(&L, &SD.cb);
+        LOAD("{scale='big'}");
+        printf("%s\n", lon_schema_error(&SD));
+        lon_setcallbacks(&L, NULL);
+        printf("schema: name %s, name\\0x %s\n",
+                lon_schema_field(&shape_schema, "name", 4) ? "found" : "missing",
+                lon_schema_field(&shape_schema, "name\0x", 6) ? "found" : "missing");
+    }
+
+    /* schema arrays filled by numeral runs */
+    {
+        lon_SchemaDecoder SD;
+        Series sr;
+        memset(&sr, 0, sizeof(sr));
+        lon_initschemadecoder(&SD, &series_schema, &sr);
+        lon_setcallbacks(&L, &SD.cb);
+        LOAD("{ids={1,2,3,[4]=-4}, xs={1,2.5,3}, fs={0.5,1.5}, 7, 8}");
+        printf("schema runs: ids %d %d %d %d (%d), xs %g %g %g (%d), "
+                "fs %g %g (%d)\n", sr.ids[0], sr.ids[1], sr.ids[2], sr.ids[3],
+                (int)sr.nids, sr.xs[0], sr.xs[1], sr.xs[2], (int)sr.nxs,
+                sr.fs[0], sr.fs[1], sr.nfs);
+        lon_initschemadecoder(&SD, &series_schema, &sr);
+        lon_setcallbacks(&L, &SD.cb);
+        LOAD("{ids={1,2,3,4,5}}");
+        printf("%s\n", lon_schema_error(&SD));
+        lon_initschemadecoder(&SD, &series_schema, &sr);
+        lon_setcallbacks(&L, &SD.cb);
+        LOAD("{ids={1.5}}");
+        printf("%s\n", lon_schema_error(&SD));
+        lon_setcallbacks(&L, NULL);
+    }
+
+    /* event tape */
+    {
+        lon_Tape T;
+        lon_inittape(&T, on_events, NULL);
+        lon_settape(&L, &T);
+        LOAD("return 1, {true,x=1.5,['y']={'z'}}, nil");
+        lon_settape(&L, NULL);
+    }
+
+    /* raw numerals */
+    {
+        lon_Callbacks cb = { NULL };
+        cb.on_raw_number = on_raw_number;
+        cb.on_key = on_key;
+        lon_setcallbacks(&L, &cb);
+        LOAD("return 1, -2.50, {0x10, -3, 1e2, [7]=0.0}");
+        lon_setcallbacks(&L, &cb);
+        LOAD("{a=1, name_2={['a b']=2, [ [[long]] ]=3}}");
+        lon_setcallbacks(&L, NULL);
+    }
+
+    /* verbatim transcoding */
+    lon_setdumpopt(&D, LON_OPT_VERBATIM, 1);
+    LOAD("return {1.0000000000000002, 'a\\n\"b', [[\n\nx]], 0x10, -7,"
+            " ['k']=\"\\u{48}\\z\n  i\", [ [[l]] ]=1e300, [\"and\"]=-0}");
+    lon_setdumpopt(&D, LON_OPT_COMPAT, 1);
+    LOAD("return {1.0000000000000002, 'a\\n\"b', [[\n\nx]], 0x10, -7,"
+            " ['k']=\"\\u{48}\\z\n  i\", [ [[l]] ]=1e300, [\"and\"]=-0}");
+    lon_setdumpopt(&D, LON_OPT_COMPAT, 0);
+    lon_setdumpopt(&D, LON_OPT_VERBATIM, 0);
+
+    /* JSON reader and writer */
+    lon_setloadopt(&L, LON_LOPT_JSON, 1);
+    LOAD("{\"a\": [1, -2.5, 1e2, \"x\\u00e9\\ud83d\\ude00\\/\"], "
+            "\"b\": {\"c\": null, \"d\": true}, \"e\": []}\n[0] \"s\"");
+    lon_setdumpopt(&D, LON_OPT_JSON, 1);
+    LOAD("{\"a\": [1, -2.5, 1e2, \"x\\u00e9\\ud83d\\ude00\\/\"], "
+            "\"b\": {\"c\": null, \"d\": true}, \"e\": []}\n[0] \"s\"");
+    LOAD("[1, 2,]");
+    LOAD("{\"a\": 01}");
+    {
+        lon_Tape T;
+        lon_inittape(&T, on_events, NULL);
+        lon_settape(&L, &T);
+        LOAD("[-0, 0, -0.0, -1]");
+        lon_settape(&L, NULL);
+    }
+    LOAD("\"a\tb\"");
+    LOAD("[0x10]");
+    LOAD("[.5]");
+    LOAD("[1.]");
+    LOAD("[1e]");
+    lon_setloadopt(&L, LON_LOPT_JSON, 0);
+    LOAD("return {1, 2, x = 3, [{1}] = {4}, 5}, {a = 1, 2, [5] = 'q\\0'}, 1e999");
+    lon_setdumpopt(&D, LON_OPT_JSON, 0);
+
+    /* interned keys */
+    {
+        lon_Callbacks cb = { NULL };
+        lon_Intern I;
+        lon_initintern(&I);
+        lon_setintern(&L, &I);
+        cb.on_interned_key = on_interned_key;
+        lon_setcallbacks(&L, &cb);
+        LOAD("{{id=1,name='a'},{id=2,name='b'},{['id']=3,type='c'}}");
+        printf("%d keys, #1 is %s\n", (int)I.count, lon_getkey(&I, 1)->s);
+        lon_setintern(&L, NULL);
+        lon_freeintern(&I);
+    }
+
+    /* DOM with shared subtables */
+    {
+        lon_Dom dom;
+        lon_DomStats st;
+        lon_Table *t;
+        lon_initdom(&dom, LON_DOM_DEDUP);
+        lon_setcallbacks(&L, &dom.cb);
+        LOAD("{a={1,2,{x=1}}, b={1,2,{x=1}}, c={x=1}, d={x=1.0}}");
+        lon_dom_stats(&dom, &st);
+        t = lon_dom_values(&dom, NULL)[0].u.t;
+        printf("dom: %d tables, %d shared, a%sb, c%sa[3], c%sd\n",
+                (int)st.tables, (int)st.shared,
+                t->fields[0].value.u.t == t->fields[1].value.u.t ? "==" : "!=",
+                t->fields[2].value.u.t ==
+                    t->fields[0].value.u.t->array[2].u.t ? "==" : "!=",
+                t->fields[2].value.u.t == t->fields[3].value.u.t ? "==" : "!=");
+        printf("dom: a[2]=%d, d.x=%g, e %s\n",
+                (int)lon_dom_getindex(&dom,
+                    lon_dom_getfield(&dom, t, "a", 1)->u.t, 2)->u.i,
+                (double)lon_dom_getfield(&dom,
+                    lon_dom_getfield(&dom, t, "d", 1)->u.t,
+                    "x", 1)->u.n,
+                lon_dom_getfield(&dom, t, "e", 1) ? "found" : "missing");
+        lon_freedom(&dom);
+    }
+
+    /* DOM key index of a large table */
+    {
+        static const char *keys[] = { "k1", "k2", "k3", "k4", "k5",
+            "k6", "k7", "k8", "k9", "long key" };
+        lon_Dom dom;
+        lon_Table *t;
+        int i, found = 0;
+        lon_initdom(&dom, 0);
+        lon_setcallbacks(&L, &dom.cb);
+        LOAD("{k1=1,k2=2,k3=3,k4=4,k5=5,k6=6,k7=7,k8=8,k9=9,"
+             "['long key']=10,k1=11,[20]=12}");
+        lon_setcallbacks(&L, NULL);
+        t = lon_dom_values(&dom, NULL)[0].u.t;
+        for (i = 0; i < 10; ++i) {
+            const lon_Value *v = lon_dom_getfield(&dom, t, keys[i],
+                    strlen(keys[i]));
+            if (v && v->u.i == (i == 0 ? 11 : i + 1)) ++found;
+        }
+        printf("dom: %s, %d of 10 keys, [20]=%d, zz %s\n",
+                t->index != lonO_noindex ? "hashed" : "scanned", found,
+                (int)lon_dom_getindex(&dom, t, 20)->u.i,
+                lon_dom_getfield(&dom, t, "zz", 2) ? "found" : "missing");
+        lon_freedom(&dom);
+    }
+
+    /* DOM: explicit integer keys stay out of the array part */
+    {
+        lon_Dom dom;
+        lon_Table *a, *b;
+        lon_initdom(&dom, 0);
+        lon_setcallbacks(&L, &dom.cb);
+        LOAD("{{[1]='a','b'}, {'b',[1]='a'}}");
+        lon_setcallbacks(&L, NULL);
+        a = lon_dom_values(&dom, NULL)[0].u.t->array[0].u.t;
+        b = lon_dom_values(&dom, NULL)[0].u.t->array[1].u.t;
+        printf("dom: [1]= first: %s (%d in array), last: %s (%d in array)\n",
+                lon_dom_getindex(&dom, a, 1)->u.str.s, (int)a->narray,
+                lon_dom_getindex(&dom, b, 1)->u.str.s, (int)b->narray);
+        lon_freedom(&dom);
+    }
+
+    /* snapshot of a loaded document */
+    {
+        lon_Dom dom;
+        lon_Buffer B;
+        lon_Snap snap;
+        const lon_SnapTable *t;
+        size_t len;
+        lon_initdom(&dom, LON_DOM_DEDUP);
+        lon_initbuffer(&B, NULL);
+        lon_setcallbacks(&L, &dom.cb);
+        LOAD("return {a={1,2,{x=1}}, b={1,2,{x=1}}, s='str', [5]=true}, 2.5");
+        lon_snap_write(&dom, &B, 0, 0);
+        printf("snap: open %d, ", lon_snap_open(&snap, lon_buffer(&B),
+                    lon_buffsize(&B)));
+        t = lon_snap_totable(&snap, lon_snap_values(&snap, &len));
+        printf("%d values, a%sb, s=%s, [5]=%d, %g\n", (int)len,
+                lon_snap_getfield(&snap, t, "a", 1)->u.off ==
+                    lon_snap_getfield(&snap, t, "b", 1)->u.off ? "==" : "!=",
+                lon_snap_tostring(&snap,
+                    lon_snap_getfield(&snap, t, "s", 1), NULL),
+                (int)lon_snap_getindex(&snap, t, 5)->u.i,
+                lon_snap_values(&snap, NULL)[1].u.n);
+        lon_buffer(&B)[lon_buffsize(&B)-1] ^= 1;
+        lon_snap_open(&snap, lon_buffer(&B), lon_buffsize(&B));
+        printf("snap: %s\n", lon_snap_error(&snap));
+        lon_buffer(&B)[lon_buffsize(&B)-1] ^= 1;
+        ((lon_SnapValue*)(lon_buffer(&B) + sizeof(lon_SnapHeader)))->u.off =
+            lon_buffsize(&B) - 8;
+        ((lon_SnapHeader*)lon_buffer(&B))->checksum = lonM_checksum(
+                lon_buffer(&B) + sizeof(lon_SnapHeader),
+                lon_buffsize(&B) - sizeof(lon_SnapHeader));
+        lon_snap_open(&snap, lon_buffer(&B), lon_buffsize(&B));
+        printf("snap: %s\n", lon_snap_error(&snap));
+        lon_freebuffer(&B);
+        lon_freedom(&dom);
+    }
+
+    /* snapshot kept beside its source */
+    {
+        lon_Snap snap;
+        FILE *fp = fopen("test.lon", "wb");
+        fputs("return {a = 1}", fp);
+        fclose(fp);
+        remove("test.snap");
+        printf("snap: load %d, ",
+                lon_snap_load(&snap, "test.snap", "test.lon"));
+        printf("a=%d\n", (int)lon_snap_getfield(&snap, lon_snap_totable(&snap,
+                        lon_snap_values(&snap, NULL)), "a", 1)->u.i);
+        lon_snap_close(&snap);
+        fp = fopen("test.snap", "r+b");
+        fputs("junk", fp);
+        fclose(fp);
+        printf("snap: load %d, ", lon_snap_load(&snap, "test.snap", NULL));
+        printf("%s\n", lon_snap_error(&snap));
+        remove("test.snap");
+        remove("test.lon");
+    }
+
+    /* binary round trip */
+    {
+        lon_Buffer B;
+        int i;
+        lon_initbuffer(&B, NULL);
+        lon_setbuffer(&D, &B);
+        lon_setdumpopt(&D, LON_OPT_BINARY, 2);
+        LOAD("return {1,2,-3,4.5,'s',x={y=true},[10]=nil}, {x=1,y=2}");
+        lon_setdumpopt(&D, LON_OPT_BINARY, 0);
+        lon_setwriter(&D, writer, NULL);
+        printf("binary: %d bytes\n", (int)lon_buffsize(&B));
+        lon_load_buffer(&L, lon_buffer(&B), lon_buffsize(&B));
+        lon_resetbuffer(&B);
+        lon_addstring(&B, LON_BINARY_MAGIC);
+        lon_addchar(&B, LON_BINARY_VERSION);
+        for (i = 0; i < 100000; ++i)
+            lon_addchar(&B, 0x06); /* LON_BT_TABLE */
+        printf("binary: %d\n", lon_validate_buffer(&L, lon_buffer(&B),
+                    lon_buffsize(&B)));
+        lon_freebuffer(&B);
+    }
+
+    /* offset index and field loading */
+    {
+        const char *doc = "return {\n a = 1,\n b = {x=1},\n 'c', [10] = 5\n}";
+        const lon_IndexEntry *e;
+        lon_Index I;
+        size_t n;
+        lon_initindex(&I, 1);
+        lon_setindex(&L, &I);
+        lon_validate_buffer(&L, doc, strlen(doc));
+        lon_setindex(&L, NULL);
+        e = lon_index_entries(&I, &n);
+        printf("index: %d fields, b at %d+%d line %d\n", (int)n,
+                (int)lon_index_find(&I, "b", 1)->offset,
+                (int)lon_index_find(&I, "b", 1)->size,
+                lon_index_find(&I, "b", 1)->line + 1);
+        lon_load_field_buffer(&L, doc, strlen(doc), lon_index_find(&I, "b", 1));
+        lon_load_field_buffer(&L, doc, strlen(doc), &e[2]);
+        lon_freeindex(&I);
+        doc = "{['kk'] = 1, [ [[l]] ] = 2, [3] = 'v'}";
+        lon_initindex(&I, 1);
+        lon_setindex(&L, &I);
+        lon_validate_buffer(&L, doc, strlen(doc));
+        lon_setindex(&L, NULL);
+        printf("index: kk %s, l %s\n",
+                lon_index_find(&I, "kk", 2) ? "found" : "missing",
+                lon_index_find(&I, "l", 1) ? "found" : "missing");
+        lon_freeindex(&I);
+    }
+
+    /* record log */
+    {
+        lon_Log g;
+        lon_Dumper *ld;
+        remove("test.log");
+        lon_log_open(&g, "test.log");
+        ld = lon_log_begin(&g, "a", 1);
+        lon_dump_integer(ld, 1);
+        lon_log_commit(&g);
+        lon_log_put(&g, "b", 1, "return 'b'", 10);
+        ld = lon_log_begin(&g, "a", 1);
+        lon_dump_table_begin(ld);
+        lon_dump_string(ld, "x");
+        lon_dump_integer(ld, 2);
+        lon_log_commit(&g);
+        lon_log_remove(&g, "b", 1);
+        lon_log_compact(&g);
+        lon_log_close(&g);
+        lon_log_open(&g, "test.log");
+        printf("log: %d live, %d records, b %s\n", (int)g.live,
+                (int)g.records, lon_log_find(&g, "b", 1, NULL) ? "found"
+                : "removed");
+        lon_log_get(&g, &L, "a", 1);
+        lon_log_put(&g, "c", 1, "return 'c'", 10);
+        lon_log_compact_start(&g);
+        lon_log_put(&g, "b", 1, "return 'b2'", 11);
+        lon_log_remove(&g, "c", 1);
+        printf("log: compact %d, ", lon_log_compact_finish(&g));
+        printf("%d live, %d records, b=%.11s\n", (int)g.live,
+                (int)g.records, lon_log_find(&g, "b", 1, NULL));
+        lon_log_close(&g);
+        lon_log_open(&g, "test.log");
+        printf("log: %d live, %d records\n", (int)g.live, (int)g.records);
+        lon_log_get(&g, &L, "a", 1);
+        lon_log_close(&g);
+        remove("test.log");
+    }
+
+    /* incremental re-parse */
+    {
+        lon_Incr I;
+        char doc[256] = "return {\n a = 1,\n b = { x = 'y', z = 2 },\n"
+            " c = {1, 2, 3},\n}";
+        lon_initincr(&I, on_change, NULL);
+        lon_incr_load(&I, doc, strlen(doc));
+        edit(&I, doc, strstr(doc, "'y'") - doc, 3, "'yy'");
+        printf("reparsed: %d\n", (int)I.reparsed);
+        edit(&I, doc, strstr(doc, "2, 3") - doc, 1, "\n 20");
+        printf("reparsed: %d\n", (int)I.reparsed);
+        edit(&I, doc, strstr(doc, "z = 2") - doc, 5, "z = 2, w = 4");
+        edit(&I, doc, strstr(doc, "a = 1") - doc, 1, "aa");
+        printf("%s: %d\n", doc, (int)lon_incr_root(&I)->fields[0]
+                .fields[2].fields[2].line);
+        {
+            lon_Incr full;
+            lon_initincr(&full, NULL, NULL);
+            lon_incr_load(&full, doc, strlen(doc));
+            printf("tree: %s\n", same_node(lon_incr_root(&I),
+                        lon_incr_root(&full)) ? "same" : "differs");
+            lon_freeincr(&full);
+        }
+        printf("edit: %d\n", edit(&I, doc, strstr(doc, "{1") - doc, 1, ""));
+        printf("%s\n", lon_incr_error(&I));
+        lon_freeincr(&I);
+    }
+
+    /* structural diff and patch */
+    {
+        const lon_Value *a, *b, *p;
+        lon_Dom dom;
+        lon_Buffer B;
+        int ops;
+        lon_initdom(&dom, LON_DOM_DEDUP);
+        lon_initbuffer(&B, NULL);
+        lon_setcallbacks(&L, &dom.cb);
+        LOAD("return {name='a', ports={80,443}, debug=true, "
+                "db={host='h', pool={1,2}}, 'x', 'y'}");
+        a = lon_dom_values(&dom, NULL);
+        lon_setcallbacks(&L, &dom.cb);
+        LOAD("return {name='b', ports={80,443,8080}, "
+                "db={host='h', pool={1,2}}, log='x', 'x'}");
+        b = lon_dom_values(&dom, NULL);
+        lon_setbuffer(&D, &B);
+        ops = lon_diff(&D, &dom, a, &dom, b);
+        lon_setwriter(&D, writer, NULL);
+        printf("diff: %d operations\n%.*s", ops, (int)lon_buffsize(&B),
+                lon_buffer(&B));
+        lon_setcallbacks(&L, &dom.cb);
+        lon_load_buffer(&L, lon_buffer(&B), lon_buffsize(&B));
+        p = lon_dom_values(&dom, NULL);
+        lon_setcallbacks(&L, NULL);
+        lon_patch(&L, &dom, a, p);
+        lon_setcallbacks(&L, &dom.cb);
+        lon_patch(&L, &dom, a, p);
+        lon_resetbuffer(&B);
+        lon_setbuffer(&D, &B);
+        ops = lon_diff(&D, &dom, b, &dom, lon_dom_values(&dom, NULL));
+        lon_setwriter(&D, writer, NULL);
+        printf("patched: %d operations left\n", ops);
+        lon_setcallbacks(&L, &dom.cb);
+        LOAD("return {{'set', {'db', 'pool', 3}, 3}, {'del', {'x', 1}}}");
+        p = lon_dom_values(&dom, NULL);
+        lon_setcallbacks(&L, NULL);
+        printf("patch: %d\n", lon_patch(&L, &dom, a, p));
+        lon_freebuffer(&B);
+        lon_freedom(&dom);
+    }
+
+    /* validation only */
+    {
+        const char *ok = "return {1, 2.5, x='y', [-3]={}}";
+        const char *bad = "return {1, 2.5e, 3}";
+        printf("validate: %d\n", lon_validate_buffer(&L, ok, strlen(ok)));
+        printf("validate: %d\n", lon_validate_buffer(&L, bad, strlen(bad)));
+        printf("offset: %d\n", (int)lon_offset(&L));
+    }
+
+    /* compressed input */
+    {
+        /* gzip member with one stored deflate block */
+        static const char gz[] = "\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\x03"
+            "\x01\x12\x00\xed\xff" "return {1, x=\"gz\"}"
+            "\xd5\xda\x37\x98\x12\x00\x00\x00";
+        const char *plain = "return 'plain'";
+        lon_ZReader Z;
+        FILE *fp = fopen("test.gz", "wb");
+        fwrite(gz, 1, sizeof(gz)-1, fp);
+        fclose(fp);
+        lon_zopen(&Z, "test.gz");
+        printf("zio: format %d, %s\n", lon_zformat(&Z),
+                lon_zerror(&Z) ? lon_zerror(&Z) : "ok");
+        lon_zclose(&Z);
+#ifdef LON_USE_ZLIB
+        lon_load_zfile(&L, "test.gz");
+#endif
+        fp = fopen("test.gz", "wb");
+        fwrite(plain, 1, strlen(plain), fp);
+        fclose(fp);
+        printf("zio: %d\n", lon_load_zfile(&L, "test.gz"));
+        remove("test.gz");
+    }
+
+    /* table level limit */
+    lon_setloadopt(&L, LON_LOPT_MAXLEVEL, 2);
+    LOAD("return {{1}}");
+    LOAD("return {{{1}}}");
+    lon_setloadopt(&L, LON_LOPT_MAXLEVEL, 0);
+
+    /* load buffers kept between loads */
+    {
+        static char s[40000];
+        lon_Loader K;
+        const char *block;
+        int same;
+        memset(s, 'x', sizeof(s) - 1);
+        s[0] = s[4000] = '\'', s[4001] = '\0';
+        lon_initloader(&K);
+        lon_setloadopt(&K, LON_LOPT_KEEPBUFFER, 16384);
+        lon_load_string(&K, s);
+        block = K.buffer.buff;
+        lon_load_string(&K, s);
+        same = K.buffer.buff == block;
+        printf("keep: %u bytes, %s block", (unsigned)K.buffer.capacity,
+                same ? "same" : "new");
+        s[4000] = s[4001] = 'x', s[sizeof(s) - 2] = '\'';
+        lon_load_string(&K, s);
+        printf(", %u bytes after a long string\n",
+                (unsigned)K.buffer.capacity);
+        lon_freeloader(&K);
+    }
+
+    /* values loaded one at a time */
+    {
+        static const char s[] = "return 1, {2, 3},\n \"x\" return nil";
+        static const char js[] = "[1] {\"a\": 2}\n3";
+        size_t pos = 0;
+        int res;
+        while ((res = lon_load_next_buffer(&L, s, sizeof(s)-1, &pos)) == 0)
+            printf(" -- next at %u\n", (unsigned)pos);
+        printf("next: %d at %u\n", res, (unsigned)pos);
+        lon_setloadopt(&L, LON_LOPT_JSON, 1);
+        pos = 4;
+        while ((res = lon_load_next_buffer(&L, js, sizeof(js)-1, &pos)) == 0)
+            printf(" -- next at %u\n", (unsigned)pos);
+        lon_setloadopt(&L, LON_LOPT_JSON, 0);
+        pos = 0;
+        res = lon_load_next_buffer(&L, "1,", 2, &pos);
+        res = lon_load_next_buffer(&L, "1,", 2, &pos);
+        printf("next: %d\n", res);
+    }
 
     return 0;
 }
@@ -0,0 +1,67 @@
+#include "lon.hpp"
+
+#include <cstdio>
+
+struct Printer : lon::Handler<Printer> {
+    lon_Loader *L;
+    explicit Printer(lon_Loader *L) : L(L) {}
+
+    void indent() {
+        const char *kind[] = { "top", "key", "value" };
+        printf("%*s%s ", lon_levels(L)*2, "", kind[lon_status(L)]);
+    }
+
+    void on_error(std::string_view msg)
+    { printf("error: %.*s\n", (int)msg.size(), msg.data()); }
+
+    void on_nil() { indent(); printf("nil\n"); }
+    void on_boolean(bool v) { indent(); printf("%s\n", v ? "true" : "false"); }
+    void on_integer(lon_Integer v) { indent(); printf("%lld\n", (long long)v); }
+    void on_number(lon_Number v) { indent(); printf("%g\n", (double)v); }
+    void on_string(std::string_view s)
+    { indent(); printf("'%.*s'\n", (int)s.size(), s.data()); }
+    void on_table_begin() { indent(); printf("{\n"); }
+    void on_table_end() { printf("%*s}\n", lon_levels(L)*2, ""); }
+};
+
+struct Runs : Printer {
+    explicit Runs(lon_Loader *L) : Printer(L) {}
+
+    void on_integer_array(lon_Integer index, const lon_Integer *v, size_t n)
+    { indent(); printf("[%d..] %d integers from %lld\n", (int)index, (int)n, (long long)v[0]); }
+    void on_number_array(lon_Integer index, const lon_Number *v, size_t n)
+    { indent(); printf("[%d..] %d numbers from %g\n", (int)index, (int)n, (double)v[0]); }
+};
+
+/* events are direct calls: the parser is instantiated on the handler, and
+ * no lon_Callbacks is installed while it runs */
+struct Direct : lon::Handler<Direct> {
+    lon_Loader *L;
+    int n = 0, indirect = 0;
+    explicit Direct(lon_Loader *L) : L(L) {}
+
+    void on_integer(lon_Integer) { ++n; indirect += L->cb != NULL; }
+};
+
+static_assert(std::is_same_v<decltype(&lon::detail::lon_parser<Direct>),
+                             void (*)(lon_Loader *, Direct &)>,
+              "parser is not instantiated on the handler");
+
+int main() {
+    lon::Loader loader;
+    Printer p(loader.get());
+    loader.load_buffer(p, "return 1, 2.5, nil, 'a\\tb', {-1,x=true,['y z']={}}");
+    loader.load_buffer(p, "{1,,2}");
+
+    /* same loader as C: numeral runs, JSON texts */
+    Runs r(loader.get());
+    loader.load_buffer(r, "return {1, 2, 3, 0.5, 1.5, 'x', 4}");
+    loader.setloadopt(LON_LOPT_JSON, 1);
+    loader.load_buffer(r, "{\"a\": [1, 2]} [null]");
+    loader.setloadopt(LON_LOPT_JSON, 0);
+
+    Direct d(loader.get());
+    loader.load_buffer(d, "return 1, {2, 3}");
+    printf("direct: %d integers, %d through callbacks\n", d.n, d.indirect);
+    return 0;
+}
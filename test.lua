@@ -16,3 +16,85 @@ local t = {
 print(lon.encode(t))
 print(lon.decode(lon.encode(t)))
 print(lon.encode(lon.decode(lon.encode(t))))
+
+-- 32 positional values fill the pending fields, keyed ones follow
+local fields = {}
+for i = 1, 32 do fields[#fields+1] = tostring(i) end
+for i = 1, 64 do fields[#fields+1] = 'k'..i..'='..i end
+local p = lon.decode("return {" .. table.concat(fields, ",") .. "}")
+assert(#p == 32 and p[32] == 32 and p.k64 == 64)
+print(#p, p.k64)
+
+-- dumper sinks: string, function and file output all match dump()
+local d = lon.Dumper.new()
+local ref = d:dump(t, 'x')
+assert(d:begin():value(t):value('x'):finish() == ref)
+local chunks = {}
+d:begin(function(s) chunks[#chunks+1] = s end):value(t, 'x'):finish()
+assert(table.concat(chunks) == ref)
+local name = os.tmpname()
+local f = assert(io.open(name, 'wb'))
+d:begin(f):value(t, 'x'):finish()
+f:close()
+f = assert(io.open(name, 'rb'))
+assert(f:read('a') == ref)
+f:close()
+-- a file closed while streaming, and a sink using its own dumper
+f = assert(io.open(name, 'wb'))
+d:begin(f):value(1)
+f:close()
+assert(not pcall(d.finish, d))
+assert(d:dump(1) == lon.encode(1))
+d:begin(function() d:begin() end):value(t)
+local ok, err = pcall(d.finish, d)
+assert(not ok and err:find('sink'))
+os.remove(name)
+print('sinks ok')
+
+-- lon.each: resume a string from a returned position
+local src = "1, {2}, 'three'"
+local seen, last = {}, nil
+for pos, v in lon.each(src) do
+   seen[#seen+1] = v
+   if #seen == 2 then last = pos break end
+end
+assert(seen[1] == 1 and seen[2][1] == 2)
+for pos, v in lon.each(src, last) do seen[#seen+1] = v end
+assert(#seen == 3 and seen[3] == 'three')
+-- files by name and by handle, an early break, and __gc closing it
+f = assert(io.open(name, 'wb'))
+f:write(src)
+f:close()
+local n = 0
+for _, v in lon.each('@' .. name) do n = n + 1 end
+assert(n == 3)
+f = assert(io.open(name, 'rb'))
+for pos, v in lon.each(f) do last = pos break end
+collectgarbage()
+for _, v in lon.each(f, last) do n = n + 1 end
+f:close()
+assert(n == 5)
+for _ in lon.each('@' .. name) do break end
+collectgarbage()
+assert(not pcall(lon.each, '@' .. name, 1, -2))
+os.remove(name)
+print('each ok')
+
+-- array parts come out positional; shared tables are fine, cycles are not
+local a = { 1, 2, 3, x = 4 }
+assert(not lon.encode(a):find('[', 1, true))
+local shared = { 1 }
+assert(lon.decode(lon.encode({ shared, shared }))[2][1] == 1)
+a.self = a
+assert(not pcall(lon.encode, a))
+print('encode ok')
+
+-- a Decoder is reused across decodes, also after one failed midway
+local dec = lon.Decoder.new { maxlevel = 2 }
+local long = string.rep('x', 5000)
+assert(dec:decode("return '" .. long .. "'") == long)
+assert(not pcall(dec.decode, dec, "return {1, {2, {3}}}"))
+assert(not pcall(dec.decode, dec, "return {1, 2"))
+local r, n2 = dec:decode("return {k = '" .. long .. "'}, 2")
+assert(r.k == long and n2 == 2)
+print('decoder ok')